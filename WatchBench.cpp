@@ -0,0 +1,451 @@
+/**
+	filewatchbench, microbenchmarks for the paths every event and command
+	takes inside the library. Kernel reads are replaced by synthetic
+	inotify records handed in through an EventRing, so decoding, path
+	lookup, fan out and dispatch are measured without the kernel. The
+	command queue and the event queue are driven by several producer
+	threads to show how they scale. Each line reports nanoseconds and
+	heap allocations per event or command. A thread count of 0 means the
+	events were dispatched inline by the reading thread.
+
+	usage: filewatchbench [options]
+		--events N      events or commands per case, default 1000000
+		--threads LIST  comma separated producer counts, default 1,2,4,8
+		--dirs N        directories of the watched tree, default 64
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/FileWatcher.h>
+#include <FileWatcher/EventQueue.h>
+#include <FileWatcher/FileWatcherFake.h>
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <vector>
+
+/// Records per synthetic read
+#define RECORDS_PER_READ 4096
+
+static std::atomic<unsigned long long> gAllocations(0);
+
+void* operator new(size_t size)
+{
+	gAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* memory = malloc(size ? size : 1);
+	if(!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+/// The counterpart of the replaced operator new. Kept out of line so the
+/// compiler pairs the deletes with that operator new, not with malloc.
+__attribute__((noinline)) static void release(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory) noexcept
+{
+	release(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	release(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	release(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+	release(memory);
+}
+
+struct Settings
+{
+	size_t events;
+	std::vector<size_t> threads;
+	size_t dirs;
+
+	Settings()
+		: events(1000000), dirs(64)
+	{
+		threads.push_back(1);
+		threads.push_back(2);
+		threads.push_back(4);
+		threads.push_back(8);
+	}
+};
+
+/// Start and end of a measurement
+class Measure
+{
+public:
+	Measure()
+		: mStart(std::chrono::steady_clock::now()), mAllocations(gAllocations.load())
+	{}
+
+	/// Prints a result line for count events
+	void report(const char* name, size_t threads, size_t count) const
+	{
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - mStart).count();
+		double allocations = (double)(gAllocations.load() - mAllocations);
+		printf("%-28s %7zu %10zu %10.1f %10.2f %12.0f\n", name, threads, count,
+			ns / count, allocations / count, count / ns * 1e9);
+		fflush(stdout);
+	}
+
+private:
+	std::chrono::steady_clock::time_point mStart;
+	unsigned long long mAllocations;
+};
+
+/// Hands the watcher's read buffer to the benchmark instead of the kernel
+class SyntheticRing : public FW::EventRing
+{
+public:
+	SyntheticRing() : mBuffer(0), mSize(0) {}
+
+	bool submitRead(int fd, void* buffer, size_t size, unsigned long long tag)
+	{
+		mBuffer = (char*)buffer;
+		mSize = size;
+		return true;
+	}
+
+	char* mBuffer;
+	size_t mSize;
+};
+
+class CountingListener : public FW::FileWatchListener
+{
+public:
+	CountingListener() : mCount(0) {}
+
+	void handleFileAction(FW::WatchID watchid, const FW::String& dir, const FW::String& filename, FW::Action action)
+	{
+		mCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::atomic<size_t> mCount;
+};
+
+//--------
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+
+//--------
+static FW::String makeTree(size_t dirs)
+{
+	char base[] = "/tmp/filewatchbench-XXXXXX";
+	if(!mkdtemp(base))
+	{
+		perror("mkdtemp");
+		exit(1);
+	}
+
+	for(size_t i = 0; i < dirs; ++i)
+	{
+		char path[256];
+		snprintf(path, sizeof(path), "%s/d%zu", base, i);
+		mkdir(path, 0755);
+	}
+	return base;
+}
+
+/// Writes records for watch descriptors 1 to wds into buffer and returns
+/// the bytes used. A fresh inotify instance numbers its watches from 1.
+static size_t fillRecords(char* buffer, size_t size, size_t wds, unsigned int mask, size_t nameLength, size_t& records)
+{
+	size_t used = 0;
+	for(size_t i = 0; i < RECORDS_PER_READ; ++i)
+	{
+		char name[256];
+		snprintf(name, sizeof(name), "f%zu", i);
+		size_t length = strlen(name);
+		while(length < nameLength && length + 1 < sizeof(name))
+			name[length++] = 'x';
+		name[length] = 0;
+
+		// names are padded the way the kernel does
+		size_t padded = (length + 1 + 15) & ~(size_t)15;
+		if(used + sizeof(struct inotify_event) + padded > size)
+			break;
+
+		struct inotify_event* event = (struct inotify_event*)(buffer + used);
+		event->wd = (int)(i % wds) + 1;
+		event->mask = mask;
+		event->cookie = 0;
+		event->len = (uint32_t)padded;
+		memset(event->name, 0, padded);
+		memcpy(event->name, name, length);
+		used += sizeof(struct inotify_event) + padded;
+		++records;
+	}
+	return used;
+}
+
+/// Feeds synthetic reads to a recursive watch and reports the cost per
+/// dispatched event
+static void benchDecode(const Settings& settings, const char* name, unsigned int mask, size_t nameLength,
+	const FW::WatchOptions& options, unsigned int poolThreads)
+{
+	FW::String base = makeTree(settings.dirs);
+	CountingListener listener;
+	{
+		FW::FileWatcher watcher;
+		if(poolThreads)
+			watcher.setDispatchThreads(poolThreads, true);
+
+		FW::WatchOptions recursive = options;
+		recursive.recursive = true;
+		watcher.addWatch(base, &listener, recursive);
+
+		SyntheticRing ring;
+		watcher.setEventRing(&ring, 1);
+		size_t records = 0;
+		size_t length = fillRecords(ring.mBuffer, ring.mSize, settings.dirs + 1, mask, nameLength, records);
+
+		// warm up the path cache and the allocator
+		watcher.completeRead((int)length);
+		watcher.flush();
+		listener.mCount = 0;
+
+		// settled changesets are not delivered inside the loop, so the cost
+		// is counted per record fed when nothing reached the listener
+		size_t fed = 0;
+		Measure measure;
+		while(fed < settings.events)
+		{
+			watcher.completeRead((int)length);
+			fed += records;
+		}
+		watcher.flush();
+		size_t delivered = listener.mCount.load();
+		measure.report(name, poolThreads, delivered ? delivered : fed);
+
+		// the read queued last is cancelled before detaching
+		watcher.completeRead(-ECANCELED);
+		watcher.setEventRing(0, 0);
+	}
+	nftw(base.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/// Producers queue commands while one thread runs update()
+static void benchCommands(const Settings& settings, size_t producers)
+{
+	FW::BufferedFileWatcher watcher;
+	std::atomic<bool> running(true);
+	std::thread consumer([&]() {
+		while(running.load())
+			watcher.update();
+		watcher.update();
+	});
+
+	size_t perProducer = settings.events / producers;
+	Measure measure;
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < producers; ++i)
+	{
+		threads.push_back(std::thread([&watcher, perProducer]() {
+			// removing an unknown watch makes update() do nothing but dequeue
+			for(size_t j = 0; j < perProducer; ++j)
+				watcher.removeWatch((FW::WatchID)0x7fffffff);
+		}));
+	}
+	for(size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	running = false;
+	consumer.join();
+	measure.report("command queue", producers, perProducer * producers);
+}
+
+/// Producers push events into a bounded queue drained by one thread
+static void benchEventQueue(const Settings& settings, size_t producers, FW::QueuePolicy policy, const char* name)
+{
+	CountingListener listener;
+	FW::EventQueue queue(FW::QueueOptions(65536, policy), true);
+	for(size_t i = 0; i < producers; ++i)
+		queue.setListener((FW::WatchID)(i + 1), &listener);
+
+	std::thread consumer([&]() {
+		while(queue.waitAndDispatch(std::chrono::milliseconds(10)))
+		{
+		}
+	});
+
+	size_t perProducer = settings.events / producers;
+	FW::String dir = "/tmp/filewatchbench/dir";
+	Measure measure;
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < producers; ++i)
+	{
+		threads.push_back(std::thread([&queue, &dir, perProducer, i]() {
+			char name[32];
+			for(size_t j = 0; j < perProducer; ++j)
+			{
+				snprintf(name, sizeof(name), "f%zu", j);
+				queue.handleFileAction((FW::WatchID)(i + 1), dir, name, FW::Actions::Modified);
+			}
+		}));
+	}
+	for(size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	while(queue.getStats().depth > 0)
+		std::this_thread::yield();
+	measure.report(name, producers, perProducer * producers);
+
+	queue.close();
+	consumer.join();
+}
+
+/// Events injected into the fake backend, through the AsyncFileWatcher
+/// threads to the listener
+static void benchFake(const Settings& settings, const FW::QueueOptions& queue, const char* name)
+{
+	FW::FileWatcherFake* fake = new FW::FileWatcherFake();
+	FW::AsyncFileWatcher watcher(fake, queue);
+	CountingListener listener;
+
+	FW::WatchBatch batch;
+	for(size_t i = 0; i < settings.dirs; ++i)
+	{
+		char dir[64];
+		snprintf(dir, sizeof(dir), "/filewatchbench/d%zu", i);
+		batch.addWatch(dir, &listener);
+	}
+	std::vector<FW::WatchResult> results = watcher.submit(batch).get();
+
+	size_t perWatch = settings.events / results.size();
+	Measure measure;
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		// in chunks, so delivery starts while the rest is injected
+		for(size_t sent = 0; sent < perWatch; sent += RECORDS_PER_READ)
+			fake->inject(results[i].watchid, "file", FW::Actions::Modified, std::min((size_t)RECORDS_PER_READ, perWatch - sent));
+	}
+
+	size_t total = perWatch * results.size();
+	while(listener.mCount.load() < total)
+		std::this_thread::yield();
+	measure.report(name, queue.capacity ? 2 : 1, total);
+}
+
+//--------
+static std::vector<size_t> parseList(const char* text)
+{
+	std::vector<size_t> values;
+	while(*text)
+	{
+		char* end;
+		size_t value = strtoull(text, &end, 10);
+		if(end == text)
+			break;
+		if(value)
+			values.push_back(value);
+		text = *end == ',' ? end + 1 : end;
+	}
+	return values;
+}
+
+//--------
+static void usage()
+{
+	fprintf(stderr, "usage: filewatchbench [--events N] [--threads LIST] [--dirs N]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	Settings settings;
+	for(int i = 1; i < argc; ++i)
+	{
+		FW::String arg = argv[i];
+		if(i + 1 >= argc)
+			usage();
+
+		const char* value = argv[++i];
+		if(arg == "--events")
+			settings.events = strtoull(value, 0, 10);
+		else if(arg == "--threads")
+			settings.threads = parseList(value);
+		else if(arg == "--dirs")
+			settings.dirs = strtoull(value, 0, 10);
+		else
+			usage();
+	}
+	if(!settings.events || settings.threads.empty())
+		usage();
+
+	printf("%-28s %7s %10s %10s %10s %12s\n", "case", "threads", "events", "ns/event", "allocs", "events/s");
+
+	FW::WatchOptions plain;
+	benchDecode(settings, "decode short names", IN_CLOSE_WRITE, 0, plain, 0);
+	benchDecode(settings, "decode long names", IN_CLOSE_WRITE, 40, plain, 0);
+	benchDecode(settings, "fan out create+close", IN_CREATE | IN_CLOSE_WRITE, 0, plain, 0);
+
+	FW::WatchOptions scheduled;
+	scheduled.priority = 1;
+	benchDecode(settings, "scheduler", IN_CLOSE_WRITE, 0, scheduled, 0);
+
+	FW::WatchOptions settled;
+	settled.settleTime = 1000;
+	benchDecode(settings, "changeset collector", IN_CLOSE_WRITE, 0, settled, 0);
+
+	for(size_t i = 0; i < settings.threads.size(); ++i)
+		benchDecode(settings, "dispatch pool", IN_CLOSE_WRITE, 0, plain, (unsigned int)settings.threads[i]);
+
+	benchFake(settings, FW::QueueOptions(), "fake backend");
+	benchFake(settings, FW::QueueOptions(65536, FW::QueuePolicies::Block), "fake backend queue");
+
+	for(size_t i = 0; i < settings.threads.size(); ++i)
+		benchCommands(settings, settings.threads[i]);
+
+	for(size_t i = 0; i < settings.threads.size(); ++i)
+		benchEventQueue(settings, settings.threads[i], FW::QueuePolicies::Block, "event queue block");
+	for(size_t i = 0; i < settings.threads.size(); ++i)
+		benchEventQueue(settings, settings.threads[i], FW::QueuePolicies::Coalesce, "event queue coalesce");
+
+	return 0;
+}
@@ -0,0 +1,542 @@
+/**
+	filewatchd, a local daemon that owns one FileWatcher and shares its
+	watches with the processes of its user through a Unix socket.
+	Clients subscribe with FW::WatchClient; subscriptions to the same
+	directory share one watch and each event is encoded once for all
+	subscribers.
+
+	usage: filewatchd [socket path]
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/FileWatcher.h>
+#include <FileWatcher/PathRouter.h>
+#include <FileWatcher/WatchProtocol.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <map>
+#include <set>
+#include <vector>
+
+/// Bytes queued for a client before its events are dropped
+#define MAX_CLIENT_BUFFER (4 * 1024 * 1024)
+/// Milliseconds between two watcher updates while nothing happens
+#define UPDATE_INTERVAL 10
+
+static volatile sig_atomic_t gStop = 0;
+
+static void onSignal(int)
+{
+	gStop = 1;
+}
+
+class WatchDaemon : public FW::FileWatchListener
+{
+public:
+	WatchDaemon()
+		: mListenFD(-1)
+	{
+	}
+
+	~WatchDaemon()
+	{
+		while(!mClients.empty())
+			dropClient(mClients.begin()->first);
+
+		if(mListenFD >= 0)
+		{
+			close(mListenFD);
+			unlink(mSocketPath.c_str());
+		}
+	}
+
+	bool listen(const FW::String& path)
+	{
+		struct sockaddr_un address;
+		if(path.size() >= sizeof(address.sun_path))
+		{
+			fprintf(stderr, "Error: socket path too long\n");
+			return false;
+		}
+
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		memcpy(address.sun_path, path.c_str(), path.size());
+
+		// refuse to take over the socket of a daemon that still answers
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(probe < 0)
+		{
+			perror("socket");
+			return false;
+		}
+		bool running = connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+		int error = errno;
+		close(probe);
+		if(running)
+		{
+			fprintf(stderr, "Error: a daemon already listens on %s\n", path.c_str());
+			return false;
+		}
+
+		// a socket left behind by a daemon of ours that died
+		struct stat attrib;
+		if(error == ECONNREFUSED && lstat(path.c_str(), &attrib) == 0 && S_ISSOCK(attrib.st_mode) && attrib.st_uid == geteuid())
+			unlink(path.c_str());
+
+		mListenFD = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(mListenFD < 0)
+		{
+			perror("socket");
+			return false;
+		}
+
+		// only the owner may connect, mode 0600
+		mode_t mask = umask(0177);
+		int bound = bind(mListenFD, (struct sockaddr*)&address, sizeof(address));
+		umask(mask);
+		if(bound < 0 || ::listen(mListenFD, 64) < 0)
+		{
+			perror(path.c_str());
+			close(mListenFD);
+			mListenFD = -1;
+			return false;
+		}
+
+		mSocketPath = path;
+		return true;
+	}
+
+	void run()
+	{
+		std::vector<struct pollfd> fds;
+		while(!gStop)
+		{
+			fds.clear();
+			struct pollfd listener = { mListenFD, POLLIN, 0 };
+			fds.push_back(listener);
+
+			std::map<int, Client>::iterator iter = mClients.begin();
+			for(; iter != mClients.end(); ++iter)
+			{
+				struct pollfd client = { iter->first, POLLIN, 0 };
+				if(iter->second.mOutput.size() > iter->second.mSent)
+					client.events |= POLLOUT;
+				fds.push_back(client);
+			}
+
+			if(poll(&fds[0], fds.size(), UPDATE_INTERVAL) < 0 && errno != EINTR)
+			{
+				perror("poll");
+				break;
+			}
+
+			if(fds[0].revents & POLLIN)
+				accept();
+
+			for(size_t i = 1; i < fds.size(); ++i)
+			{
+				if(!mClients.count(fds[i].fd))
+					continue;
+				if(fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+					receive(fds[i].fd);
+			}
+
+			mWatcher.update();
+
+			// flush what the update produced right away
+			std::vector<int> clients;
+			for(iter = mClients.begin(); iter != mClients.end(); ++iter)
+				clients.push_back(iter->first);
+			for(size_t i = 0; i < clients.size(); ++i)
+				flush(clients[i]);
+		}
+	}
+
+	/// Called by mRouter for each subscription under dir
+	void handleFileAction(FW::WatchID subscription, const FW::String& dir, const FW::String& filename, FW::Action action)
+	{
+		std::map<FW::WatchID, Subscription>::iterator sub = mSubscriptions.find(subscription);
+		if(sub == mSubscriptions.end())
+			return;
+
+		Client& client = mClients[sub->second.mClient];
+		if(client.mLagging)
+			return;
+
+		mFrame.clear();
+		{
+			FW::WatchProtocol::Writer writer(mFrame, FW::WatchProtocol::Event);
+			writer.put32((uint32_t)subscription);
+			writer.put8((uint8_t)action);
+			writer.put32((uint32_t)dir.size());
+			writer.put(dir);
+			writer.put(filename);
+		}
+
+		if(client.mOutput.size() - client.mSent + mFrame.size() > MAX_CLIENT_BUFFER)
+		{
+			// told with Actions::Overflow once it has caught up
+			client.mLagging = true;
+			return;
+		}
+		client.mOutput.append(mFrame);
+	}
+
+private:
+	struct Client
+	{
+		FW::String mInput;
+		FW::String mOutput;
+		size_t mSent;
+		std::set<FW::WatchID> mSubscriptions;
+		/// events were dropped because the client did not read
+		bool mLagging;
+
+		Client() : mSent(0), mLagging(false) {}
+	};
+
+	/// A watch of mWatcher, shared by the subscriptions it covers
+	struct Watch
+	{
+		/// resolved directories in mByPath that lead here
+		std::vector<FW::String> mKeys;
+		bool mRecursive;
+		/// number of subscriptions using it
+		unsigned int mSubscriptions;
+	};
+
+	/// A client's subscription, as numbered by mRouter
+	struct Subscription
+	{
+		int mClient;
+		FW::WatchID mWatch;
+	};
+
+	void accept()
+	{
+		while(true)
+		{
+			int fd = accept4(mListenFD, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if(fd < 0)
+				return;
+
+			// the watches are served to the daemon's own user only
+			struct ucred peer;
+			socklen_t length = sizeof(peer);
+			if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) < 0 || peer.uid != geteuid())
+			{
+				close(fd);
+				continue;
+			}
+			mClients[fd];
+		}
+	}
+
+	void receive(int fd)
+	{
+		Client& client = mClients[fd];
+
+		char buffer[64 * 1024];
+		while(true)
+		{
+			ssize_t result = recv(fd, buffer, sizeof(buffer), 0);
+			if(result > 0)
+			{
+				client.mInput.append(buffer, result);
+				continue;
+			}
+			if(result < 0 && errno == EINTR)
+				continue;
+			if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+
+			dropClient(fd);
+			return;
+		}
+
+		size_t pos = 0;
+		uint8_t type;
+		FW::WatchProtocol::Reader payload(0, 0);
+		while(FW::WatchProtocol::nextFrame(client.mInput, pos, type, payload))
+		{
+			if(type == FW::WatchProtocol::Subscribe)
+			{
+				uint32_t request = payload.get32();
+				uint8_t flags = payload.get8();
+				FW::String path = payload.rest();
+				if(payload.valid())
+					subscribe(fd, request, path, (flags & FW::WatchProtocol::Recursive) != 0);
+			}
+			else if(type == FW::WatchProtocol::Unsubscribe)
+			{
+				uint32_t subscription = payload.get32();
+				if(payload.valid())
+					unsubscribe(fd, subscription);
+			}
+			else
+			{
+				dropClient(fd);
+				return;
+			}
+		}
+		client.mInput.erase(0, pos);
+	}
+
+	void subscribe(int fd, uint32_t request, const FW::String& path, bool recursive)
+	{
+		FW::WatchID subscription = 0;
+		int error = 0;
+		FW::String message;
+
+		// one watch per directory, however it was spelled; events name the
+		// resolved directory so the router can match them
+		char resolved[PATH_MAX];
+		FW::String key = realpath(path.c_str(), resolved) ? resolved : path;
+
+		try
+		{
+			FW::WatchID watchid = watch(key, recursive);
+			subscription = mRouter.subscribe(key, this, recursive);
+
+			Subscription& sub = mSubscriptions[subscription];
+			sub.mClient = fd;
+			sub.mWatch = watchid;
+			++mWatches[watchid].mSubscriptions;
+			mClients[fd].mSubscriptions.insert(subscription);
+		}
+		catch(const FW::FileNotFoundException& e)
+		{
+			error = ENOENT;
+			message = e.what();
+		}
+		catch(const std::exception& e)
+		{
+			error = EIO;
+			message = e.what();
+		}
+
+		FW::WatchProtocol::Writer writer(mClients[fd].mOutput, FW::WatchProtocol::Subscribed);
+		writer.put32(request);
+		writer.put32((uint32_t)subscription);
+		writer.put32((uint32_t)error);
+		writer.put(message);
+	}
+
+	/// The watch that covers key, added or made recursive as needed
+	FW::WatchID watch(const FW::String& key, bool recursive)
+	{
+		std::map<FW::String, FW::WatchID>::const_iterator known = mByPath.find(key);
+		if(known != mByPath.end() && (!recursive || mWatches[known->second].mRecursive))
+			return known->second;
+
+		FW::WatchID previous = 0;
+		if(known != mByPath.end())
+		{
+			// added again with recursion, its subscriptions move over
+			previous = known->second;
+			mWatcher.removeWatch(previous);
+		}
+
+		// the backend may hand back a watch that covers the directory already
+		FW::WatchID watchid = mWatcher.addWatch(key, &mRouter, recursive);
+		std::map<FW::WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+		{
+			iter = mWatches.insert(std::make_pair(watchid, Watch())).first;
+			iter->second.mRecursive = recursive;
+			iter->second.mSubscriptions = 0;
+		}
+		iter->second.mKeys.push_back(key);
+		mByPath[key] = watchid;
+
+		if(previous)
+		{
+			std::map<FW::WatchID, Watch>::iterator old = mWatches.find(previous);
+			for(size_t i = 0; i < old->second.mKeys.size(); ++i)
+			{
+				if(old->second.mKeys[i] != key)
+				{
+					iter->second.mKeys.push_back(old->second.mKeys[i]);
+					mByPath[old->second.mKeys[i]] = watchid;
+				}
+			}
+			iter->second.mSubscriptions += old->second.mSubscriptions;
+			mWatches.erase(old);
+
+			std::map<FW::WatchID, Subscription>::iterator sub = mSubscriptions.begin();
+			for(; sub != mSubscriptions.end(); ++sub)
+			{
+				if(sub->second.mWatch == previous)
+					sub->second.mWatch = watchid;
+			}
+		}
+		return watchid;
+	}
+
+	void unsubscribe(int fd, FW::WatchID subscription)
+	{
+		Client& client = mClients[fd];
+		if(client.mSubscriptions.erase(subscription))
+			release(subscription);
+	}
+
+	void release(FW::WatchID subscription)
+	{
+		std::map<FW::WatchID, Subscription>::iterator sub = mSubscriptions.find(subscription);
+		if(sub == mSubscriptions.end())
+			return;
+
+		mRouter.unsubscribe(subscription);
+		FW::WatchID watchid = sub->second.mWatch;
+		mSubscriptions.erase(sub);
+
+		std::map<FW::WatchID, Watch>::iterator watch = mWatches.find(watchid);
+		if(watch == mWatches.end() || --watch->second.mSubscriptions > 0)
+			return;
+
+		// last subscriber gone
+		mWatcher.removeWatch(watchid);
+		for(size_t i = 0; i < watch->second.mKeys.size(); ++i)
+			mByPath.erase(watch->second.mKeys[i]);
+		mWatches.erase(watch);
+	}
+
+	void flush(int fd)
+	{
+		Client& client = mClients[fd];
+		while(client.mSent < client.mOutput.size())
+		{
+			ssize_t result = send(fd, client.mOutput.data() + client.mSent, client.mOutput.size() - client.mSent, MSG_NOSIGNAL);
+			if(result > 0)
+			{
+				client.mSent += result;
+				continue;
+			}
+			if(result < 0 && errno == EINTR)
+				continue;
+			if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+
+			dropClient(fd);
+			return;
+		}
+
+		if(client.mSent == client.mOutput.size())
+		{
+			client.mOutput.clear();
+			client.mSent = 0;
+
+			if(client.mLagging)
+			{
+				client.mLagging = false;
+				std::set<FW::WatchID>::const_iterator iter = client.mSubscriptions.begin();
+				for(; iter != client.mSubscriptions.end(); ++iter)
+				{
+					FW::WatchProtocol::Writer writer(client.mOutput, FW::WatchProtocol::Event);
+					writer.put32((uint32_t)*iter);
+					writer.put8((uint8_t)FW::Actions::Overflow);
+					writer.put32(0);
+				}
+			}
+		}
+		else if(client.mSent > MAX_CLIENT_BUFFER / 2)
+		{
+			client.mOutput.erase(0, client.mSent);
+			client.mSent = 0;
+		}
+	}
+
+	void dropClient(int fd)
+	{
+		std::map<int, Client>::iterator client = mClients.find(fd);
+		if(client == mClients.end())
+			return;
+
+		std::set<FW::WatchID> subscriptions;
+		subscriptions.swap(client->second.mSubscriptions);
+		mClients.erase(client);
+		close(fd);
+
+		std::set<FW::WatchID>::const_iterator iter = subscriptions.begin();
+		for(; iter != subscriptions.end(); ++iter)
+			release(*iter);
+	}
+
+	/// Passes the events of every watch to the subscriptions under them
+	FW::PathRouter mRouter;
+	FW::FileWatcher mWatcher;
+	int mListenFD;
+	FW::String mSocketPath;
+	std::map<int, Client> mClients;
+	std::map<FW::WatchID, Subscription> mSubscriptions;
+	std::map<FW::WatchID, Watch> mWatches;
+	/// resolved directory to watch
+	std::map<FW::String, FW::WatchID> mByPath;
+	/// scratch buffer for encoding events
+	FW::String mFrame;
+};
+
+/// Creates the directory of the default socket, or makes sure nobody
+/// else can reach into it
+static bool privateDirectory(const FW::String& path)
+{
+	FW::String dir = path.substr(0, path.rfind('/'));
+	if(dir.empty() || (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST))
+	{
+		perror(dir.c_str());
+		return false;
+	}
+
+	struct stat attrib;
+	if(lstat(dir.c_str(), &attrib) < 0 || !S_ISDIR(attrib.st_mode) || attrib.st_uid != geteuid() || (attrib.st_mode & 077))
+	{
+		fprintf(stderr, "Error: %s is not a private directory\n", dir.c_str());
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	FW::String path = argc > 1 ? argv[1] : FW::WatchProtocol::defaultSocketPath();
+	if(argc <= 1 && !privateDirectory(path))
+		return 1;
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	signal(SIGPIPE, SIG_IGN);
+
+	WatchDaemon daemon;
+	if(!daemon.listen(path))
+		return 1;
+
+	daemon.run();
+	return 0;
+}
@@ -0,0 +1,532 @@
+/**
+	filewatchstress, measures how many events a FileWatcher loses or
+	repeats under load. A seeded generator applies random file system
+	operations to a scratch tree and keeps an exact model of it, while a
+	listener rebuilds the tree from the delivered events. Once the watcher
+	has settled the two trees are compared. Every combination of rate and
+	tree size is one run and one line of the report.
+
+	Loss is the share of created paths whose final state differs between
+	the model and the rebuilt tree; duplication is the share of delivered
+	events that add a path already present or delete one that is absent.
+	The expected event count is an upper bound, as the kernel merges
+	identical consecutive events.
+
+	usage: filewatchstress [options]
+		--root DIR      where the scratch trees go, default /dev/shm
+		--seed N        random seed, default 1
+		--ops N         operations per run, default 20000
+		--rates LIST    comma separated operations per second, 0 for as
+		                fast as possible, default 1000,10000,0
+		--sizes LIST    comma separated number of entries the tree is kept
+		                around, default 64,1024
+		--interval MS   milliseconds between watcher updates, default 1
+		--iouring       read the kernel events through io_uring
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/FileWatcher.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// Milliseconds without new events after which the watcher counts as settled
+#define SETTLE_TIME 300
+
+struct Settings
+{
+	FW::String root;
+	unsigned long long seed;
+	size_t ops;
+	std::vector<size_t> rates;
+	std::vector<size_t> sizes;
+	unsigned int interval;
+	bool iouring;
+
+	Settings()
+		: root("/dev/shm"), seed(1), ops(20000), interval(1), iouring(false)
+	{
+		rates.push_back(1000);
+		rates.push_back(10000);
+		rates.push_back(0);
+		sizes.push_back(64);
+		sizes.push_back(1024);
+	}
+};
+
+/// A set of relative paths that can hand out a random member
+class PathSet
+{
+public:
+	void add(const FW::String& path)
+	{
+		if(mIndex.count(path))
+			return;
+		mIndex[path] = mPaths.size();
+		mPaths.push_back(path);
+	}
+
+	void remove(const FW::String& path)
+	{
+		std::unordered_map<FW::String, size_t>::iterator iter = mIndex.find(path);
+		if(iter == mIndex.end())
+			return;
+
+		size_t index = iter->second;
+		mIndex.erase(iter);
+		if(index + 1 != mPaths.size())
+		{
+			mPaths[index].swap(mPaths.back());
+			mIndex[mPaths[index]] = index;
+		}
+		mPaths.pop_back();
+	}
+
+	bool contains(const FW::String& path) const { return mIndex.count(path) != 0; }
+
+	const FW::String& pick(std::mt19937_64& random) const
+	{
+		return mPaths[random() % mPaths.size()];
+	}
+
+	size_t size() const { return mPaths.size(); }
+	bool empty() const { return mPaths.empty(); }
+	const std::vector<FW::String>& paths() const { return mPaths; }
+
+private:
+	std::vector<FW::String> mPaths;
+	std::unordered_map<FW::String, size_t> mIndex;
+};
+
+/// Applies random operations to the scratch tree and tracks what it
+/// should look like
+class Generator
+{
+public:
+	Generator(const FW::String& base, unsigned long long seed, size_t size)
+		: mBase(base), mRandom(seed), mSize(size), mNext(0), mExpected(0), mCreated(0)
+	{
+		// the watched directory itself
+		mDirs.add("");
+	}
+
+	/// Applies one operation
+	void step()
+	{
+		// grow the tree until it reaches the size, then keep it there
+		bool grow = mFiles.size() + mDirs.size() < mSize;
+		unsigned int roll = mRandom() % 100;
+
+		if(roll < (grow ? 45u : 20u))
+			createFile(mDirs.pick(mRandom));
+		else if(roll < (grow ? 55u : 25u))
+			makeDirectory();
+		else if(mFiles.empty())
+			createFile(mDirs.pick(mRandom));
+		else if(roll < 70)
+			modifyFile();
+		else if(roll < 85)
+			renameFile();
+		else if(roll < 95 || mDirs.size() == 1)
+			deleteFile();
+		else
+			removeDirectory();
+	}
+
+	const PathSet& files() const { return mFiles; }
+	const PathSet& dirs() const { return mDirs; }
+
+	/// Events the operations should have caused
+	size_t expected() const { return mExpected; }
+
+	/// Distinct paths created
+	size_t created() const { return mCreated; }
+
+private:
+	FW::String child(const FW::String& dir, char prefix)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%c%zu", prefix, mNext++);
+		++mCreated;
+		return dir.empty() ? FW::String(name) : dir + "/" + name;
+	}
+
+	FW::String full(const FW::String& path) const { return path.empty() ? mBase : mBase + "/" + path; }
+
+	static FW::String parent(const FW::String& path)
+	{
+		size_t slash = path.rfind('/');
+		return slash == FW::String::npos ? FW::String() : path.substr(0, slash);
+	}
+
+	void write(const FW::String& path, int flags)
+	{
+		int fd = open(full(path).c_str(), O_WRONLY | O_CLOEXEC | flags, 0644);
+		if(fd < 0)
+		{
+			perror("open");
+			exit(1);
+		}
+		if(::write(fd, "x", 1) != 1)
+			perror("write");
+		close(fd);
+	}
+
+	void createFile(const FW::String& dir)
+	{
+		FW::String path = child(dir, 'f');
+		write(path, O_CREAT | O_EXCL);
+		mFiles.add(path);
+		++mChildren[dir];
+		// Add, then Modified on close
+		mExpected += 2;
+	}
+
+	void makeDirectory()
+	{
+		FW::String dir = mDirs.pick(mRandom);
+		FW::String path = child(dir, 'd');
+		if(mkdir(full(path).c_str(), 0755) != 0)
+		{
+			perror("mkdir");
+			exit(1);
+		}
+		mDirs.add(path);
+		++mChildren[dir];
+		mExpected += 1;
+
+		// races the installation of the new directory's watch
+		if(mRandom() % 2)
+			createFile(path);
+	}
+
+	void modifyFile()
+	{
+		write(mFiles.pick(mRandom), O_APPEND);
+		mExpected += 1;
+	}
+
+	void renameFile()
+	{
+		FW::String from = mFiles.pick(mRandom);
+		FW::String dir = mDirs.pick(mRandom);
+		FW::String to = child(dir, 'f');
+		if(rename(full(from).c_str(), full(to).c_str()) != 0)
+		{
+			perror("rename");
+			exit(1);
+		}
+		--mChildren[parent(from)];
+		++mChildren[dir];
+		mFiles.remove(from);
+		mFiles.add(to);
+		// Delete of the old name, Add of the new one
+		mExpected += 2;
+	}
+
+	void deleteFile()
+	{
+		FW::String path = mFiles.pick(mRandom);
+		unlink(full(path).c_str());
+		--mChildren[parent(path)];
+		mFiles.remove(path);
+		mExpected += 1;
+	}
+
+	void removeDirectory()
+	{
+		FW::String path = mDirs.pick(mRandom);
+		if(path.empty() || mChildren[path] > 0)
+		{
+			deleteFile();
+			return;
+		}
+
+		if(rmdir(full(path).c_str()) != 0)
+		{
+			perror("rmdir");
+			exit(1);
+		}
+		mChildren.erase(path);
+		--mChildren[parent(path)];
+		mDirs.remove(path);
+		mExpected += 1;
+	}
+
+	FW::String mBase;
+	std::mt19937_64 mRandom;
+	size_t mSize;
+	size_t mNext;
+	size_t mExpected;
+	size_t mCreated;
+	PathSet mFiles;
+	PathSet mDirs;
+	std::unordered_map<FW::String, int> mChildren;
+};
+
+/// Rebuilds the tree from the events. Runs on the watcher thread; the
+/// counters are read once that thread has stopped.
+class Observer : public FW::FileWatchListener
+{
+public:
+	Observer(const FW::String& base)
+		: mBase(base), mDelivered(0), mDuplicates(0), mOverflows(0), mStrays(0)
+	{}
+
+	void handleFileAction(FW::WatchID watchid, const FW::String& dir, const FW::String& filename, FW::Action action)
+	{
+		handleFileEvent(watchid, dir, filename, action, FW::FileInfo());
+	}
+
+	void handleFileEvent(FW::WatchID watchid, const FW::String& dir, const FW::String& filename, FW::Action action, const FW::FileInfo& info)
+	{
+		++mDelivered;
+		if(action == FW::Actions::Overflow)
+		{
+			++mOverflows;
+			return;
+		}
+
+		FW::String path = relative(dir, filename);
+		std::unordered_map<FW::String, bool>::iterator iter = mEntries.find(path);
+		switch(action)
+		{
+		case FW::Actions::Add:
+			if(iter != mEntries.end())
+				++mDuplicates;
+			mEntries[path] = info.type == FW::FileTypes::Directory;
+			break;
+		case FW::Actions::Delete:
+			if(iter == mEntries.end())
+				++mDuplicates;
+			else
+				mEntries.erase(iter);
+			break;
+		case FW::Actions::Modified:
+			// a change to a file whose Add never came
+			if(iter == mEntries.end())
+				++mStrays;
+			break;
+		default:
+			break;
+		}
+	}
+
+	const std::unordered_map<FW::String, bool>& entries() const { return mEntries; }
+
+	/// Events seen so far, safe to read while the watcher runs
+	size_t delivered() const { return mDelivered.load(); }
+
+	size_t duplicates() const { return mDuplicates; }
+	size_t overflows() const { return mOverflows; }
+	size_t strays() const { return mStrays; }
+
+private:
+	FW::String relative(const FW::String& dir, const FW::String& filename) const
+	{
+		if(dir.size() <= mBase.size())
+			return filename;
+		return dir.substr(mBase.size() + 1) + "/" + filename;
+	}
+
+	FW::String mBase;
+	std::unordered_map<FW::String, bool> mEntries;
+	std::atomic<size_t> mDelivered;
+	size_t mDuplicates;
+	size_t mOverflows;
+	size_t mStrays;
+};
+
+//--------
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+
+//--------
+static void run(const Settings& settings, size_t rate, size_t size, int index)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/filewatchstress-%d-%d", (int)getpid(), index);
+	FW::String base = settings.root + name;
+	if(mkdir(base.c_str(), 0755) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", base.c_str(), strerror(errno));
+		exit(1);
+	}
+
+	Generator generator(base, settings.seed, size);
+	Observer observer(base);
+	double elapsed = 0;
+	{
+		FW::FileWatcher watcher;
+		if(settings.iouring && !watcher.setEventReader(FW::EventReaders::IoUring))
+			fprintf(stderr, "io_uring is not available, reading with select\n");
+		watcher.addWatch(base, &observer, true);
+
+		std::atomic<bool> running(true);
+		std::thread thread([&]() {
+			while(running.load())
+			{
+				watcher.update();
+				if(settings.interval)
+					std::this_thread::sleep_for(std::chrono::milliseconds(settings.interval));
+			}
+		});
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(size_t i = 0; i < settings.ops; ++i)
+		{
+			if(rate)
+				std::this_thread::sleep_until(start + std::chrono::nanoseconds(i * 1000000000ull / rate));
+			generator.step();
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// settled once no event arrived for a while
+		size_t seen = observer.delivered();
+		while(true)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_TIME));
+			size_t now = observer.delivered();
+			if(now == seen)
+				break;
+			seen = now;
+		}
+
+		running = false;
+		thread.join();
+	}
+
+	// compare the rebuilt tree with the model
+	size_t missing = 0;
+	size_t stale = 0;
+	const std::unordered_map<FW::String, bool>& entries = observer.entries();
+	for(size_t i = 0; i < generator.files().size(); ++i)
+	{
+		std::unordered_map<FW::String, bool>::const_iterator iter = entries.find(generator.files().paths()[i]);
+		if(iter == entries.end() || iter->second)
+			++missing;
+	}
+	for(size_t i = 0; i < generator.dirs().size(); ++i)
+	{
+		const FW::String& path = generator.dirs().paths()[i];
+		std::unordered_map<FW::String, bool>::const_iterator iter = entries.find(path);
+		if(!path.empty() && (iter == entries.end() || !iter->second))
+			++missing;
+	}
+	std::unordered_map<FW::String, bool>::const_iterator iter = entries.begin();
+	for(; iter != entries.end(); ++iter)
+	{
+		if(!generator.files().contains(iter->first) && !generator.dirs().contains(iter->first))
+			++stale;
+	}
+
+	size_t delivered = observer.delivered();
+	double loss = generator.created() ? 100.0 * (missing + stale) / generator.created() : 0;
+	double duplication = delivered ? 100.0 * observer.duplicates() / delivered : 0;
+
+	printf("%8zu %6zu %10.0f %9zu %9zu %8zu %6zu %6zu %7zu %6zu %7.3f%% %7.3f%%\n",
+		rate, size, settings.ops / elapsed, generator.expected(), delivered, observer.overflows(),
+		observer.duplicates(), observer.strays(), missing, stale, loss, duplication);
+	fflush(stdout);
+
+	nftw(base.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+//--------
+static std::vector<size_t> parseList(const char* text)
+{
+	std::vector<size_t> values;
+	while(*text)
+	{
+		char* end;
+		values.push_back(strtoull(text, &end, 10));
+		text = *end == ',' ? end + 1 : end;
+		if(end == text && *end)
+			break;
+	}
+	return values;
+}
+
+//--------
+static void usage()
+{
+	fprintf(stderr, "usage: filewatchstress [--root DIR] [--seed N] [--ops N] [--rates LIST] [--sizes LIST] [--interval MS] [--iouring]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	Settings settings;
+	for(int i = 1; i < argc; ++i)
+	{
+		FW::String arg = argv[i];
+		if(arg == "--iouring")
+		{
+			settings.iouring = true;
+			continue;
+		}
+		if(i + 1 >= argc)
+			usage();
+
+		const char* value = argv[++i];
+		if(arg == "--root")
+			settings.root = value;
+		else if(arg == "--seed")
+			settings.seed = strtoull(value, 0, 10);
+		else if(arg == "--ops")
+			settings.ops = strtoull(value, 0, 10);
+		else if(arg == "--rates")
+			settings.rates = parseList(value);
+		else if(arg == "--sizes")
+			settings.sizes = parseList(value);
+		else if(arg == "--interval")
+			settings.interval = strtoul(value, 0, 10);
+		else
+			usage();
+	}
+
+	printf("seed %llu, %zu operations per run\n", settings.seed, settings.ops);
+	printf("%8s %6s %10s %9s %9s %8s %6s %6s %7s %6s %8s %8s\n",
+		"rate", "size", "achieved", "expected", "delivered", "overflow",
+		"dups", "strays", "missing", "stale", "loss", "dup");
+
+	int index = 0;
+	for(size_t i = 0; i < settings.rates.size(); ++i)
+	{
+		for(size_t j = 0; j < settings.sizes.size(); ++j)
+			run(settings, settings.rates[i], settings.sizes[j], index++);
+	}
+	return 0;
+}
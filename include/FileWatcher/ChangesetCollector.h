@@ -0,0 +1,124 @@
+/**
+	Groups the events of a watch into changesets that are delivered once
+	the watch has been quiet for a while, with one net action per path.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_CHANGESETCOLLECTOR_H_
+#define _FW_CHANGESETCOLLECTOR_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+namespace FW
+{
+	class FileWatcherImpl;
+
+	/// Holds the events of watches with WatchOptions::settleTime until the
+	/// watch settles or its changeset is maxLatency old, then hands the
+	/// changeset to the watch's listener. Used from the thread that
+	/// updates the watcher.
+	/// @class ChangesetCollector
+	class ChangesetCollector : public FileWatchListener
+	{
+	public:
+		/// @param clock Backend whose clock times the changesets, the
+		/// steady clock when null
+		ChangesetCollector(const FileWatcherImpl* clock = 0);
+		~ChangesetCollector();
+
+		/// Collects the events of watchid for listener.
+		void setListener(WatchID watchid, FileWatchListener* listener, const String& directory, const WatchOptions& options);
+
+		/// Stops collecting for watchid and drops its pending changes.
+		void removeListener(WatchID watchid);
+
+		/// Same as removeListener for the watch added for directory.
+		void removeDirectory(const String& directory);
+
+		/// Folds an event into the changeset of its watch.
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		/// Folds an event and its FileInfo into the changeset of its watch.
+		void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Folds changes into the changeset of watchid and delivers it at
+		/// once. They settled already, e.g. while the watch was paused.
+		void handleChangeset(WatchID watchid, const Changeset& changes);
+
+		/// Delivers the changesets that are due.
+		void flush();
+
+		/// Stops collecting for watchid and hands out its pending changes
+		/// instead of delivering them. Returns the listener of watchid, 0 if
+		/// it was not collected for.
+		FileWatchListener* release(WatchID watchid, Changeset& changes);
+
+		/// Milliseconds until the next changeset is due, -1 when none is pending
+		int timeUntilDue() const;
+
+		/// Number of watches collected for
+		size_t size() const { return mWatches.size(); }
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Watch
+		{
+			FileWatchListener* mListener;
+			String mDirectory;
+			std::chrono::milliseconds mSettleTime;
+			std::chrono::milliseconds mMaxLatency;
+			/// net changes in order of first occurrence, merged away entries
+			/// have action 0
+			Changeset mChanges;
+			/// index into mChanges per path
+			std::unordered_map<String, size_t> mByPath;
+			/// whether events arrived since the last changeset
+			bool mOpen;
+			Clock::time_point mFirst;
+			Clock::time_point mLast;
+		};
+
+		ChangesetCollector(const ChangesetCollector&);
+		ChangesetCollector& operator=(const ChangesetCollector&);
+
+		/// When the changeset of watch is due
+		static Clock::time_point due(const Watch* watch);
+
+		/// Moves the net changes of watch into changes and closes it
+		void take(Watch* watch, Changeset& changes);
+
+		Clock::time_point currentTime() const;
+
+		std::unordered_map<WatchID, Watch*> mWatches;
+		/// Watches with pending changes
+		size_t mPending;
+		const FileWatcherImpl* mClock;
+	};
+
+};//namespace FW
+
+#endif//_FW_CHANGESETCOLLECTOR_H_
@@ -0,0 +1,137 @@
+/**
+	Runs listener callbacks on a pool of threads. Events are sharded by
+	watch and path so the events of one file stay in order, while events
+	of unrelated files are handled in parallel.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_DISPATCHPOOL_H_
+#define _FW_DISPATCHPOOL_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+namespace FW
+{
+	/// Work stealing pool for listener callbacks. Each shard is a FIFO of
+	/// events that only one worker drains at a time; idle workers steal
+	/// whole shards from busy ones. Events are queued from a single thread,
+	/// the one that updates the watcher.
+	/// @class DispatchPool
+	class DispatchPool : public FileWatchListener
+	{
+	public:
+		/// @param threads Number of worker threads, at least one
+		DispatchPool(unsigned int threads);
+
+		/// Runs the remaining callbacks, then stops the workers.
+		~DispatchPool();
+
+		/// Routes the events of watchid to listener.
+		void setListener(WatchID watchid, FileWatchListener* listener);
+
+		/// Stops routing the events of watchid. Callbacks already queued still run.
+		void removeListener(WatchID watchid);
+
+		/// Queues a callback on the shard of its watch and path.
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		/// Queues a callback that receives the event's FileInfo.
+		void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Waits for the queued callbacks, then runs the listener's
+		/// handleChangeset on the calling thread.
+		void handleChangeset(WatchID watchid, const Changeset& changes);
+
+		/// Waits until every queued callback has returned. Must not be called
+		/// from a listener running on the pool.
+		void flush();
+
+		/// Number of callbacks queued or running
+		size_t inFlight() const { return mPending.load(); }
+
+	private:
+		struct Task
+		{
+			FileWatchListener* mListener;
+			WatchID mWatchID;
+			String mDir;
+			String mFilename;
+			Action mAction;
+			FileInfo mInfo;
+		};
+
+		struct Shard
+		{
+			std::mutex mMutex;
+			std::deque<Task> mTasks;
+			/// queued on a worker or being drained
+			bool mScheduled;
+		};
+
+		struct Worker
+		{
+			std::mutex mMutex;
+			/// shards ready to be drained
+			std::deque<size_t> mShards;
+			std::thread mThread;
+		};
+
+		DispatchPool(const DispatchPool&);
+		DispatchPool& operator=(const DispatchPool&);
+
+		/// Worker loop
+		void run(size_t index);
+
+		/// Queues a shard on a worker and wakes one
+		void schedule(size_t shard, size_t worker);
+
+		/// Takes a shard from the worker's own deque or steals one
+		bool take(size_t index, size_t& shard);
+
+		/// Runs up to a fixed number of the shard's callbacks
+		void drain(size_t index, size_t shard);
+
+		std::vector<Shard*> mShards;
+		std::vector<Worker*> mWorkers;
+		std::unordered_map<WatchID, FileWatchListener*> mListeners;
+
+		/// callbacks queued or running
+		std::atomic<size_t> mPending;
+
+		std::mutex mIdleMutex;
+		/// signalled when shards are queued
+		std::condition_variable mWork;
+		/// signalled when mPending drops to zero
+		std::condition_variable mIdle;
+		/// shards sitting in worker deques
+		size_t mQueued;
+		bool mStop;
+	};
+
+};//namespace FW
+
+#endif//_FW_DISPATCHPOOL_H_
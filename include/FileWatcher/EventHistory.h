@@ -0,0 +1,116 @@
+/**
+	Bounded per watch history of events, stamped with a clock, so clients
+	can ask what changed since they last looked.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_EVENTHISTORY_H_
+#define _FW_EVENTHISTORY_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace FW
+{
+	/// Records the events of watches with WatchOptions::historySize and
+	/// passes them on to the next listener. The history of a watch keeps
+	/// the recent events of up to historySize paths; runs of Modified for
+	/// a path are compacted into one. Queries may come from any thread.
+	/// @class EventHistory
+	class EventHistory : public FileWatchListener
+	{
+	public:
+		EventHistory();
+		~EventHistory();
+
+		/// Records the events of watchid and forwards them to listener.
+		void setListener(WatchID watchid, FileWatchListener* listener, const String& directory, size_t historySize);
+
+		/// Drops the history of watchid.
+		void removeListener(WatchID watchid);
+
+		/// Same as removeListener for the watch added for directory.
+		void removeDirectory(const String& directory);
+
+		/// Records an event and forwards it.
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		/// Records an event and forwards it with its FileInfo.
+		void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Forwards a changeset, recording every change.
+		void handleChangeset(WatchID watchid, const Changeset& changes);
+
+		/// The clock of the latest event
+		ClockToken getClock() const;
+
+		/// The net changes of watchid after since.
+		HistoryResult query(WatchID watchid, ClockToken since) const;
+
+	private:
+		struct Event
+		{
+			ClockToken mClock;
+			Action mAction;
+		};
+
+		struct PathHistory
+		{
+			String mDir;
+			String mFilename;
+			FileInfo mInfo;
+			/// oldest first
+			std::vector<Event> mEvents;
+			std::list<PathHistory*>::iterator mOrder;
+		};
+
+		struct Watch
+		{
+			FileWatchListener* mListener;
+			String mDirectory;
+			size_t mLimit;
+			/// tokens before this one are not covered any more
+			ClockToken mTruncated;
+			std::unordered_map<String, PathHistory*> mPaths;
+			/// least recently changed first
+			std::list<PathHistory*> mOrder;
+		};
+
+		EventHistory(const EventHistory&);
+		EventHistory& operator=(const EventHistory&);
+
+		/// Records an event under mMutex and returns the listener to forward to
+		FileWatchListener* record(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		static void destroy(Watch* watch);
+
+		std::unordered_map<WatchID, Watch*> mWatches;
+		ClockToken mClock;
+		mutable std::mutex mMutex;
+	};
+
+};//namespace FW
+
+#endif//_FW_EVENTHISTORY_H_
@@ -0,0 +1,155 @@
+/**
+	Bounded queue between reading and dispatch for BufferedFileWatcher and
+	AsyncFileWatcher.
+
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_EVENTQUEUE_H_
+#define _FW_EVENTQUEUE_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <unordered_map>
+
+namespace FW
+{
+	/// Folds the action of a later event for a file into the action still
+	/// pending for it, e.g. Add followed by Modified stays Add, and Delete
+	/// followed by Add becomes Modified. Returns false when the two cancel
+	/// out, i.e. a file that was added and deleted again.
+	bool mergeAction(Action& pending, Action next);
+
+	/// Receives the events of every watch of a watcher, holds up to a fixed
+	/// number of them and hands them to the real listeners on dispatch.
+	/// Safe to fill from one thread while another dispatches.
+	/// @class EventQueue
+	class EventQueue : public FileWatchListener
+	{
+	public:
+		/// @param blockingPush Whether a full queue with the Block policy makes
+		/// the reader wait. Must be false when the reader also dispatches.
+		EventQueue(const QueueOptions& options, bool blockingPush);
+		~EventQueue();
+
+		/// Routes the events of watchid to listener.
+		void setListener(WatchID watchid, FileWatchListener* listener);
+
+		/// Stops routing the events of watchid and discards its pending events.
+		void removeListener(WatchID watchid);
+
+		/// Sets whether a full queue with the Block policy makes the reader wait.
+		void setBlockingPush(bool blockingPush);
+
+		/// Queues an event, applying the policy when the queue is full.
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		/// Queues an event with its FileInfo. Coalesce keeps the latest info.
+		void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Queues a changeset as a single entry.
+		void handleChangeset(WatchID watchid, const Changeset& changes);
+
+		/// True when the Block policy wants the reader to pause
+		bool isFull() const;
+
+		/// Hands the pending events to their listeners on the calling thread.
+		/// Returns the number of events dispatched.
+		size_t dispatch();
+
+		/// Waits up to timeout for events and dispatches them. Returns false
+		/// once the queue is closed.
+		bool waitAndDispatch(std::chrono::milliseconds timeout);
+
+		/// Wakes every waiting thread. Events queued afterwards are ignored.
+		void close();
+
+		/// Reports the queue counters
+		QueueStats getStats() const;
+
+	private:
+		struct Entry
+		{
+			WatchID mWatchID;
+			FileWatchListener* mListener;
+			String mDir;
+			String mFilename;
+			Action mAction;
+			FileInfo mInfo;
+			/// set for an entry that carries a whole changeset
+			std::shared_ptr<const Changeset> mChangeset;
+			unsigned long long mSequence;
+			/// false once merged away by Coalesce
+			bool mLive;
+		};
+
+		typedef std::map<std::pair<WatchID, String>, FileWatchListener*> OverflowMap;
+
+		EventQueue(const EventQueue&);
+		EventQueue& operator=(const EventQueue&);
+
+		/// Drops the oldest live entry and remembers its directory for an
+		/// overflow marker. Called with mMutex held.
+		void dropOldest();
+
+		/// Queues an entry, applying the policy when the queue is full
+		void push(WatchID watchid, const String& dir, const String& filename, Action action,
+			const FileInfo& info, const std::shared_ptr<const Changeset>& changes);
+
+		/// Pops dead entries off the front. Called with mMutex held.
+		void trimFront();
+
+		/// Removes and returns the oldest live entry. Called with mMutex held.
+		bool popFront(Entry& entry);
+
+		/// False if watchid was removed since removals was read. Called
+		/// without mMutex.
+		bool isListening(WatchID watchid, unsigned long removals) const;
+
+		QueueOptions mOptions;
+		bool mBlockingPush;
+		bool mClosed;
+
+		std::deque<Entry> mEntries;
+		unsigned long long mNextSequence;
+		/// Sequence of the pending entry per watch and path, Coalesce only
+		std::unordered_map<String, unsigned long long> mByPath;
+		/// Directories that lost events since the last dispatch
+		OverflowMap mOverflows;
+		std::unordered_map<WatchID, FileWatchListener*> mListeners;
+		/// Bumped by removeListener so dispatch rechecks the batch
+		std::atomic<unsigned long> mRemovals;
+		QueueStats mStats;
+
+		mutable std::mutex mMutex;
+		std::condition_variable mNotFull;
+		std::condition_variable mNotEmpty;
+	};
+
+};//namespace FW
+
+#endif//_FW_EVENTQUEUE_H_
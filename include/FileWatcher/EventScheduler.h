@@ -0,0 +1,97 @@
+/**
+	Weighted fair dispatch of pending events across watches. Watches are
+	served in priority order, watches of equal priority share the dispatch
+	by deficit round robin according to their weight, and watches with a
+	rate limit draw from a token bucket.
+
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_EVENTSCHEDULER_H_
+#define _FW_EVENTSCHEDULER_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <vector>
+
+namespace FW
+{
+	/// Holds the events of a batch per watch and decides the order in
+	/// which they reach the listeners.
+	/// @class EventScheduler
+	class EventScheduler
+	{
+	public:
+		/// Pending events of one watch
+		struct Queue;
+
+		EventScheduler();
+		~EventScheduler();
+
+		/// Creates the queue for a watch.
+		Queue* addQueue(WatchID watchid, FileWatchListener* listener, const WatchOptions& options);
+
+		/// Drops a queue and its pending events. May be called from a listener.
+		void removeQueue(Queue* queue);
+
+		/// Sends the events of queue, pending ones included, to listener.
+		void setListener(Queue* queue, FileWatchListener* listener);
+
+		/// True while any queue has non-default scheduling options. Only
+		/// then do events need to go through the scheduler at all.
+		bool isActive() const { return mScheduledQueues > 0; }
+
+		/// Queues an event for dispatch.
+		void push(Queue* queue, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Dispatches every pending event the rate limits allow. Events over
+		/// a limit stay queued for a later call.
+		void dispatch();
+
+		/// Number of events waiting for dispatch
+		size_t pending() const { return mPending; }
+
+		/// Number of events merged into a pending event on the same path
+		size_t coalesced() const { return mCoalesced; }
+
+	private:
+		EventScheduler(const EventScheduler&);
+		EventScheduler& operator=(const EventScheduler&);
+
+		/// Frees removed queues and files queues added during dispatch
+		void purge();
+
+		/// Queues sorted by descending priority
+		std::vector<Queue*> mQueues;
+		/// Queues added by a listener during dispatch
+		std::vector<Queue*> mAddedQueues;
+		/// Number of queues with non-default options
+		size_t mScheduledQueues;
+		size_t mPending;
+		size_t mCoalesced;
+		bool mDispatching;
+		bool mHasRemoved;
+	};
+
+};//namespace FW
+
+#endif//_FW_EVENTSCHEDULER_H_
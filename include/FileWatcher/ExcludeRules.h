@@ -0,0 +1,85 @@
+/**
+	gitignore style exclusion rules, compiled once per watch and checked
+	while a recursive watch crawls its tree.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_EXCLUDERULES_H_
+#define _FW_EXCLUDERULES_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <vector>
+#include <unordered_set>
+
+namespace FW
+{
+	/// Matches paths relative to a watched directory against gitignore
+	/// style patterns: '*', '?', '[...]', '**', a leading '!' to re-include,
+	/// a trailing '/' for directories only, and a '/' anywhere else to
+	/// anchor the pattern at its base directory. Plain names go into a hash
+	/// set, so the common rules like node_modules cost one lookup.
+	/// @class ExcludeRules
+	class ExcludeRules
+	{
+	public:
+		ExcludeRules();
+
+		/// Adds a pattern line. Anchored patterns are taken relative to base, a
+		/// directory relative to the watched one.
+		void add(const String& line, const String& base = "");
+
+		/// Adds the patterns of a gitignore style file. Returns false when
+		/// the file cannot be read.
+		bool load(const String& file, const String& base = "");
+
+		/// True when there are no patterns
+		bool empty() const { return mRules.empty(); }
+
+		/// Whether an entry is excluded
+		/// @param path Path relative to the watched directory, '/' separated
+		bool excluded(const String& path, bool directory) const;
+
+	private:
+		struct Rule
+		{
+			String mPattern;
+			bool mNegate;
+			bool mDirectory;
+			bool mAnchored;
+			bool mLiteral;
+		};
+
+		bool matches(const Rule& rule, const String& path, const char* name, bool directory) const;
+
+		/// every rule, in the order added; the last match wins
+		std::vector<Rule> mRules;
+		/// literal names matching at any depth, used while there is no negation
+		std::unordered_set<String> mNames;
+		std::unordered_set<String> mDirectoryNames;
+		/// whether any rule re-includes entries
+		bool mNegations;
+	};
+
+};//namespace FW
+
+#endif//_FW_EXCLUDERULES_H_
@@ -0,0 +1,455 @@
+/**
+	A cache of values parsed from files, kept current by watch events.
+	Entries are dropped on the events of their path and reloaded on first
+	use, or right away on a small worker pool.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_FILECACHE_H_
+#define _FW_FILECACHE_H_
+#pragma once
+
+#include "FileWatcher.h"
+#include "DispatchPool.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace FW
+{
+	/// How a FileCache bounds and refreshes its values.
+	struct FileCacheOptions
+	{
+		/// Most values held, 0 for no bound. Values that were not read
+		/// recently are evicted first.
+		size_t capacity;
+		/// Threads that load changed values again right away. With 0 a
+		/// changed value is loaded by the next get().
+		unsigned int reloadThreads;
+
+		FileCacheOptions()
+			: capacity(1024), reloadThreads(0)
+		{}
+
+		FileCacheOptions(size_t capacity_, unsigned int reloadThreads_)
+			: capacity(capacity_), reloadThreads(reloadThreads_)
+		{}
+	};
+
+	struct FileCacheStats
+	{
+		/// get() calls answered from the cache
+		size_t hits;
+		/// get() calls that had to load or wait for a load
+		size_t misses;
+		/// Loader calls, including reloads
+		size_t loads;
+		/// Loader calls that threw
+		size_t failures;
+		/// Values dropped because their file changed
+		size_t invalidations;
+		/// Values dropped to stay within the capacity
+		size_t evictions;
+
+		FileCacheStats()
+			: hits(0), misses(0), loads(0), failures(0), invalidations(0), evictions(0)
+		{}
+	};
+
+	/// Values parsed from files, keyed by path. Add the cache as the
+	/// listener of a watch: the events of a path drop its value, and with
+	/// reloadThreads a dropped value is loaded again on a worker. Paths are
+	/// spelled the way the watcher reports them, the watched directory, '/'
+	/// and the file name.
+	///
+	/// Loader is a callable T(const String& path). It may throw; get()
+	/// passes the exception on and nothing is cached. Readers look values
+	/// up in a snapshot of the table without taking the cache's lock;
+	/// writers publish a new snapshot, so an update costs O(capacity).
+	/// @class FileCache
+	template <typename T, typename Loader>
+	class FileCache : public FileWatchListener
+	{
+	public:
+		typedef std::shared_ptr<const T> Value;
+
+		FileCache(const Loader& loader = Loader(), const FileCacheOptions& options = FileCacheOptions())
+			: mLoader(loader), mOptions(options), mTable(std::make_shared<Table>()), mHand(0), mNextLoad(0),
+			mHits(0), mMisses(0), mLoadCount(0), mFailures(0), mInvalidations(0), mEvictions(0),
+			mReloader(this), mPool(0)
+		{
+			if(mOptions.reloadThreads)
+			{
+				mPool = new DispatchPool(mOptions.reloadThreads);
+				mPool->setListener(0, &mReloader);
+			}
+		}
+
+		/// Runs the queued reloads before the values go away.
+		~FileCache()
+		{
+			delete mPool;
+		}
+
+		/// The value of path, loaded on a miss. Concurrent misses of one
+		/// path share a single load.
+		Value get(const String& path)
+		{
+			Value value = peek(path);
+			if(value)
+			{
+				++mHits;
+				return value;
+			}
+
+			++mMisses;
+			return load(path);
+		}
+
+		/// The cached value of path or null. Never loads.
+		Value peek(const String& path) const
+		{
+			std::shared_ptr<const Table> table = std::atomic_load(&mTable);
+			typename Table::const_iterator iter = table->find(path);
+			if(iter == table->end())
+				return Value();
+
+			iter->second->mReferenced.store(true, std::memory_order_relaxed);
+			return iter->second->mValue;
+		}
+
+		/// Drops the value of path.
+		void invalidate(const String& path)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			invalidateLocked(path);
+		}
+
+		/// Drops every value.
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			std::atomic_store(&mTable, std::shared_ptr<const Table>(std::make_shared<Table>()));
+			mClock.clear();
+			mHand = 0;
+			// loads in flight finish without caching their value
+			mLoads.clear();
+		}
+
+		/// Number of cached values
+		size_t size() const
+		{
+			return std::atomic_load(&mTable)->size();
+		}
+
+		FileCacheStats getStats() const
+		{
+			FileCacheStats stats;
+			stats.hits = mHits.load();
+			stats.misses = mMisses.load();
+			stats.loads = mLoadCount.load();
+			stats.failures = mFailures.load();
+			stats.invalidations = mInvalidations.load();
+			stats.evictions = mEvictions.load();
+			return stats;
+		}
+
+		/// Drops the value of the event's path, and of every path under dir
+		/// on Overflow and Dirty.
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+		{
+			handleFileEvent(watchid, dir, filename, action, FileInfo());
+		}
+
+		/// Same as handleFileAction; a directory that was added or deleted,
+		/// e.g. renamed, also drops the values of the paths under it.
+		void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+		{
+			if(action == Actions::StormBegin || action == Actions::StormEnd)
+				return;
+
+			std::vector<String> reload;
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				if(isDirectoryAction(action))
+				{
+					invalidateUnder(dir, reload);
+				}
+				else if(info.type == FileTypes::Directory && (action == Actions::Add || action == Actions::Delete))
+				{
+					String path = joinPath(dir, filename);
+					invalidateLocked(path);
+
+					// paths that moved out are gone, the ones moved in load again
+					std::vector<String> gone;
+					invalidateUnder(path, action == Actions::Add ? reload : gone);
+				}
+				else
+				{
+					String path = joinPath(dir, filename);
+					if(invalidateLocked(path) && action != Actions::Delete)
+						reload.push_back(path);
+				}
+			}
+
+			if(!mPool)
+				return;
+
+			// the pool takes its events from one thread at a time
+			std::lock_guard<std::mutex> lock(mPoolMutex);
+			for(size_t i = 0; i < reload.size(); ++i)
+				mPool->handleFileAction(0, String(), reload[i], Actions::Modified);
+		}
+
+	private:
+		struct Entry
+		{
+			Value mValue;
+			/// Set by readers, cleared as the eviction hand passes
+			mutable std::atomic<bool> mReferenced;
+
+			Entry(const Value& value) : mValue(value), mReferenced(true) {}
+		};
+
+		typedef std::unordered_map<String, std::shared_ptr<Entry> > Table;
+
+		struct Load
+		{
+			std::shared_future<Value> mResult;
+			/// Tells this load apart from a later one of the same path
+			unsigned long long mID;
+		};
+
+		/// Reloads the paths the cache queues on its pool
+		class Reloader : public FileWatchListener
+		{
+		public:
+			Reloader(FileCache* cache) : mCache(cache) {}
+
+			void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+			{
+				try
+				{
+					mCache->load(filename);
+				}
+				catch(...)
+				{
+					// counted as a failure, the next get() tries again
+				}
+			}
+
+		private:
+			FileCache* mCache;
+		};
+
+		FileCache(const FileCache&);
+		FileCache& operator=(const FileCache&);
+
+		static String joinPath(const String& dir, const String& filename)
+		{
+			if(!dir.empty() && dir[dir.size() - 1] == '/')
+				return dir + filename;
+			return dir + '/' + filename;
+		}
+
+		/// Loads path unless a load is already running, which is joined
+		Value load(const String& path)
+		{
+			std::shared_ptr<std::promise<Value> > promise;
+			std::shared_future<Value> running;
+			unsigned long long id = 0;
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				typename Table::const_iterator cached = mTable->find(path);
+				if(cached != mTable->end())
+					return cached->second->mValue;
+
+				typename std::unordered_map<String, Load>::iterator iter = mLoads.find(path);
+				if(iter != mLoads.end())
+				{
+					running = iter->second.mResult;
+				}
+				else
+				{
+					promise = std::make_shared<std::promise<Value> >();
+					Load& load = mLoads[path];
+					load.mResult = promise->get_future().share();
+					load.mID = id = ++mNextLoad;
+				}
+			}
+
+			if(!promise)
+				return running.get();
+
+			++mLoadCount;
+			Value value;
+			try
+			{
+				value = std::make_shared<T>(mLoader(path));
+			}
+			catch(...)
+			{
+				++mFailures;
+				finishLoad(path, id, Value());
+				promise->set_exception(std::current_exception());
+				throw;
+			}
+
+			finishLoad(path, id, value);
+			promise->set_value(value);
+			return value;
+		}
+
+		/// Caches the value of a load unless the file changed meanwhile
+		void finishLoad(const String& path, unsigned long long id, const Value& value)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			typename std::unordered_map<String, Load>::iterator iter = mLoads.find(path);
+			if(iter == mLoads.end() || iter->second.mID != id)
+				return;
+
+			mLoads.erase(iter);
+			if(value)
+				insertLocked(path, value);
+		}
+
+		/// Returns whether path had a value or a load running
+		bool invalidateLocked(const String& path)
+		{
+			// a running load no longer caches its result
+			bool cached = mLoads.erase(path) > 0;
+
+			if(mTable->find(path) != mTable->end())
+			{
+				std::shared_ptr<Table> table = std::make_shared<Table>(*mTable);
+				table->erase(path);
+				removeFromClock(path);
+				std::atomic_store(&mTable, std::shared_ptr<const Table>(table));
+				++mInvalidations;
+				cached = true;
+			}
+			return cached;
+		}
+
+		/// Drops the values of the paths under dir
+		void invalidateUnder(const String& dir, std::vector<String>& paths)
+		{
+			String prefix = joinPath(dir, String());
+			typename Table::const_iterator iter = mTable->begin();
+			for(; iter != mTable->end(); ++iter)
+			{
+				if(iter->first.compare(0, prefix.size(), prefix) == 0)
+					paths.push_back(iter->first);
+			}
+
+			typename std::unordered_map<String, Load>::const_iterator load = mLoads.begin();
+			for(; load != mLoads.end(); ++load)
+			{
+				if(load->first.compare(0, prefix.size(), prefix) == 0 && !mTable->count(load->first))
+					paths.push_back(load->first);
+			}
+
+			for(size_t i = 0; i < paths.size(); ++i)
+				invalidateLocked(paths[i]);
+		}
+
+		void insertLocked(const String& path, const Value& value)
+		{
+			std::shared_ptr<Table> table = std::make_shared<Table>(*mTable);
+			while(mOptions.capacity && table->size() >= mOptions.capacity && !mClock.empty())
+				evict(*table);
+
+			(*table)[path] = std::make_shared<Entry>(value);
+			mClock.push_back(path);
+			std::atomic_store(&mTable, std::shared_ptr<const Table>(table));
+		}
+
+		/// Second chance eviction: the hand skips values read since it last
+		/// passed and drops the first one that was not
+		void evict(Table& table)
+		{
+			for(;;)
+			{
+				if(mHand >= mClock.size())
+					mHand = 0;
+
+				typename Table::iterator iter = table.find(mClock[mHand]);
+				if(iter != table.end() && iter->second->mReferenced.exchange(false, std::memory_order_relaxed))
+				{
+					++mHand;
+					continue;
+				}
+
+				if(iter != table.end())
+				{
+					table.erase(iter);
+					++mEvictions;
+				}
+				mClock.erase(mClock.begin() + mHand);
+				return;
+			}
+		}
+
+		void removeFromClock(const String& path)
+		{
+			for(size_t i = 0; i < mClock.size(); ++i)
+			{
+				if(mClock[i] == path)
+				{
+					mClock.erase(mClock.begin() + i);
+					if(i < mHand)
+						--mHand;
+					return;
+				}
+			}
+		}
+
+		Loader mLoader;
+		FileCacheOptions mOptions;
+
+		std::mutex mMutex;
+		/// Published with atomic_store, read with atomic_load
+		std::shared_ptr<const Table> mTable;
+		/// Cached paths in insertion order, walked by the eviction hand
+		std::vector<String> mClock;
+		size_t mHand;
+		std::unordered_map<String, Load> mLoads;
+		unsigned long long mNextLoad;
+
+		std::atomic<size_t> mHits;
+		std::atomic<size_t> mMisses;
+		std::atomic<size_t> mLoadCount;
+		std::atomic<size_t> mFailures;
+		std::atomic<size_t> mInvalidations;
+		std::atomic<size_t> mEvictions;
+
+		Reloader mReloader;
+		std::mutex mPoolMutex;
+		DispatchPool* mPool;
+	};
+
+};//namespace FW
+
+#endif//_FW_FILECACHE_H_
@@ -0,0 +1,103 @@
+/**
+	The set of files a manifest watch cares about, with a filter that
+	rejects most other names without touching the set.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_FILEMANIFEST_H_
+#define _FW_FILEMANIFEST_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace FW
+{
+	/// Absolute paths of the files to watch. Lookups go through a Bloom
+	/// filter first, so names that are not listed are rejected without
+	/// building a path or probing the set. Every directory holding a file,
+	/// and every directory above it, is counted so a crawl can skip the
+	/// subtrees that hold nothing listed.
+	/// @class FileManifest
+	class FileManifest
+	{
+	public:
+		FileManifest();
+
+		/// Adds a file. Returns false if it was listed already or the path
+		/// is not absolute.
+		bool add(const String& path);
+
+		/// Removes a file. Returns false if it was not listed.
+		bool remove(const String& path);
+
+		/// Adds the paths of a file, one per line. Returns false when the
+		/// file cannot be read.
+		bool load(const String& file);
+
+		/// Number of files
+		size_t size() const { return mFiles.size(); }
+
+		bool empty() const { return mFiles.empty(); }
+
+		/// Whether filename in dir is listed
+		bool contains(const String& dir, const String& filename) const;
+
+		/// Whether directory holds a listed file or has one below it
+		bool covers(const String& directory) const;
+
+		/// The directories that hold listed files
+		std::vector<String> getDirectories() const;
+
+		/// The deepest directory every listed file is below
+		String getCommonDirectory() const;
+
+	private:
+		/// FNV-1a of dir + '/' + filename, the same as of the joined path
+		static unsigned long long hash(const String& dir, const String& filename);
+
+		void setBits(unsigned long long hash);
+
+		bool testBits(unsigned long long hash) const;
+
+		/// Sizes the filter for the files and sets their bits again
+		void rebuildFilter();
+
+		/// Adds delta to the counts of the directories above path
+		void countDirectories(const String& path, int delta);
+
+		std::unordered_set<String> mFiles;
+		/// Listed files in or below each directory
+		std::unordered_map<String, size_t> mDirectories;
+		/// Bloom filter over the hashes of mFiles
+		std::vector<unsigned long long> mFilter;
+		/// Number of bits in mFilter minus one
+		unsigned long long mFilterMask;
+		/// Files removed since the filter was built, their bits stay set
+		size_t mStale;
+	};
+
+};//namespace FW
+
+#endif//_FW_FILEMANIFEST_H_
@@ -33,8 +33,14 @@
 #include <string>
 #include <stdexcept>
 #include <thread>
+#include <atomic>
 #include <mutex>
 #include <queue>
+#include <map>
+#include <vector>
+#include <memory>
+#include <future>
+#include <functional>
 
 namespace FW
 {
@@ -46,6 +52,7 @@ namespace FW
 	// forward declarations
 	class FileWatcherImpl;
 	class FileWatchListener;
+	class FileManifest;
 
 	/// Base exception class
 	/// @class Exception
@@ -83,11 +90,316 @@ namespace FW
 			/// Sent when a file is deleted or renamed
 			Delete = 2,
 			/// Sent when a file is modified
-			Modified = 4
+			Modified = 4,
+			/// Sent when events for the directory were lost, because the
+			/// kernel queue or a bounded event queue overflowed. The filename
+			/// is empty; rescan the directory to catch up.
+			Overflow = 8,
+			/// Sent instead of the events of a directory while its watch is
+			/// in a storm, at most once per update. The filename is empty and
+			/// FileInfo::events holds the number of events it stands for.
+			Dirty = 16,
+			/// Sent for the watched directory when its watch enters a storm
+			StormBegin = 32,
+			/// Sent for the watched directory when the storm is over, before
+			/// the net changes of the files of the dirty directories
+			StormEnd = 64
 		};
 	};
 	typedef Actions::Action Action;
 
+	/// Whether an action is about a whole directory rather than one file
+	inline bool isDirectoryAction(Action action)
+	{
+		return action >= Actions::Overflow;
+	}
+
+	/// Kinds of file system entries
+	namespace FileTypes
+	{
+		enum FileType
+		{
+			/// Not known, e.g. for Overflow
+			Unknown = 0,
+			/// A regular file, or anything that is not a directory when the
+			/// entry could not be inspected
+			File = 1,
+			Directory = 2,
+			Symlink = 3,
+			/// Devices, sockets and pipes
+			Other = 4
+		};
+	};
+	typedef FileTypes::FileType FileType;
+
+	/// What the watcher knew about an entry when it reported an event.
+	/// The type comes with every event of the Linux backend; the other
+	/// fields are filled in for watches added with WatchOptions::metadata.
+	struct FileInfo
+	{
+		FileType type;
+		/// True when size, mtime and inode were read. Stays false for
+		/// deletes and for entries gone by the time they were inspected.
+		bool hasStat;
+		unsigned long long size;
+		/// Modification time in nanoseconds since the epoch
+		long long mtime;
+		unsigned long long inode;
+		/// Number of events an Actions::Dirty stands for
+		size_t events;
+
+		FileInfo() : type(FileTypes::Unknown), hasStat(false), size(0), mtime(0), inode(0), events(0) {}
+	};
+
+	/// The net change of one path over a changeset
+	struct Change
+	{
+		String dir;
+		String filename;
+		/// The action that sums up every event of the path, e.g. Add for a
+		/// file that was created and then written
+		Action action;
+		/// From the last event of the path
+		FileInfo info;
+
+		Change() : action(Actions::Modified) {}
+	};
+
+	/// Changes of one watch, in the order the paths first changed
+	typedef std::vector<Change> Changeset;
+
+	/// Position in the event history of a watcher. Every event recorded
+	/// for a watch with WatchOptions::historySize advances the clock.
+	typedef unsigned long long ClockToken;
+
+	/// Answer to FileWatcher::query
+	struct HistoryResult
+	{
+		/// Token to pass to the next query
+		ClockToken clock;
+		/// True when the history does not reach back to the token, because
+		/// it was truncated, events were lost or the token is unknown. The
+		/// changes are empty then; rescan and query from clock onwards.
+		bool freshInstance;
+		/// The net change of every path that changed after the token
+		Changeset changes;
+
+		HistoryResult() : clock(0), freshInstance(false) {}
+	};
+
+	/// Memory bounds of the heavy hitter counting.
+	struct HeavyHitterOptions
+	{
+		/// Busiest files and busiest directories reported, each
+		size_t topK;
+		/// Counters per row of the count-min sketch, rounded up to a power
+		/// of two. More counters tighten the estimates.
+		size_t width;
+
+		HeavyHitterOptions() : topK(32), width(4096) {}
+	};
+
+	/// A busy file or directory of a watch
+	struct HeavyHitter
+	{
+		WatchID watchid;
+		String dir;
+		/// Empty for a directory
+		String filename;
+		/// Estimated events, never below the true count
+		unsigned long long count;
+		/// Most the estimate may be above the true count
+		unsigned long long error;
+		/// Events by action since the path became a candidate
+		unsigned long long adds;
+		unsigned long long deletes;
+		unsigned long long modifies;
+		/// Overflow, Dirty and the other directory actions
+		unsigned long long others;
+
+		HeavyHitter()
+			: watchid(0), count(0), error(0), adds(0), deletes(0), modifies(0), others(0)
+		{}
+	};
+
+	/// Answer to FileWatcher::getHeavyHitters, busiest first
+	struct HeavyHitterReport
+	{
+		/// Events counted
+		unsigned long long events;
+		std::vector<HeavyHitter> files;
+		std::vector<HeavyHitter> directories;
+
+		HeavyHitterReport() : events(0) {}
+	};
+
+	/// Per watch settings for addWatch.
+	struct WatchOptions
+	{
+		/// Watch subdirectories as well
+		bool recursive;
+		/// Events of watches with a higher priority are dispatched first
+		int priority;
+		/// Share of the dispatch among watches of the same priority. A watch
+		/// with weight 4 gets four events dispatched for every one of a
+		/// watch with weight 1 while both have events pending.
+		unsigned int weight;
+		/// Most events per second dispatched for this watch, 0 for no limit.
+		/// Events over the limit are held for later updates, and the events
+		/// of a file are merged into its net change while they wait.
+		unsigned int rateLimit;
+		/// gitignore style patterns for entries to leave out of a recursive
+		/// watch, such as ".git" or "build/". Excluded directories are
+		/// neither crawled nor watched. Honoured by the Linux backend.
+		std::vector<String> exclude;
+		/// gitignore style files to read more patterns from. Relative paths
+		/// start at the watched directory; the patterns of a file below it
+		/// apply to the file's own directory.
+		std::vector<String> excludeFrom;
+		/// Read the size, mtime and inode of changed entries and pass them to
+		/// FileWatchListener::handleFileEvent. The entries of one read are
+		/// inspected together, one directory at a time. Honoured by the
+		/// Linux backend.
+		bool metadata;
+		/// Group the events of the watch into changesets that are passed to
+		/// FileWatchListener::handleChangeset once no event arrived for this
+		/// many milliseconds. 0 reports every event on its own.
+		unsigned int settleTime;
+		/// Longest a changeset is held while events keep coming, in
+		/// milliseconds. 0 waits for the watch to settle.
+		unsigned int maxLatency;
+		/// Number of paths whose recent changes are kept for
+		/// FileWatcher::query. 0 keeps no history.
+		size_t historySize;
+		/// Events per second that put the watch into a storm, 0 for never.
+		/// During a storm the events of each directory are collapsed into
+		/// Actions::Dirty, between Actions::StormBegin and StormEnd. The rate
+		/// is measured over 100 milliseconds, or over the time the threshold
+		/// takes for 10 events when that is longer. Honoured by the Linux
+		/// backend.
+		unsigned int stormThreshold;
+		/// Milliseconds the rate has to stay below stormThreshold before the
+		/// storm ends and the files of the dirty directories are rescanned
+		unsigned int stormCooldown;
+		/// Files the watch is limited to. Only directories holding them, or
+		/// with them below, are crawled and watched, and events for other
+		/// names are dropped before dispatch. Honoured by the Linux backend.
+		std::shared_ptr<const FileManifest> manifest;
+
+		WatchOptions()
+			: recursive(false), priority(0), weight(1), rateLimit(0), metadata(false), settleTime(0), maxLatency(0),
+			historySize(0), stormThreshold(0), stormCooldown(1000)
+		{}
+	};
+
+	/// What a bounded event queue does when it is full.
+	namespace QueuePolicies
+	{
+		enum QueuePolicy
+		{
+			/// Stop reading from the kernel until the listeners catch up.
+			/// Events wait in the kernel queue meanwhile.
+			Block = 0,
+			/// Drop the oldest queued event and send Actions::Overflow for
+			/// its directory before the next dispatched event
+			DropOldest = 1,
+			/// Keep at most one pending event per file and merge later actions
+			/// into it. Drops the oldest event like DropOldest when the queue
+			/// is full of distinct files.
+			Coalesce = 2
+		};
+	};
+	typedef QueuePolicies::QueuePolicy QueuePolicy;
+
+	/// Bound and policy for the queue between reading and dispatch in
+	/// BufferedFileWatcher and AsyncFileWatcher.
+	struct QueueOptions
+	{
+		/// Most events held, 0 dispatches straight from the reader as before
+		size_t capacity;
+		/// What happens when the queue is full
+		QueuePolicy policy;
+
+		QueueOptions()
+			: capacity(0), policy(QueuePolicies::Block)
+		{}
+
+		QueueOptions(size_t capacity, QueuePolicy policy)
+			: capacity(capacity), policy(policy)
+		{}
+	};
+
+	/// Counters of a bounded event queue
+	struct QueueStats
+	{
+		/// Events waiting for dispatch
+		size_t depth;
+		/// Largest depth seen
+		size_t highWater;
+		/// Events dropped by DropOldest or Coalesce
+		size_t dropped;
+		/// Events merged into a pending event by Coalesce
+		size_t coalesced;
+		/// Times the reader had to wait for space
+		size_t blocked;
+
+		QueueStats() : depth(0), highWater(0), dropped(0), coalesced(0), blocked(0) {}
+	};
+
+	class EventQueue;
+	class DispatchPool;
+	class ChangesetCollector;
+	class EventHistory;
+	class HeavyHitters;
+
+	/// Ways a backend can read events from the kernel.
+	namespace EventReaders
+	{
+		enum EventReader
+		{
+			/// The backend's native mechanism (select and read on Linux)
+			Default = 0,
+			/// Linux only. Keeps a read of the inotify descriptor in flight
+			/// on an io_uring, so an update without events costs no system call
+			IoUring = 1
+		};
+	};
+	typedef EventReaders::EventReader EventReader;
+
+	/// An application owned submission ring, typically an io_uring, that
+	/// the watcher queues its reads on. The application passes completions
+	/// back through FileWatcher::completeRead, so file changes are handled
+	/// in the same loop as the rest of its I/O.
+	/// @class EventRing
+	class EventRing
+	{
+	public:
+		virtual ~EventRing() {}
+
+		/// Queue a read of up to size bytes from fd into buffer. The completion
+		/// must be reported with the given tag. Returns false if the read
+		/// could not be queued.
+		virtual bool submitRead(int fd, void* buffer, size_t size, unsigned long long tag) = 0;
+	};
+
+	/// Memory held by a watcher for its watch records. Only the user space
+	/// side is counted; the kernel charges its own per watch cost against
+	/// the user's memory cgroup in addition to this.
+	struct MemoryUsage
+	{
+		/// Number of kernel watches held
+		size_t watches;
+		/// Bytes held for watch records, lookup tables and directory names
+		size_t bytes;
+		/// Directories covered by stat polling because the watch limit was reached
+		size_t polled;
+
+		MemoryUsage() : watches(0), bytes(0), polled(0) {}
+
+		/// Average bytes per watch
+		size_t bytesPerWatch() const { return watches ? bytes / watches : 0; }
+	};
+
 	/// Listens to files and directories and dispatches events
 	/// to notify the parent program of the changes.
 	/// @class FileWatcher
@@ -98,6 +410,10 @@ namespace FW
 		///
 		FileWatcher();
 
+		/// Runs on impl instead of the platform backend, e.g. a
+		/// FileWatcherFake, and deletes it when done.
+		explicit FileWatcher(FileWatcherImpl* impl);
+
 		///
 		///
 		virtual ~FileWatcher();
@@ -111,28 +427,179 @@ namespace FW
 		/// @exception FileNotFoundException Thrown when the requested directory does not exist
 		WatchID addWatch(const String& directory, FileWatchListener* watcher, bool recursive);
 
+		/// Add a directory watch with scheduling options. Priority, weight
+		/// and rate limits are honoured by the Linux backend; other backends
+		/// dispatch in arrival order. A directory that a watch already
+		/// covers gets the id of that watch, whose listener and options
+		/// stay as they are.
+		/// @exception FileNotFoundException Thrown when the requested directory does not exist
+		WatchID addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options);
+
+		/// Watch the files of a manifest: a recursive watch on their common
+		/// directory, limited to the directories that lead to them.
+		/// @exception FileNotFoundException Thrown when the common directory does not exist
+		WatchID addWatch(const FileManifest& manifest, FileWatchListener* watcher, const WatchOptions& options = WatchOptions());
+
 		/// Remove a directory watch. This is a brute force search O(nlogn).
 		void removeWatch(const String& directory);
 
 		/// Remove a directory watch. This is a map lookup O(logn).
 		void removeWatch(WatchID watchid);
 
+		/// Adds and removes files of the manifest of watchid, watching or
+		/// dropping directories to match. Returns false if the watch has no
+		/// manifest or an added file is outside its directory.
+		bool updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed);
+
 		/// Updates the watcher. Must be called often.
 		void update();
 
+		/// Reports the memory held for the current watches.
+		MemoryUsage getMemoryUsage() const;
+
+		/// Selects how kernel events are read. Returns false when the reader
+		/// is not available on this system, in which case the previous reader
+		/// stays in use.
+		bool setEventReader(EventReader reader);
+
+		/// Queues the kernel reads on an application owned ring instead of
+		/// reading in update(). Completions tagged with tag must be passed to
+		/// completeRead from the thread that calls update(). Pass 0 to go back
+		/// to reading in update(). Returns false if the backend cannot do this.
+		/// To detach, cancel the read tagged with tag on the ring and pass its
+		/// completion, -ECANCELED or the bytes it read, to completeRead before
+		/// passing 0 or destroying the watcher; until then the read still
+		/// writes to the watcher's buffer and switching rings returns false.
+		bool setEventRing(EventRing* ring, unsigned long long tag);
+
+		/// Dispatches the events of a completed read queued on the EventRing.
+		/// @param result Bytes read, or a negative errno value
+		void completeRead(int result);
+
+		/// Caps the number of kernel watches. When the cap or the system limit
+		/// is reached, the least recently active directories lose their kernel
+		/// watch and are polled every pollInterval milliseconds until they see
+		/// changes again. Pass 0 to use the system limit. Returns false if the
+		/// backend has no such limit.
+		bool setWatchLimit(size_t watches, unsigned int pollInterval = 1000);
+
+		/// Runs the listeners of watches added afterwards on a pool of
+		/// threads. Events of the same watch and path keep their order.
+		/// Pass 0 to call listeners from update() again. Returns false while
+		/// watches still dispatch through the current pool.
+		/// @param waitInUpdate When true, update() returns only after the
+		/// callbacks for the events it read have run
+		bool setDispatchThreads(unsigned int threads, bool waitInUpdate = false);
+
+		/// Waits for the callbacks running on the dispatch pool.
+		void flush();
+
+		/// Blocks until events are ready for update(), wake() is called or
+		/// timeout milliseconds pass; -1 waits without a timeout. Returns true
+		/// when events are ready. Backends that cannot wait sleep for the
+		/// timeout and return true.
+		bool wait(int timeout);
+
+		/// Makes a wait on another thread return early. Safe to call from
+		/// any thread.
+		void wake();
+
+		/// The clock of the latest recorded event. Safe to call from any thread.
+		ClockToken getClock() const;
+
+		/// The changes of a watch added with WatchOptions::historySize after
+		/// the since token. Safe to call from any thread.
+		HistoryResult query(WatchID watchid, ClockToken since) const;
+
+		/// Counts the events of the watches added from now on by file and
+		/// directory, in memory bounded by options, to find noisy paths.
+		/// Calling it again starts over.
+		void enableHeavyHitters(const HeavyHitterOptions& options = HeavyHitterOptions());
+
+		/// The busiest files and directories counted so far. Empty unless
+		/// enableHeavyHitters was called. Safe to call from any thread.
+		HeavyHitterReport getHeavyHitters() const;
+
+		/// Holds back the events of watchid, keeping the net change of each
+		/// path, e.g. while the application writes to the directory itself.
+		/// The kernel watches stay in place. Returns false if the watch is
+		/// unknown, already paused or the backend cannot pause.
+		bool pause(WatchID watchid);
+
+		/// Delivers the net changes since pause as one changeset, through
+		/// FileWatchListener::handleChangeset, and lets events through
+		/// again. The history and the heavy hitters see the events while
+		/// the watch is paused, and with a settle time the changes go out
+		/// at once. Returns false if the watch was not paused.
+		bool resume(WatchID watchid);
+
 	private:
 		/// The implementation
 		FileWatcherImpl* mImpl;
 
+		/// Runs the listeners when dispatch threads are set
+		DispatchPool* mPool;
+
+		struct Watch
+		{
+			String mDirectory;
+			/// the listener is called from mPool
+			bool mPooled;
+			/// the heavy hitters count its events
+			bool mCounted;
+			/// 0 without a history
+			size_t mHistorySize;
+			/// the collector, the pool or the listener, behind the stages
+			/// that record events
+			FileWatchListener* mTarget;
+			/// mPaused stands in for mTarget
+			bool mPaused;
+		};
+
+		/// Records a watch added through this watcher, returns 0 if the
+		/// backend handed back one that exists
+		Watch* addWatchEntry(WatchID watchid, const String& directory, FileWatchListener* target);
+
+		/// Passes the events of watchid from its last recording stage on to
+		/// target. Returns false if the backend cannot swap listeners.
+		bool connectTarget(WatchID watchid, const Watch& watch, FileWatchListener* target);
+
+		/// Watches added through this watcher
+		std::map<WatchID, Watch> mWatches;
+
+		/// Watches whose listener is called from mPool
+		size_t mPooledWatches;
+
+		/// Holds the events of watches with a settle time, created on demand
+		ChangesetCollector* mCollector;
+
+		/// Records the events of watches with a history size
+		EventHistory* mHistory;
+
+		/// Counts events by path once enabled, in front of the history
+		HeavyHitters* mHeavyHitters;
+
+		/// Holds the events of paused watches, 0 until the first pause
+		ChangesetCollector* mPaused;
+
+		bool mWaitForDispatch;
+
 	};//end FileWatcher
 
 	enum cmd_type
 	{
 		AddWatch,
 		RemoveWatchStr,
-		RemoveWatchID
+		RemoveWatchID,
+		PauseWatch,
+		ResumeWatch,
+		UpdateManifest,
+		RunBatch
 	};
 
+	/// A submitted WatchBatch and where its results go
+	struct batch_command;
+
 	struct command_struct
 	{
 		String path;
@@ -149,15 +616,135 @@ namespace FW
 			{
 				WatchID id;
 			} RemoveID;
+
+			/// PauseWatch, ResumeWatch and UpdateManifest
+			struct
+			{
+				WatchID id;
+			} Pause;
 		};
 
+		/// only used by AddWatch
+		WatchOptions options;
+
+		/// only used by UpdateManifest
+		std::vector<String> added;
+		std::vector<String> removed;
+
+		/// only used by RunBatch
+		std::shared_ptr<batch_command> batch;
+
 		cmd_type Type;
 	};
 
+	/// Outcome of one operation of a WatchBatch
+	struct WatchResult
+	{
+		/// The new watch for an add, the removed one for a remove by id, the
+		/// paused, resumed or updated one, 0 if it was not
+		WatchID watchid;
+		/// The exception the operation threw, empty on success
+		std::exception_ptr error;
+		/// what() of the error
+		String message;
+
+		WatchResult() : watchid(0) {}
+
+		bool failed() const { return error != nullptr; }
+	};
+
+	/// Called with the results of a batch, in the order of the operations
+	typedef std::function<void(const std::vector<WatchResult>&)> BatchCallback;
+
+	/// Add and remove operations that a BufferedFileWatcher runs together,
+	/// in one pass on its watcher thread.
+	/// @class WatchBatch
+	class WatchBatch
+	{
+		friend class BufferedFileWatcher;
+	public:
+		void addWatch(const String& directory, FileWatchListener* watcher, bool recursive = false);
+
+		void addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options);
+
+		void removeWatch(const String& directory);
+
+		void removeWatch(WatchID watchid);
+
+		void pause(WatchID watchid);
+
+		void resume(WatchID watchid);
+
+		void updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed);
+
+		/// Number of operations
+		size_t size() const { return m_commands.size(); }
+
+		bool empty() const { return m_commands.empty(); }
+
+	private:
+		std::vector<command_struct> m_commands;
+	};
+
+	/// How the AsyncFileWatcher thread waits for events.
+	struct ReaderOptions
+	{
+		/// CPU the reader thread is pinned to, -1 to leave it to the system
+		int cpu;
+		/// Microseconds the reader keeps checking for events without
+		/// blocking after it found some. Costs a core while spinning; saves
+		/// the wakeup of a blocking wait for bursts of events.
+		unsigned int spin;
+		/// Longest blocking wait in milliseconds. Commands and directories
+		/// without a kernel watch are handled at least this often.
+		unsigned int maxWait;
+		/// Record the latency reported by AsyncFileWatcher::getLatencyStats
+		bool measureLatency;
+
+		ReaderOptions()
+			: cpu(-1), spin(0), maxWait(50), measureLatency(false)
+		{}
+	};
+
+	/// Wakeup to callback latency of an AsyncFileWatcher, in microseconds.
+	/// Measured from the moment the reader sees events until the callbacks
+	/// for them have returned, or until they are queued when listeners run
+	/// on the dispatch thread. Percentiles are rounded up to a power of two.
+	struct LatencyStats
+	{
+		/// Wakeups that found events
+		size_t wakeups;
+		/// Wakeups that found events while spinning
+		size_t spinWakeups;
+		/// Microseconds spent spinning
+		unsigned long long spinTime;
+		unsigned long long min;
+		unsigned long long p50;
+		unsigned long long p99;
+		unsigned long long max;
+		double mean;
+
+		LatencyStats()
+			: wakeups(0), spinWakeups(0), spinTime(0), min(0), p50(0), p99(0), max(0), mean(0)
+		{}
+	};
+
+	class AsyncFileWatcher;
+
 	class BufferedFileWatcher
 	{
+		friend class AsyncFileWatcher;
+		friend void async_filewatcher_thread(AsyncFileWatcher* args);
+		friend void async_dispatch_thread(AsyncFileWatcher* args);
 	public:
-		BufferedFileWatcher();
+		/// @param queue Bound and policy of the event queue. By default events
+		/// are dispatched while reading, without a queue. Since update() both
+		/// reads and dispatches, the Block policy skips reading while the
+		/// queue is full, and a single read may go past the bound.
+		BufferedFileWatcher(const QueueOptions& queue = QueueOptions());
+
+		/// Runs on impl instead of the platform backend and deletes it when done.
+		explicit BufferedFileWatcher(FileWatcherImpl* impl, const QueueOptions& queue = QueueOptions());
 		virtual ~BufferedFileWatcher();
 
 	public:
@@ -170,26 +757,94 @@ namespace FW
 		/// @exception FileNotFoundException Thrown when the requested directory does not exist
 		void addWatch(const String& directory, FileWatchListener* watcher, bool recursive, WatchID* target = nullptr);
 
+		/// Add a directory watch with scheduling options
+		/// @exception FileNotFoundException Thrown when the requested directory does not exist
+		void addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options, WatchID* target = nullptr);
+
+		/// Watch the files of a manifest, see FileWatcher::addWatch
+		/// @exception FileNotFoundException Thrown when the common directory does not exist
+		void addWatch(const FileManifest& manifest, FileWatchListener* watcher, const WatchOptions& options, WatchID* target = nullptr);
+
 		/// Remove a directory watch. This is a brute force search O(nlogn).
 		void removeWatch(const String& directory);
 
 		/// Remove a directory watch. This is a map lookup O(logn).
 		void removeWatch(WatchID watchid);
 
+		/// Queues a batch as a single command. The future becomes ready at
+		/// the update() that runs it. Failed operations don't stop the batch;
+		/// their error is in their result.
+		std::future<std::vector<WatchResult> > submit(const WatchBatch& batch);
+
+		/// Queues a batch as a single command. completion is called from
+		/// update() once the whole batch has run.
+		void submit(const WatchBatch& batch, const BatchCallback& completion);
+
 		/// Updates the watcher. Must be called often.
 		void update();
 
+		/// Reports the event queue counters. All zero without a queue.
+		QueueStats getQueueStats() const;
+
+		/// The clock of the latest recorded event. Safe to call from any thread.
+		ClockToken getClock() const;
+
+		/// The changes of a watch added with WatchOptions::historySize after
+		/// the since token. Safe to call from any thread.
+		HistoryResult query(WatchID watchid, ClockToken since) const;
+
+		/// Counts the events of watches added afterwards by path. Call it
+		/// before adding the watches to count.
+		void enableHeavyHitters(const HeavyHitterOptions& options = HeavyHitterOptions());
+
+		/// The busiest files and directories. Safe to call from any thread.
+		HeavyHitterReport getHeavyHitters() const;
+
+		/// Queues a pause of watchid, see FileWatcher::pause.
+		void pause(WatchID watchid);
+
+		/// Queues a resume of watchid, see FileWatcher::resume.
+		void resume(WatchID watchid);
+
+		/// Queues a manifest update, see FileWatcher::updateManifest.
+		void updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed);
+
 	private:
+		/// Runs one command, returning the WatchID it added or removed
+		WatchID runCommand(const command_struct& cmd);
+
+		/// Runs every operation of a batch and reports the results
+		void runBatch(batch_command& batch);
+
+		/// Registers the listener of a new watch with the queue
+		WatchID addQueuedWatch(const command_struct& cmd);
+
 		FileWatcher m_watcher;
 		std::mutex m_mutex;
 		std::queue<command_struct> m_commands;
+		/// Events between reading and dispatch, 0 without a bound
+		EventQueue* m_queue;
+		/// WatchIDs of queued watches by path, for removeWatch by path
+		std::map<String, WatchID> m_paths;
+		/// Whether update() dispatches the queue, false when AsyncFileWatcher
+		/// dispatches on its own thread
+		bool m_dispatch;
 	};
 
 	class AsyncFileWatcher
 	{
 		friend void async_filewatcher_thread(AsyncFileWatcher* args);
+		friend void async_dispatch_thread(AsyncFileWatcher* args);
 	public:
-		AsyncFileWatcher();
+		/// @param queue Bound and policy of the event queue. With a capacity,
+		/// listeners run on a separate dispatch thread so a slow listener
+		/// never stalls reading. By default listeners run on the watcher
+		/// thread.
+		/// @param reader How the watcher thread waits for events
+		AsyncFileWatcher(const QueueOptions& queue = QueueOptions(), const ReaderOptions& reader = ReaderOptions());
+
+		/// Runs on impl instead of the platform backend and deletes it when done.
+		explicit AsyncFileWatcher(FileWatcherImpl* impl, const QueueOptions& queue = QueueOptions(), const ReaderOptions& reader = ReaderOptions());
 		virtual ~AsyncFileWatcher();
 
 	public:
@@ -202,19 +857,81 @@ namespace FW
 		/// @exception FileNotFoundException Thrown when the requested directory does not exist
 		void addWatch(const String& directory, FileWatchListener* watcher, bool recursive, WatchID* target = NULL);
 
+		/// Add a directory watch with scheduling options
+		/// @exception FileNotFoundException Thrown when the requested directory does not exist
+		void addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options, WatchID* target = NULL);
+
+		/// Watch the files of a manifest, see FileWatcher::addWatch
+		/// @exception FileNotFoundException Thrown when the common directory does not exist
+		void addWatch(const FileManifest& manifest, FileWatchListener* watcher, const WatchOptions& options, WatchID* target = NULL);
+
 		/// Remove a directory watch. This is a brute force search O(nlogn).
 		void removeWatch(const String& directory);
 
 		/// Remove a directory watch. This is a map lookup O(logn).
 		void removeWatch(WatchID watchid);
 
+		/// Queues a batch as a single command. The future becomes ready once
+		/// the watcher thread has run it.
+		std::future<std::vector<WatchResult> > submit(const WatchBatch& batch);
+
+		/// Queues a batch as a single command. completion is called on the
+		/// watcher thread once the whole batch has run.
+		void submit(const WatchBatch& batch, const BatchCallback& completion);
+
 		/// Updates the watcher. Must be called often.
 		void update();
 
+		/// Reports the event queue counters. All zero without a queue.
+		QueueStats getQueueStats() const;
+
+		/// Reports the wakeup to callback latency. All zero unless
+		/// ReaderOptions::measureLatency is set.
+		LatencyStats getLatencyStats() const;
+
+		/// The clock of the latest recorded event
+		ClockToken getClock() const;
+
+		/// The changes of a watch added with WatchOptions::historySize after
+		/// the since token. Answers from the history, so it may run while the
+		/// watcher thread is busy.
+		HistoryResult query(WatchID watchid, ClockToken since) const;
+
+		/// Counts the events of watches added afterwards by path. Call it
+		/// before adding the watches to count.
+		void enableHeavyHitters(const HeavyHitterOptions& options = HeavyHitterOptions());
+
+		/// The busiest files and directories, answered while the watcher
+		/// thread runs.
+		HeavyHitterReport getHeavyHitters() const;
+
+		/// Queues a pause of watchid, see FileWatcher::pause.
+		void pause(WatchID watchid);
+
+		/// Queues a resume of watchid, see FileWatcher::resume.
+		void resume(WatchID watchid);
+
+		/// Queues a manifest update, see FileWatcher::updateManifest.
+		void updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed);
+
 	private:
+		/// Starts the watcher thread, and the dispatch thread with a queue
+		void start();
+
+		/// Adds a wakeup to the latency counters
+		void recordLatency(unsigned long long micros, bool spun);
+
 		BufferedFileWatcher m_watch;
+		ReaderOptions m_reader;
+		mutable std::mutex m_statsMutex;
+		LatencyStats m_stats;
+		/// wakeups by latency, bucket i holds latencies below 2^i microseconds
+		std::vector<size_t> m_latencies;
+		unsigned long long m_latencySum;
 		std::thread m_thr;
-		bool m_running;
+		/// Runs the listeners when the queue is bounded
+		std::thread m_dispatchThr;
+		std::atomic<bool> m_running;
 	};
 
 	/// Basic interface for listening for file events.
@@ -232,6 +949,24 @@ namespace FW
 		/// @param action Action that was performed
 		virtual void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action) = 0;
 
+		/// Handles the action along with what is known about the entry.
+		/// Backends that gather FileInfo call this; the default forwards to
+		/// handleFileAction.
+		virtual void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+		{
+			handleFileAction(watchid, dir, filename, action);
+		}
+
+		/// Handles the changes of a watch added with WatchOptions::settleTime
+		/// once it settled. Runs on the thread that updates the watcher, also
+		/// when dispatch threads are set. The default passes each change to
+		/// handleFileEvent.
+		virtual void handleChangeset(WatchID watchid, const Changeset& changes)
+		{
+			for(size_t i = 0; i < changes.size(); ++i)
+				handleFileEvent(watchid, changes[i].dir, changes[i].filename, changes[i].action, changes[i].info);
+		}
+
 	};//class FileWatchListener
 
 };//namespace FW
@@ -0,0 +1,168 @@
+/**
+	Implementation driven by events the program injects, on a clock it
+	advances, for tests and benchmarks that should not touch the file
+	system.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_FILEWATCHERFAKE_H_
+#define _FW_FILEWATCHERFAKE_H_
+#pragma once
+
+#include "FileWatcherImpl.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace FW
+{
+	/// Implementation without a kernel. Directories need not exist; events
+	/// are queued with inject() and delivered to the watch covering their
+	/// directory on the next update(). As with the Linux backend, adding
+	/// a directory that a watch covers returns the id of that watch. Of
+	/// the WatchOptions, recursive and manifest are honoured. The clock only moves with advance():
+	/// events injected for a later time wait for it, and settle times of
+	/// the watches run on it. Watches are added, removed and updated from
+	/// one thread; events may be injected from any thread.
+	/// @class FileWatcherFake
+	class FileWatcherFake : public FileWatcherImpl
+	{
+	public:
+		///
+		///
+		FileWatcherFake();
+
+		///
+		///
+		virtual ~FileWatcherFake();
+
+		/// Add a directory watch
+		WatchID addWatch(const String& directory, FileWatchListener* watcher, bool recursive);
+
+		/// Add a directory watch, limited to the files of options.manifest
+		WatchID addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options);
+
+		/// Remove a directory watch.
+		void removeWatch(const String& directory);
+
+		/// Remove a directory watch.
+		void removeWatch(WatchID watchid);
+
+		/// Delivers the events that are due.
+		void update();
+
+		/// Unused, events do not come from WatchStructs
+		void handleAction(WatchStruct* watch, const String& filename, unsigned long action) {}
+
+		/// Blocks until events are due, wake is called or timeout
+		/// milliseconds of real time pass.
+		int wait(int timeout);
+
+		/// Makes a wait on another thread return early.
+		void wake();
+
+		/// The simulated clock
+		std::chrono::steady_clock::time_point now() const;
+
+		/// Sends the events of watchid to listener
+		FileWatchListener* swapListener(WatchID watchid, FileWatchListener* listener, String& directory);
+
+		/// Changes the manifest of watchid
+		bool updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed);
+
+		/// Queues an event for the watch on dir, or the recursive watch
+		/// above it. Events for unwatched directories are dropped on
+		/// delivery.
+		void inject(const String& dir, const String& filename, Action action, const FileInfo& info = FileInfo());
+
+		/// Queues count copies of an event for watchid, in its directory.
+		/// The cheapest way to push many events through the listeners.
+		void inject(WatchID watchid, const String& filename, Action action, size_t count = 1);
+
+		/// Like inject, delivered once the clock reaches time milliseconds.
+		void injectAt(unsigned long long time, const String& dir, const String& filename, Action action, const FileInfo& info = FileInfo());
+
+		/// Moves the clock forward, making the events injected up to then due.
+		void advance(unsigned long long milliseconds);
+
+		/// Milliseconds on the clock, starting at 0
+		unsigned long long getTime() const;
+
+		/// Number of events injected and not yet delivered
+		size_t getPendingCount() const;
+
+		/// Number of events delivered to listeners
+		unsigned long long getDeliveredCount() const { return mDelivered; }
+
+	private:
+		struct Watch
+		{
+			String mDirectory;
+			FileWatchListener* mListener;
+			bool mRecursive;
+			/// files the watch is limited to, null without a manifest
+			std::shared_ptr<FileManifest> mManifest;
+		};
+
+		struct Event
+		{
+			/// 0 to route by mDir
+			WatchID mWatchID;
+			String mDir;
+			String mFilename;
+			Action mAction;
+			FileInfo mInfo;
+			size_t mCount;
+		};
+
+		FileWatcherFake(const FileWatcherFake&);
+		FileWatcherFake& operator=(const FileWatcherFake&);
+
+		/// The watch for events in dir, 0 if none covers it
+		const Watch* route(const String& dir, WatchID& watchid) const;
+
+		std::map<WatchID, Watch> mWatches;
+		/// WatchIDs by directory
+		std::unordered_map<String, WatchID> mByDirectory;
+		WatchID mLastWatchID;
+		/// Bumped by removeWatch, so delivery notices a listener going away
+		unsigned long long mRemovals;
+		std::atomic<unsigned long long> mDelivered;
+
+		mutable std::mutex mMutex;
+		std::condition_variable mCondition;
+		/// Events due, in order
+		std::vector<Event> mPending;
+		/// The events update() is delivering, kept for their capacity
+		std::vector<Event> mDelivering;
+		/// Events waiting for the clock, by time
+		std::multimap<unsigned long long, Event> mScheduled;
+		unsigned long long mTime;
+		bool mWoken;
+	};
+
+};//namespace FW
+
+#endif//_FW_FILEWATCHERFAKE_H_
@@ -30,6 +30,8 @@
 
 #include "FileWatcher.h"
 
+#include <chrono>
+
 #define FILEWATCHER_PLATFORM_WIN32 1
 #define FILEWATCHER_PLATFORM_LINUX 2
 #define FILEWATCHER_PLATFORM_KQUEUE 3
@@ -61,6 +63,14 @@ namespace FW
 		/// @exception FileNotFoundException Thrown when the requested directory does not exist
 		virtual WatchID addWatch(const String& directory, FileWatchListener* watcher, bool recursive) = 0;
 
+		/// Add a directory watch with scheduling options. Backends without a
+		/// scheduler only honour the recursive flag.
+		/// @exception FileNotFoundException Thrown when the requested directory does not exist
+		virtual WatchID addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options)
+		{
+			return addWatch(directory, watcher, options.recursive);
+		}
+
 		/// Remove a directory watch. This is a brute force lazy search O(nlogn).
 		virtual void removeWatch(const String& directory) = 0;
 
@@ -73,6 +83,46 @@ namespace FW
 		/// Handles the action
 		virtual void handleAction(WatchStruct* watch, const String& filename, unsigned long action) = 0;
 
+		/// Reports the memory held for the current watches. Backends that
+		/// do not track it report nothing.
+		virtual MemoryUsage getMemoryUsage() const { return MemoryUsage(); }
+
+		/// Selects how kernel events are read. Returns false if unsupported.
+		virtual bool setEventReader(EventReader reader) { return reader == EventReaders::Default; }
+
+		/// Queues the kernel reads on an application owned ring. Returns false
+		/// if unsupported.
+		virtual bool setEventRing(EventRing* ring, unsigned long long tag) { return false; }
+
+		/// Dispatches the events of a read completed on the EventRing.
+		virtual void completeRead(int result) {}
+
+		/// Caps the number of kernel watches. Returns false if unsupported.
+		virtual bool setWatchLimit(size_t watches, unsigned int pollInterval) { return false; }
+
+		/// Blocks until events are ready to be read, wake is called or timeout
+		/// milliseconds pass. Returns 1 when events are ready, 0 otherwise and
+		/// -1 if the backend cannot wait.
+		virtual int wait(int timeout) { return -1; }
+
+		/// Makes a wait on another thread return early.
+		virtual void wake() {}
+
+		/// Sends the events of watchid to listener from now on, including
+		/// the ones already held back, and sets directory to the directory
+		/// of the watch. Returns the listener it replaced, 0 if the watch is
+		/// unknown or the backend cannot swap listeners.
+		virtual FileWatchListener* swapListener(WatchID watchid, FileWatchListener* listener, String& directory) { return 0; }
+
+		/// Adds and removes files of the manifest of watchid. Returns false
+		/// if the watch has no manifest, the backend ignores manifests, or
+		/// an added file is outside the watched directory.
+		virtual bool updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed) { return false; }
+
+		/// The time settle timers run on. Backends with a simulated clock
+		/// override it.
+		virtual std::chrono::steady_clock::time_point now() const { return std::chrono::steady_clock::now(); }
+
 	};//end FileWatcherImpl
 };//namespace FW
 
@@ -32,18 +32,29 @@
 
 #if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
 
-#include <map>
+#include "WatchPool.h"
+#include "EventScheduler.h"
+#include <deque>
+#include <vector>
 #include <sys/types.h>
+#include <sys/select.h>
 
 namespace FW
 {
+	struct WatchRoot;
+	struct PollState;
+	struct StormState;
+	class IoUringReader;
+
 	/// Implementation for Linux based on inotify.
 	/// @class FileWatcherLinux
 	class FileWatcherLinux : public FileWatcherImpl
 	{
 	public:
-		/// type for a map from WatchID to WatchStruct pointer
-		typedef std::map<WatchID, WatchStruct*> WatchMap;
+		/// type for a map from inotify watch descriptor to WatchStruct pointer
+		typedef WatchTable<WatchStruct> WatchMap;
+		/// type for a map from WatchID to WatchRoot pointer
+		typedef WatchTable<WatchRoot> RootMap;
 
 	public:
 		///
@@ -54,10 +65,15 @@ namespace FW
 		///
 		virtual ~FileWatcherLinux();
 
-		/// Add a directory watch
+		/// Add a directory watch. Directories that are already covered by a
+		/// watch return the id of that watch.
 		/// @exception FileNotFoundException Thrown when the requested directory does not exist
 		WatchID addWatch(const String& directory, FileWatchListener* watcher, bool recursive);
 
+		/// Add a directory watch with scheduling options
+		/// @exception FileNotFoundException Thrown when the requested directory does not exist
+		WatchID addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options);
+
 		/// Remove a directory watch. This is a brute force lazy search O(nlogn).
 		void removeWatch(const String& directory);
 
@@ -70,17 +86,221 @@ namespace FW
 		/// Handles the action
 		void handleAction(WatchStruct* watch, const String& filename, unsigned long action);
 
+		/// Reports the memory held for the current watches.
+		MemoryUsage getMemoryUsage() const;
+
+		/// Selects how kernel events are read. Falls back to select when the
+		/// kernel has no io_uring.
+		bool setEventReader(EventReader reader);
+
+		/// Queues the kernel reads on an application owned ring.
+		bool setEventRing(EventRing* ring, unsigned long long tag);
+
+		/// Dispatches the events of a read completed on the EventRing.
+		void completeRead(int result);
+
+		/// Caps the kernel watches, evicting the coldest ones above the cap
+		bool setWatchLimit(size_t watches, unsigned int pollInterval);
+
+		/// Polls the inotify descriptor and the wake descriptor
+		int wait(int timeout);
+
+		/// Signals the wake descriptor
+		void wake();
+
+		/// Sends the events of watchid to listener, scheduled ones included
+		FileWatchListener* swapListener(WatchID watchid, FileWatchListener* listener, String& directory);
+
+		/// Changes the manifest of watchid and watches or drops the
+		/// directories on the way to the files that changed
+		bool updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed);
+
+		/// Returns the full path of a watched directory. Paths are not stored,
+		/// they are rebuilt from the directory tree on demand.
+		const String& getPath(const WatchStruct* watch);
+
 	private:
-		/// Map of WatchID to WatchStruct pointers
+		/// A directory moved away from its parent, waiting for the matching
+		/// IN_MOVED_TO
+		struct PendingMove
+		{
+			unsigned int mCookie;
+			WatchStruct* mWatch;
+			int mAge;
+		};
+
+		/// An event held back until its entry has been inspected
+		struct HeldEvent
+		{
+			WatchID mWatchID;
+			String mDir;
+			String mFilename;
+			Action mAction;
+			FileInfo mInfo;
+			/// whether the entry still has to be inspected
+			bool mInspect;
+		};
+
+		/// Dispatches the inotify records in buffer
+		void processEvents(const char* buffer, ssize_t length);
+
+		/// Handles the action for a directory whose watch lies inside the
+		/// tree of another one, for every watch that covers it
+		void handleNestedAction(WatchRoot* root, WatchStruct* watch, const String& filename, unsigned long action);
+
+		/// Dispatches the actions of an inotify mask to root
+		void dispatchEvent(WatchRoot* root, const String& dir, const String& filename, unsigned long action);
+
+		/// Hands an event on, or holds it while events that need metadata
+		/// are held
+		void dispatchAction(WatchRoot* root, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Hands an event to the watch's listener, or to the scheduler
+		void deliverAction(WatchRoot* root, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Inspects the entries of the held events and dispatches them
+		void flushHeldEvents();
+
+		/// Sends Actions::Overflow to every watch after IN_Q_OVERFLOW
+		void handleOverflow();
+
+		/// Counts an event towards the storm detection of its watch. Returns
+		/// true when the watch is in a storm and the event was collapsed.
+		bool collapseStorm(WatchRoot* root, const String& dir, const String& filename, Action action);
+
+		/// Reports the dirty directories and ends the storms that calmed down
+		void updateStorms();
+
+		/// Leaves storm mode and reports the net changes of the dirty files
+		void endStorm(WatchRoot* root);
+
+		/// Makes sure a read is queued on the application's ring
+		void submitRingRead();
+
+		/// Creates the kernel watch and node for a subdirectory. Directories
+		/// that find no room for a kernel watch are polled. Returns 0 and sets
+		/// errno on failure.
+		WatchStruct* createWatch(const String& path, WatchStruct* parent, const String& name, unsigned long long activity);
+
+		/// inotify_add_watch within the watch limit. Evicts directories that
+		/// were last active before activity to make room. Returns -1 and sets
+		/// errno on failure.
+		int addKernelWatch(const String& path, unsigned int mask, unsigned long long activity);
+
+		/// Evicts the least recently active kernel watch if it was last active
+		/// before activity
+		bool evictColdest(unsigned long long activity);
+
+		/// Replaces the kernel watch of a directory by polling
+		void evictWatch(WatchStruct* watch);
+
+		/// Starts polling a directory that has no kernel watch
+		void startPolling(WatchStruct* watch);
+
+		/// Moves a polled directory back to a kernel watch
+		bool promoteWatch(WatchStruct* watch);
+
+		/// Polls the directories that are due
+		void pollDirectories();
+
+		/// Reports the changes of a polled directory since its last poll
+		void pollDirectory(PollState* state);
+
+		/// Marks a directory as active for the eviction order
+		void touch(WatchStruct* watch);
+
+		/// Links a kernel watched directory into the eviction order
+		void lruInsert(WatchStruct* watch);
+
+		/// Unlinks a directory from the eviction order
+		void lruRemove(WatchStruct* watch);
+
+		/// Watches every directory below watch
+		void addChildren(WatchStruct* watch, const String& path, bool emitEvents);
+
+		/// Removes watch and all directories below it
+		void destroyTree(WatchStruct* watch, bool removeKernelWatch);
+
+		/// Covers the tree of a watch added earlier from the recursive watch
+		/// whose crawl reached its root directory below anchor
+		void nestRoot(WatchRoot* root, WatchStruct* anchor);
+
+		/// Drops the cover of root once the watch around it is gone
+		void uncoverRoot(WatchRoot* root);
+
+		/// Tracks directory creation, deletion and renames in recursive watches
+		void handleDirectoryAction(WatchStruct* watch, const String& name, unsigned long action, unsigned int cookie);
+
+		/// Drops moves whose destination never showed up
+		void expirePendingMoves();
+
+		/// Whether an entry of watch is in the manifest of its watch, or on
+		/// the way to a listed file for a directory. True without a manifest.
+		bool isListed(WatchStruct* watch, const String& name, bool directory);
+
+		/// Watches the directories leading to file that the manifest of root
+		/// covers and drops the ones it no longer does
+		void syncManifest(WatchRoot* root, const String& file);
+
+		/// Map of inotify watch descriptors to WatchStruct pointers
 		WatchMap mWatches;
+		/// Map of WatchID to WatchRoot pointers
+		RootMap mRoots;
+		/// Evicted watch descriptors whose IN_IGNORED has not arrived yet
+		WatchMap mRetired;
+		/// Slab storage for the WatchStructs
+		ObjectPool<WatchStruct> mWatchPool;
+		/// Slab storage for the WatchRoots
+		ObjectPool<WatchRoot, 64> mRootPool;
+		/// Interned directory names
+		StringPool mDirNames;
+		/// Orders dispatch across watches with scheduling options
+		EventScheduler mScheduler;
+		/// Directories moved out of a parent during the last reads
+		std::vector<PendingMove> mPendingMoves;
+		/// Events of the current read waiting for their metadata
+		std::vector<HeldEvent> mHeldEvents;
+		/// Kernel watched directories, most recently active first
+		WatchStruct* mLruHead;
+		WatchStruct* mLruTail;
+		/// Most kernel watches to hold
+		size_t mWatchLimit;
+		/// Milliseconds between two polls of a directory without kernel watch
+		unsigned int mPollInterval;
+		/// Polled directories in the order they are due
+		std::deque<PollState*> mPollQueue;
+		/// Number of polled directories
+		size_t mPolled;
+		/// Watches in a storm
+		size_t mStorms;
+		/// Watches whose root directory lies inside another watch's tree
+		size_t mNested;
+		/// Clock of the current update in milliseconds
+		unsigned long long mNow;
+		/// Last path built by getPath
+		String mPathCache;
+		/// Directory mPathCache belongs to
+		const WatchStruct* mPathCacheWatch;
 		/// The last watchid
 		WatchID mLastWatchID;
 		/// inotify file descriptor
 		int mFD;
+		/// eventfd that ends a wait early
+		int mWakeFD;
 		/// time out data
 		struct timeval mTimeOut;
 		/// File descriptor set
 		fd_set mDescriptorSet;
+		/// Buffer the kernel events are read into
+		char* mBuffer;
+		/// io_uring reader, 0 when reading with select
+		IoUringReader* mRingReader;
+		/// Application owned ring the reads are queued on, or 0
+		EventRing* mEventRing;
+		/// Tag for completions on mEventRing
+		unsigned long long mEventRingTag;
+		/// Whether a read is queued on mEventRing
+		bool mEventRingPending;
 
 	};//end FileWatcherLinux
 
@@ -0,0 +1,139 @@
+/**
+	Finds the files and directories with the most events in bounded memory,
+	using a count-min sketch and a top-K list of candidates.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_HEAVYHITTERS_H_
+#define _FW_HEAVYHITTERS_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace FW
+{
+	/// Counts the events passing through it per (watch, file) and per
+	/// (watch, directory) and forwards them to the next listener. Every
+	/// key is counted in a count-min sketch; the keys whose estimate beats
+	/// the smallest candidate enter a top-K list, so paths are only copied
+	/// when they become busy. Reports may come from any thread.
+	/// @class HeavyHitters
+	class HeavyHitters : public FileWatchListener
+	{
+	public:
+		HeavyHitters();
+		~HeavyHitters();
+
+		/// Starts counting from scratch with the given bounds.
+		void enable(const HeavyHitterOptions& options);
+
+		/// Whether enable was called
+		bool isEnabled() const { return mEnabled; }
+
+		/// Counts the events of watchid and forwards them to listener.
+		void setListener(WatchID watchid, FileWatchListener* listener, const String& directory);
+
+		/// Stops forwarding for watchid. Its counts stay in the report.
+		void removeListener(WatchID watchid);
+
+		/// Same as removeListener for the watch added for directory.
+		void removeDirectory(const String& directory);
+
+		/// Counts an event and forwards it.
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		/// Counts an event and forwards it with its FileInfo.
+		void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Counts every change and forwards the changeset.
+		void handleChangeset(WatchID watchid, const Changeset& changes);
+
+		/// The candidates, busiest first
+		HeavyHitterReport getReport() const;
+
+	private:
+		struct Candidate
+		{
+			unsigned long long mKey;
+			WatchID mWatchID;
+			String mDir;
+			String mFilename;
+			unsigned long long mCount;
+			unsigned long long mError;
+			/// Add, Delete, Modified and the rest
+			unsigned long long mActions[4];
+			size_t mHeapIndex;
+		};
+
+		/// The K candidates with the highest counts, as a min-heap
+		struct TopK
+		{
+			std::vector<Candidate*> mHeap;
+			std::unordered_map<unsigned long long, Candidate*> mByKey;
+		};
+
+		struct Watch
+		{
+			FileWatchListener* mListener;
+			String mDirectory;
+		};
+
+		HeavyHitters(const HeavyHitters&);
+		HeavyHitters& operator=(const HeavyHitters&);
+
+		/// Counts an event under mMutex and returns the listener to forward to
+		FileWatchListener* count(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		/// Adds one to key in the sketch and returns the new estimate
+		unsigned long long increment(unsigned long long key);
+
+		/// Counts key towards the top-K list
+		void offer(TopK& top, unsigned long long key, WatchID watchid, const String& dir, const String& filename, Action action);
+
+		void siftDown(TopK& top, size_t index);
+
+		void siftUp(TopK& top, size_t index);
+
+		static void clear(TopK& top);
+
+		static void report(const TopK& top, std::vector<HeavyHitter>& hitters);
+
+		std::unordered_map<WatchID, Watch> mWatches;
+		std::atomic<bool> mEnabled;
+		size_t mTopK;
+		/// mask of the counters of one row
+		size_t mWidthMask;
+		/// SKETCH_DEPTH rows of counters
+		std::vector<unsigned int> mSketch;
+		TopK mFiles;
+		TopK mDirectories;
+		unsigned long long mEvents;
+		mutable std::mutex mMutex;
+	};
+
+};//namespace FW
+
+#endif//_FW_HEAVYHITTERS_H_
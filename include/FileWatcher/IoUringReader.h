@@ -0,0 +1,102 @@
+/**
+	Minimal io_uring wrapper used by the Linux backend to read the inotify
+	descriptor. Talks to the kernel through the raw system calls, so no
+	liburing is needed.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_IOURINGREADER_H_
+#define _FW_IOURINGREADER_H_
+#pragma once
+
+#include "FileWatcherImpl.h"
+
+#if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
+
+#include <stddef.h>
+
+namespace FW
+{
+	/// Keeps one read of a descriptor in flight on a private io_uring.
+	/// The buffer is registered with the ring when the memlock limit allows
+	/// it. Completions are reaped straight from the shared completion queue,
+	/// so checking for events costs no system call.
+	/// @class IoUringReader
+	class IoUringReader
+	{
+	public:
+		IoUringReader();
+		~IoUringReader();
+
+		/// Sets up the ring for reads of fd into buffer. Returns false and
+		/// sets errno when the kernel does not provide io_uring.
+		bool init(int fd, char* buffer, unsigned int size);
+
+		/// Queues a read unless one is already in flight. Returns false and
+		/// sets errno if the read could not be submitted.
+		bool submit();
+
+		/// Returns true and the read result (bytes or -errno) once the read
+		/// in flight has completed.
+		bool poll(int& result);
+
+		/// Cancels the read in flight and waits for it to end. Returns true
+		/// and the read result when there was one; a read that completed
+		/// before the cancel took effect returns the bytes it read.
+		bool cancel(int& result);
+
+		/// Returns true when the buffer is registered with the ring
+		bool isFixed() const { return mFixed; }
+
+	private:
+		IoUringReader(const IoUringReader&);
+		IoUringReader& operator=(const IoUringReader&);
+
+		void release();
+
+		int mRingFD;
+		int mFD;
+		char* mBuffer;
+		unsigned int mSize;
+		bool mFixed;
+		bool mInFlight;
+
+		void* mSQRing;
+		size_t mSQRingSize;
+		void* mCQRing;
+		size_t mCQRingSize;
+		void* mSQEs;
+		size_t mSQEsSize;
+
+		unsigned int* mSQTail;
+		unsigned int* mSQMask;
+		unsigned int* mSQArray;
+		unsigned int* mCQHead;
+		unsigned int* mCQTail;
+		unsigned int* mCQMask;
+		void* mCQEs;
+	};
+
+};//namespace FW
+
+#endif//FILEWATCHER_PLATFORM_LINUX
+
+#endif//_FW_IOURINGREADER_H_
@@ -0,0 +1,121 @@
+/**
+	Routes events to listeners subscribed to directories, walking a trie
+	of path components once per event.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_PATHROUTER_H_
+#define _FW_PATHROUTER_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace FW
+{
+	/// Fans the events of one watch out to many listeners, each subscribed
+	/// to a directory and, if recursive, everything below it. Subscriptions
+	/// sit on the trie node of their directory, so an event costs a walk
+	/// down its path plus a call per matching listener, however many other
+	/// listeners there are. Listeners may subscribe and unsubscribe from
+	/// any thread, including from within a listener; new subscriptions
+	/// start with the next event.
+	/// @class PathRouter
+	class PathRouter : public FileWatchListener
+	{
+	public:
+		PathRouter();
+		~PathRouter();
+
+		/// Routes the events in directory, and below it if recursive, to
+		/// listener. Returns the id its events carry instead of the one of
+		/// the watch.
+		WatchID subscribe(const String& directory, FileWatchListener* listener, bool recursive);
+
+		/// Stops routing to a subscription. No more calls are made for it
+		/// once this returns, unless it is called from another listener
+		/// running at the same time.
+		void unsubscribe(WatchID id);
+
+		/// Number of subscriptions
+		size_t size() const;
+
+		/// Routes an event to the subscriptions of dir.
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		/// Routes an event and its FileInfo to the subscriptions of dir.
+		void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		/// Hands every subscription the part of the changeset it matches.
+		void handleChangeset(WatchID watchid, const Changeset& changes);
+
+	private:
+		struct Entry
+		{
+			WatchID mID;
+			/// 0 once unsubscribed during a route
+			FileWatchListener* mListener;
+			bool mRecursive;
+		};
+
+		struct Node
+		{
+			Node* mParent;
+			String mName;
+			std::unordered_map<String, Node*> mChildren;
+			std::vector<Entry> mEntries;
+		};
+
+		PathRouter(const PathRouter&);
+		PathRouter& operator=(const PathRouter&);
+
+		/// The child of node for the next component of path after start,
+		/// 0 if there is none. Advances start past the component; key is
+		/// scratch space.
+		static Node* next(const Node* node, const String& path, size_t& start, String& key);
+
+		/// Whether the components of path after start are used up
+		static bool atEnd(const String& path, size_t start);
+
+		/// Appends the subscriptions matching dir, up to last, to matches
+		void collect(const String& dir, WatchID last, std::vector<Entry>& matches) const;
+
+		/// Drops unsubscribed entries and nodes left empty
+		void compact(Node* node);
+
+		static void destroy(Node* node);
+
+		Node mRoot;
+		std::unordered_map<WatchID, Node*> mByID;
+		WatchID mLastID;
+		/// Routes running on the thread that holds the mutex
+		int mDepth;
+		/// Nodes with entries unsubscribed during a route
+		std::vector<Node*> mDirty;
+		mutable std::recursive_mutex mMutex;
+	};
+
+};//namespace FW
+
+#endif//_FW_PATHROUTER_H_
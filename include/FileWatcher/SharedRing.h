@@ -0,0 +1,164 @@
+/**
+	Shared memory event ring. One process publishes events into a memfd,
+	any number of local processes read them in place.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_SHAREDRING_H_
+#define _FW_SHAREDRING_H_
+#pragma once
+
+#include "FileWatcherImpl.h"
+
+#if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
+
+#include <stdint.h>
+
+namespace FW
+{
+	struct SharedRingHeader;
+
+	/// An event read from a SharedRing. The names point into the shared
+	/// mapping and are NUL terminated; they stay valid until the writer
+	/// laps the reader, which SharedRingReader::intact tells.
+	struct SharedEvent
+	{
+		WatchID watchid;
+		Action action;
+		const char* dir;
+		size_t dirLength;
+		const char* filename;
+		size_t filenameLength;
+		/// Position of the event in the stream, starting at 0
+		uint64_t sequence;
+	};
+
+	/// Single writer side of the ring. Records are written back to back
+	/// and old ones are overwritten once the ring is full; the writer never
+	/// waits for readers. Use it as the listener of the watches to publish.
+	/// @class SharedRingWriter
+	class SharedRingWriter : public FileWatchListener
+	{
+	public:
+		SharedRingWriter();
+		~SharedRingWriter();
+
+		/// Creates the ring in a sealed memfd. capacity is rounded up to a
+		/// power of two of at least 64KB. Returns false and sets errno on
+		/// failure.
+		bool create(size_t capacity);
+
+		/// Descriptor of the memfd, for readers in other processes
+		int getFD() const { return mFD; }
+
+		/// Passes the memfd over a Unix socket. Returns false and sets errno.
+		bool send(int socket) const;
+
+		/// Publishes an event and wakes the readers that wait.
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		/// Number of events published
+		uint64_t published() const;
+
+	private:
+		SharedRingWriter(const SharedRingWriter&);
+		SharedRingWriter& operator=(const SharedRingWriter&);
+
+		void release();
+
+		int mFD;
+		SharedRingHeader* mHeader;
+		char* mData;
+		size_t mMapSize;
+		/// local copies, only this process writes them
+		uint64_t mHead;
+		uint64_t mTail;
+		uint64_t mSequence;
+	};
+
+	/// Reader side of the ring, with a cursor of its own.
+	/// @class SharedRingReader
+	class SharedRingReader
+	{
+	public:
+		enum Status
+		{
+			/// an event was read
+			Read,
+			/// nothing new
+			Empty,
+			/// the writer overwrote events before they were read. The cursor
+			/// moved to the newest event; lost() counts what was skipped
+			Lapped
+		};
+
+		SharedRingReader();
+		~SharedRingReader();
+
+		/// Maps a ring from its memfd. The descriptor is duplicated. Returns
+		/// false and sets errno if fd is not a ring.
+		bool attach(int fd);
+
+		/// Receives the memfd over a Unix socket and attaches to it.
+		bool receive(int socket);
+
+		/// Reads the next event without copying it.
+		Status next(SharedEvent& event);
+
+		/// Whether the last event returned by next is still untouched by the
+		/// writer. Check after using its names; if false, discard the event
+		/// and the next call to next reports Lapped.
+		bool intact() const;
+
+		/// Waits until there are events to read, for at most timeout
+		/// milliseconds, or forever when negative.
+		bool wait(int timeout);
+
+		/// Number of events skipped because the reader was lapped
+		uint64_t lost() const { return mLost; }
+
+	private:
+		SharedRingReader(const SharedRingReader&);
+		SharedRingReader& operator=(const SharedRingReader&);
+
+		/// Moves the cursor past everything published so far
+		void resync();
+
+		void release();
+
+		int mFD;
+		SharedRingHeader* mHeader;
+		const char* mData;
+		size_t mMapSize;
+		uint64_t mMask;
+		uint64_t mCursor;
+		/// start of the last record returned
+		uint64_t mRecord;
+		/// sequence expected next
+		uint64_t mSequence;
+		uint64_t mLost;
+	};
+
+};//namespace FW
+
+#endif//FILEWATCHER_PLATFORM_LINUX
+
+#endif//_FW_SHAREDRING_H_
@@ -0,0 +1,113 @@
+/**
+	Client side of the watch daemon. Subscriptions made here share the
+	daemon's watches with every other process on the machine.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_WATCHCLIENT_H_
+#define _FW_WATCHCLIENT_H_
+#pragma once
+
+#include "FileWatcherImpl.h"
+
+#if FILEWATCHER_PLATFORM != FILEWATCHER_PLATFORM_WIN32
+
+#include "WatchProtocol.h"
+#include <deque>
+
+namespace FW
+{
+	/// Connection to a filewatchd daemon. Watches are added and removed
+	/// like on a FileWatcher and events reach the same FileWatchListeners,
+	/// but the directories are watched, crawled and deduplicated by the
+	/// daemon. Not thread safe, use it from one thread.
+	/// @class WatchClient
+	class WatchClient
+	{
+	public:
+		WatchClient();
+		~WatchClient();
+
+		/// Connects to the daemon. Returns false and sets errno on failure.
+		bool connect(const String& socketPath = WatchProtocol::defaultSocketPath());
+
+		/// Subscribes to a directory. Blocks until the daemon answers.
+		/// @exception FileNotFoundException Thrown when the requested directory does not exist
+		/// @exception Exception Thrown when the daemon is not reachable or fails
+		WatchID addWatch(const String& directory, FileWatchListener* watcher, bool recursive = false);
+
+		/// Ends a subscription.
+		void removeWatch(WatchID watchid);
+
+		/// Reads the events the daemon sent and dispatches them. Must be
+		/// called often. Returns false once the connection is lost.
+		bool update();
+
+		/// Descriptor to wait on for events
+		int getFD() const { return mFD; }
+
+	private:
+		struct Watch
+		{
+			WatchID mSubscription;
+			FileWatchListener* mListener;
+		};
+
+		struct PendingEvent
+		{
+			WatchID mSubscription;
+			String mDir;
+			String mFilename;
+			Action mAction;
+		};
+
+		WatchClient(const WatchClient&);
+		WatchClient& operator=(const WatchClient&);
+
+		/// Writes a whole frame, blocking
+		void send(const String& frame);
+
+		/// Reads what is available, blocking for at least one byte if asked.
+		/// Returns false when the connection is gone.
+		bool receive(bool block);
+
+		/// Decodes the buffered frames. Stops after the answer to request,
+		/// if given, and fills result with it.
+		bool decode(uint32_t request, WatchID* result, int* error, String* message);
+
+		void disconnect();
+
+		int mFD;
+		/// bytes received and not decoded yet
+		String mInput;
+		/// events received while waiting for an answer
+		std::deque<PendingEvent> mPending;
+		/// local watches, several may share one daemon subscription
+		std::map<WatchID, Watch> mWatches;
+		WatchID mLastWatchID;
+		uint32_t mLastRequest;
+	};
+
+};//namespace FW
+
+#endif//FILEWATCHER_PLATFORM != FILEWATCHER_PLATFORM_WIN32
+
+#endif//_FW_WATCHCLIENT_H_
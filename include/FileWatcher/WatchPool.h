@@ -0,0 +1,348 @@
+/**
+	Storage helpers for the FileWatcher backends. Watch records are
+	allocated from slabs, directory strings are interned, and the
+	WatchID lookup table is a flat open addressing array, so that a
+	watcher holding a very large number of watches keeps its records
+	dense in memory.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_WATCHPOOL_H_
+#define _FW_WATCHPOOL_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <new>
+#include <utility>
+#include <vector>
+#include <unordered_map>
+
+namespace FW
+{
+	/// Fixed size object allocator. Objects are carved out of slabs of
+	/// SlabSize elements and recycled through an intrusive free list, so
+	/// records allocated together sit next to each other in memory.
+	/// Live objects must be destroyed before the pool goes away.
+	/// @class ObjectPool
+	template <typename T, size_t SlabSize = 1024>
+	class ObjectPool
+	{
+	public:
+		ObjectPool()
+			: mFreeList(0), mLive(0)
+		{}
+
+		~ObjectPool()
+		{
+			for(size_t i = 0; i < mSlabs.size(); ++i)
+				delete[] mSlabs[i];
+		}
+
+		/// Constructs a new object in the pool.
+		template <typename... Args>
+		T* create(Args&&... args)
+		{
+			if(!mFreeList)
+				grow();
+
+			Slot* slot = mFreeList;
+			mFreeList = slot->mNext;
+			++mLive;
+			return new (&slot->mStorage) T(std::forward<Args>(args)...);
+		}
+
+		/// Destroys an object previously returned by create.
+		void destroy(T* object)
+		{
+			if(!object)
+				return;
+
+			object->~T();
+			Slot* slot = reinterpret_cast<Slot*>(object);
+			slot->mNext = mFreeList;
+			mFreeList = slot;
+			--mLive;
+		}
+
+		/// Number of live objects
+		size_t size() const { return mLive; }
+
+		/// Bytes reserved by the slabs
+		size_t memoryUsage() const
+		{
+			return mSlabs.size() * SlabSize * sizeof(Slot) + mSlabs.capacity() * sizeof(Slot*);
+		}
+
+	private:
+		union Slot
+		{
+			Slot* mNext;
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type mStorage;
+		};
+
+		void grow()
+		{
+			Slot* slab = new Slot[SlabSize];
+			mSlabs.push_back(slab);
+
+			// thread the free list front to back so consecutive allocations
+			// are consecutive in memory
+			for(size_t i = SlabSize; i > 0; --i)
+			{
+				slab[i - 1].mNext = mFreeList;
+				mFreeList = &slab[i - 1];
+			}
+		}
+
+		ObjectPool(const ObjectPool&);
+		ObjectPool& operator=(const ObjectPool&);
+
+		std::vector<Slot*> mSlabs;
+		Slot* mFreeList;
+		size_t mLive;
+	};
+
+	/// Reference counted string interning. Identical strings share one
+	/// copy, and the returned pointers stay valid until the last reference
+	/// is released.
+	/// @class StringPool
+	class StringPool
+	{
+	public:
+		/// Returns the shared copy of str, adding a reference to it.
+		const String* intern(const String& str)
+		{
+			Map::iterator iter = mStrings.find(str);
+			if(iter == mStrings.end())
+				iter = mStrings.insert(std::make_pair(str, size_t(0))).first;
+
+			++iter->second;
+			return &iter->first;
+		}
+
+		/// Returns the shared copy of str without adding a reference, or 0
+		/// when str is not interned.
+		const String* find(const String& str) const
+		{
+			Map::const_iterator iter = mStrings.find(str);
+			return iter == mStrings.end() ? 0 : &iter->first;
+		}
+
+		/// Drops a reference obtained from intern.
+		void release(const String* str)
+		{
+			if(!str)
+				return;
+
+			Map::iterator iter = mStrings.find(*str);
+			if(iter != mStrings.end() && --iter->second == 0)
+				mStrings.erase(iter);
+		}
+
+		/// Number of distinct strings
+		size_t size() const { return mStrings.size(); }
+
+		/// Approximate bytes held by the pool, including string heap buffers
+		size_t memoryUsage() const
+		{
+			// node: next pointer, cached hash and the value
+			const size_t nodeSize = sizeof(void*) + sizeof(size_t) + sizeof(Map::value_type);
+			size_t bytes = mStrings.bucket_count() * sizeof(void*) + mStrings.size() * nodeSize;
+
+			Map::const_iterator iter = mStrings.begin();
+			Map::const_iterator end = mStrings.end();
+			for(; iter != end; ++iter)
+			{
+				// libstdc++ keeps up to 15 characters inline
+				if(iter->first.capacity() > 15)
+					bytes += iter->first.capacity() + 1;
+			}
+			return bytes;
+		}
+
+	private:
+		typedef std::unordered_map<String, size_t> Map;
+		Map mStrings;
+	};
+
+	/// Flat open addressing table from WatchID to record pointer. Uses
+	/// linear probing with backward shift deletion, so lookups touch one or
+	/// two cache lines and no per entry nodes are allocated.
+	/// @class WatchTable
+	template <typename T>
+	class WatchTable
+	{
+	private:
+		struct Slot
+		{
+			WatchID mKey;
+			T* mValue;
+		};
+
+	public:
+		/// Iterates the live records. Invalidated by insert and erase.
+		class const_iterator
+		{
+		public:
+			const_iterator(const Slot* slot, const Slot* end)
+				: mSlot(slot), mEnd(end)
+			{
+				skip();
+			}
+
+			WatchID key() const { return mSlot->mKey; }
+			T* operator*() const { return mSlot->mValue; }
+			const_iterator& operator++() { ++mSlot; skip(); return *this; }
+			bool operator!=(const const_iterator& other) const { return mSlot != other.mSlot; }
+			bool operator==(const const_iterator& other) const { return mSlot == other.mSlot; }
+
+		private:
+			void skip()
+			{
+				while(mSlot != mEnd && !mSlot->mValue)
+					++mSlot;
+			}
+
+			const Slot* mSlot;
+			const Slot* mEnd;
+		};
+
+		WatchTable()
+			: mSize(0)
+		{}
+
+		/// Returns the record for key or 0.
+		T* find(WatchID key) const
+		{
+			if(mSlots.empty())
+				return 0;
+
+			size_t mask = mSlots.size() - 1;
+			for(size_t i = hash(key) & mask; mSlots[i].mValue; i = (i + 1) & mask)
+			{
+				if(mSlots[i].mKey == key)
+					return mSlots[i].mValue;
+			}
+			return 0;
+		}
+
+		/// Inserts or replaces the record for key.
+		void insert(WatchID key, T* value)
+		{
+			if((mSize + 1) * 4 > mSlots.size() * 3)
+				rehash(mSlots.empty() ? 16 : mSlots.size() * 2);
+
+			size_t mask = mSlots.size() - 1;
+			size_t i = hash(key) & mask;
+			for(; mSlots[i].mValue; i = (i + 1) & mask)
+			{
+				if(mSlots[i].mKey == key)
+				{
+					mSlots[i].mValue = value;
+					return;
+				}
+			}
+
+			mSlots[i].mKey = key;
+			mSlots[i].mValue = value;
+			++mSize;
+		}
+
+		/// Removes the record for key. Returns the removed record or 0.
+		T* erase(WatchID key)
+		{
+			if(mSlots.empty())
+				return 0;
+
+			size_t mask = mSlots.size() - 1;
+			size_t i = hash(key) & mask;
+			for(; mSlots[i].mValue; i = (i + 1) & mask)
+			{
+				if(mSlots[i].mKey == key)
+					break;
+			}
+
+			T* removed = mSlots[i].mValue;
+			if(!removed)
+				return 0;
+
+			// shift following entries of the probe run back into the hole
+			size_t hole = i;
+			for(size_t j = (i + 1) & mask; mSlots[j].mValue; j = (j + 1) & mask)
+			{
+				size_t home = hash(mSlots[j].mKey) & mask;
+				if(((j - home) & mask) >= ((j - hole) & mask))
+				{
+					mSlots[hole] = mSlots[j];
+					hole = j;
+				}
+			}
+			mSlots[hole].mValue = 0;
+			--mSize;
+			return removed;
+		}
+
+		void clear()
+		{
+			mSlots.clear();
+			mSize = 0;
+		}
+
+		size_t size() const { return mSize; }
+		bool empty() const { return mSize == 0; }
+
+		const_iterator begin() const { return const_iterator(data(), data() + mSlots.size()); }
+		const_iterator end() const { return const_iterator(data() + mSlots.size(), data() + mSlots.size()); }
+
+		/// Bytes reserved by the table
+		size_t memoryUsage() const { return mSlots.capacity() * sizeof(Slot); }
+
+	private:
+		static size_t hash(WatchID key)
+		{
+			// fibonacci hashing spreads the sequential ids handed out by the kernel
+			return (size_t)((unsigned long long)key * 11400714819323198485ull >> 20);
+		}
+
+		const Slot* data() const { return mSlots.empty() ? 0 : &mSlots[0]; }
+
+		void rehash(size_t count)
+		{
+			std::vector<Slot> old;
+			old.swap(mSlots);
+			mSlots.assign(count, Slot());
+			mSize = 0;
+
+			for(size_t i = 0; i < old.size(); ++i)
+			{
+				if(old[i].mValue)
+					insert(old[i].mKey, old[i].mValue);
+			}
+		}
+
+		std::vector<Slot> mSlots;
+		size_t mSize;
+	};
+
+};//namespace FW
+
+#endif//_FW_WATCHPOOL_H_
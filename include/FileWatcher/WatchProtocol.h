@@ -0,0 +1,192 @@
+/**
+	Wire format between the watch daemon and its clients.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_WATCHPROTOCOL_H_
+#define _FW_WATCHPROTOCOL_H_
+#pragma once
+
+#include "FileWatcher.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace FW
+{
+	/// Messages over the daemon's Unix socket. Every frame is a uint32 size
+	/// of what follows, a uint8 type and the payload, in native byte order
+	/// since both ends are on the same machine. Strings are not terminated;
+	/// the last string of a payload runs to its end.
+	namespace WatchProtocol
+	{
+		enum MessageType
+		{
+			/// client: uint32 request, uint8 flags, path
+			Subscribe = 1,
+			/// client: uint32 subscription
+			Unsubscribe = 2,
+			/// daemon: uint32 request, uint32 subscription, int32 errno or 0, message
+			Subscribed = 3,
+			/// daemon: uint32 subscription, uint8 action, uint32 dir size, dir, filename
+			Event = 4
+		};
+
+		/// Subscribe flags
+		enum { Recursive = 1 };
+
+		/// Frames above this size are a protocol error
+		enum { MaxFrame = 1 << 20 };
+
+		/// Where the daemon listens unless told otherwise. Without
+		/// XDG_RUNTIME_DIR the socket goes into a per-user directory that
+		/// the daemon creates with mode 0700.
+		inline String defaultSocketPath()
+		{
+			const char* runtime = getenv("XDG_RUNTIME_DIR");
+			if(runtime && *runtime)
+				return String(runtime) + "/filewatchd.sock";
+
+			char path[64];
+			snprintf(path, sizeof(path), "/tmp/filewatchd-%u/filewatchd.sock", (unsigned int)getuid());
+			return path;
+		}
+
+		/// Appends frames to a send buffer
+		class Writer
+		{
+		public:
+			Writer(String& buffer, MessageType type)
+				: mBuffer(buffer), mStart(buffer.size())
+			{
+				uint32_t size = 0;
+				mBuffer.append((const char*)&size, sizeof(size));
+				put8((uint8_t)type);
+			}
+
+			/// Fills in the frame size
+			~Writer()
+			{
+				uint32_t size = (uint32_t)(mBuffer.size() - mStart - sizeof(uint32_t));
+				memcpy(&mBuffer[mStart], &size, sizeof(size));
+			}
+
+			void put8(uint8_t value) { mBuffer.push_back((char)value); }
+			void put32(uint32_t value) { mBuffer.append((const char*)&value, sizeof(value)); }
+			void put(const String& value) { mBuffer.append(value); }
+
+		private:
+			Writer(const Writer&);
+			Writer& operator=(const Writer&);
+
+			String& mBuffer;
+			size_t mStart;
+		};
+
+		/// Reads the payload of one frame
+		class Reader
+		{
+		public:
+			Reader(const char* data, size_t size)
+				: mData(data), mSize(size), mPos(0), mValid(true)
+			{}
+
+			uint8_t get8()
+			{
+				uint8_t value = 0;
+				take(&value, sizeof(value));
+				return value;
+			}
+
+			uint32_t get32()
+			{
+				uint32_t value = 0;
+				take(&value, sizeof(value));
+				return value;
+			}
+
+			String get(size_t size)
+			{
+				if(size > mSize - mPos)
+				{
+					mValid = false;
+					return String();
+				}
+				String value(mData + mPos, size);
+				mPos += size;
+				return value;
+			}
+
+			/// The rest of the payload
+			String rest() { return get(mSize - mPos); }
+
+			/// False once a read went past the end
+			bool valid() const { return mValid; }
+
+		private:
+			void take(void* value, size_t size)
+			{
+				if(size > mSize - mPos)
+				{
+					mValid = false;
+					return;
+				}
+				memcpy(value, mData + mPos, size);
+				mPos += size;
+			}
+
+			const char* mData;
+			size_t mSize;
+			size_t mPos;
+			bool mValid;
+		};
+
+		/// Finds the next complete frame at pos in buffer. Returns false when
+		/// more bytes are needed, sets type to 0 on an oversized frame.
+		inline bool nextFrame(const String& buffer, size_t& pos, uint8_t& type, Reader& payload)
+		{
+			if(buffer.size() - pos < sizeof(uint32_t) + 1)
+				return false;
+
+			uint32_t size;
+			memcpy(&size, buffer.data() + pos, sizeof(size));
+			if(size == 0 || size > MaxFrame)
+			{
+				type = 0;
+				return true;
+			}
+			if(buffer.size() - pos - sizeof(uint32_t) < size)
+				return false;
+
+			const char* frame = buffer.data() + pos + sizeof(uint32_t);
+			type = (uint8_t)frame[0];
+			payload = Reader(frame + 1, size - 1);
+			pos += sizeof(uint32_t) + size;
+			return true;
+		}
+	};
+
+};//namespace FW
+
+#endif//_FW_WATCHPROTOCOL_H_
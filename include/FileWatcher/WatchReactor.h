@@ -0,0 +1,181 @@
+/**
+	A process wide reactor that hosts the watches of many front-ends on one
+	inotify instance and one watcher thread, for applications where every
+	plugin wants its own watcher.
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+#ifndef _FW_WATCHREACTOR_H_
+#define _FW_WATCHREACTOR_H_
+#pragma once
+
+#include "FileWatcher.h"
+#include "PathRouter.h"
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace FW
+{
+	class SharedFileWatcher;
+
+	/// Owns one AsyncFileWatcher and fans its events out to the watches of
+	/// SharedFileWatcher front-ends. Front-ends watching the same directory
+	/// share one kernel watch, created with the options of the first one;
+	/// a later recursive watch adds the shared one again with its own
+	/// options. Each front-end only sees events under the directories it
+	/// watches.
+	/// @class WatchReactor
+	class WatchReactor : private FileWatchListener
+	{
+		friend class SharedFileWatcher;
+	public:
+		/// @param queue With a capacity, listeners run on a dispatch thread
+		/// next to the watcher thread
+		/// @param reader How the watcher thread waits for events
+		WatchReactor(const QueueOptions& queue = QueueOptions(), const ReaderOptions& reader = ReaderOptions());
+
+		/// Every SharedFileWatcher using the reactor must be gone.
+		~WatchReactor();
+
+		/// The reactor of the process, created on first use.
+		static WatchReactor& shared();
+
+		/// Number of kernel side watches, shared ones counted once
+		size_t getWatchCount() const;
+
+		/// Number of front-end watches
+		size_t getSubscriptionCount() const;
+
+	private:
+		struct Watch;
+
+		struct Subscription
+		{
+			WatchID mID;
+			const SharedFileWatcher* mOwner;
+			/// 0 once removed
+			FileWatchListener* mListener;
+			String mDirectory;
+			bool mRecursive;
+			std::shared_ptr<Watch> mWatch;
+		};
+
+		typedef std::shared_ptr<Subscription> SubscriptionPtr;
+
+		struct Watch
+		{
+			/// 0 until the first add has run
+			WatchID mCoreID;
+			/// Adds queued and not yet run
+			int mPending;
+			bool mRecursive;
+			/// Directories that map to this watch
+			std::vector<String> mKeys;
+			std::vector<SubscriptionPtr> mSubscriptions;
+			/// Ready once the pending add has run
+			std::shared_future<void> mReady;
+		};
+
+		typedef std::shared_ptr<Watch> WatchPtr;
+
+		WatchID subscribe(const SharedFileWatcher* owner, const String& directory, FileWatchListener* listener, const WatchOptions& options);
+
+		void unsubscribe(const SharedFileWatcher* owner, WatchID watchid);
+
+		void unsubscribe(const SharedFileWatcher* owner, const String& directory);
+
+		/// Removes every watch of owner
+		void unsubscribeAll(const SharedFileWatcher* owner);
+
+		/// Queues the add, or the re-add with recursion, of watch
+		void submitAdd(const WatchPtr& watch, const String& directory, const WatchOptions& options);
+
+		/// Runs on the watcher thread once the add of watch has run
+		void completeAdd(const WatchPtr& watch, const WatchResult& result, const std::shared_ptr<std::promise<void> >& ready);
+
+		/// Detaches a subscription, dropping its watch with the last one
+		void release(const SubscriptionPtr& subscription);
+
+		/// Removes a watch without live subscriptions and no add in flight
+		void drop(const WatchPtr& watch);
+
+		void handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action);
+
+		void handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info);
+
+		void handleChangeset(WatchID watchid, const Changeset& changes);
+
+		mutable std::recursive_mutex mMutex;
+		std::unordered_map<WatchID, SubscriptionPtr> mSubscriptions;
+		std::map<String, WatchPtr> mByDirectory;
+		std::unordered_map<WatchID, WatchPtr> mByCoreID;
+		/// Fan-outs running on the thread that holds the mutex
+		int mDepth;
+		/// Routes events to the subscriptions under their directory
+		PathRouter mRouter;
+		/// Declared last so its threads stop before the tables go away
+		AsyncFileWatcher mWatcher;
+	};
+
+	/// A watcher front-end hosted by a WatchReactor. Watches are added and
+	/// removed synchronously and the listeners are called from the reactor
+	/// thread; once removeWatch returns no more calls are made for the
+	/// watch. Adds from within a listener return before the watch is live.
+	/// @class SharedFileWatcher
+	class SharedFileWatcher
+	{
+	public:
+		SharedFileWatcher(WatchReactor& reactor = WatchReactor::shared());
+
+		/// Removes the watches of this front-end.
+		~SharedFileWatcher();
+
+		/// Add a directory watch
+		/// @exception FileNotFoundException Thrown when the requested directory does not exist
+		WatchID addWatch(const String& directory, FileWatchListener* watcher, bool recursive = false);
+
+		/// Add a directory watch with options
+		/// @exception FileNotFoundException Thrown when the requested directory does not exist
+		WatchID addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options);
+
+		/// Remove the watches of this front-end on directory
+		void removeWatch(const String& directory);
+
+		/// Remove a directory watch of this front-end
+		void removeWatch(WatchID watchid);
+
+		WatchReactor& getReactor() const { return mReactor; }
+
+	private:
+		SharedFileWatcher(const SharedFileWatcher&);
+		SharedFileWatcher& operator=(const SharedFileWatcher&);
+
+		WatchReactor& mReactor;
+	};
+
+};//namespace FW
+
+#endif//_FW_WATCHREACTOR_H_
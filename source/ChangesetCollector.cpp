@@ -0,0 +1,273 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/ChangesetCollector.h>
+#include <FileWatcher/EventQueue.h>
+#include <FileWatcher/FileWatcherImpl.h>
+
+#include <algorithm>
+
+namespace FW
+{
+
+	//--------
+	ChangesetCollector::ChangesetCollector(const FileWatcherImpl* clock)
+		: mPending(0), mClock(clock)
+	{
+	}
+
+	//--------
+	ChangesetCollector::~ChangesetCollector()
+	{
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.begin();
+		for(; iter != mWatches.end(); ++iter)
+			delete iter->second;
+	}
+
+	//--------
+	void ChangesetCollector::setListener(WatchID watchid, FileWatchListener* listener, const String& directory, const WatchOptions& options)
+	{
+		Watch*& watch = mWatches[watchid];
+		if(!watch)
+		{
+			watch = new Watch();
+			watch->mOpen = false;
+		}
+
+		watch->mListener = listener;
+		watch->mDirectory = directory;
+		watch->mSettleTime = std::chrono::milliseconds(options.settleTime);
+		watch->mMaxLatency = std::chrono::milliseconds(options.maxLatency);
+	}
+
+	//--------
+	void ChangesetCollector::removeListener(WatchID watchid)
+	{
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return;
+
+		if(iter->second->mOpen)
+			--mPending;
+		delete iter->second;
+		mWatches.erase(iter);
+	}
+
+	//--------
+	void ChangesetCollector::removeDirectory(const String& directory)
+	{
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.begin();
+		for(; iter != mWatches.end(); ++iter)
+		{
+			if(iter->second->mDirectory == directory)
+			{
+				removeListener(iter->first);
+				return;
+			}
+		}
+	}
+
+	//--------
+	void ChangesetCollector::handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		handleFileEvent(watchid, dir, filename, action, FileInfo());
+	}
+
+	//--------
+	void ChangesetCollector::handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return;
+
+		Watch* watch = iter->second;
+		Clock::time_point now = currentTime();
+		if(!watch->mOpen)
+		{
+			watch->mOpen = true;
+			watch->mFirst = now;
+			++mPending;
+		}
+		watch->mLast = now;
+
+		// directory actions are reported once per directory and kind, and
+		// never merged
+		String key = dir;
+		if(isDirectoryAction(action))
+		{
+			key += '\0';
+			key += (char)action;
+		}
+		else
+		{
+			key += '/';
+		}
+		key += filename;
+
+		std::unordered_map<String, size_t>::iterator pending = watch->mByPath.find(key);
+		if(pending != watch->mByPath.end())
+		{
+			Change& change = watch->mChanges[pending->second];
+			if(action == Actions::Dirty)
+			{
+				change.info.events += info.events;
+				return;
+			}
+			change.info = info;
+			// the changeset stays open when this empties it, the burst is
+			// not over yet
+			if(!isDirectoryAction(action) && !mergeAction(change.action, action))
+			{
+				change.action = (Action)0;
+				watch->mByPath.erase(pending);
+			}
+			return;
+		}
+
+		Change change;
+		change.dir = dir;
+		change.filename = filename;
+		change.action = action;
+		change.info = info;
+		watch->mByPath[key] = watch->mChanges.size();
+		watch->mChanges.push_back(change);
+	}
+
+	//--------
+	void ChangesetCollector::handleChangeset(WatchID watchid, const Changeset& changes)
+	{
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return;
+
+		for(size_t i = 0; i < changes.size(); ++i)
+			handleFileEvent(watchid, changes[i].dir, changes[i].filename, changes[i].action, changes[i].info);
+
+		Watch* watch = iter->second;
+		Changeset merged;
+		take(watch, merged);
+		if(!merged.empty() && watch->mListener)
+			watch->mListener->handleChangeset(watchid, merged);
+	}
+
+	//--------
+	ChangesetCollector::Clock::time_point ChangesetCollector::due(const Watch* watch)
+	{
+		Clock::time_point settled = watch->mLast + watch->mSettleTime;
+		if(watch->mMaxLatency.count() == 0)
+			return settled;
+		return std::min(settled, watch->mFirst + watch->mMaxLatency);
+	}
+
+	//--------
+	ChangesetCollector::Clock::time_point ChangesetCollector::currentTime() const
+	{
+		return mClock ? mClock->now() : Clock::now();
+	}
+
+	//--------
+	void ChangesetCollector::flush()
+	{
+		if(!mPending)
+			return;
+
+		Clock::time_point now = currentTime();
+		std::vector<WatchID> ready;
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.begin();
+		for(; iter != mWatches.end(); ++iter)
+		{
+			if(iter->second->mOpen && due(iter->second) <= now)
+				ready.push_back(iter->first);
+		}
+
+		for(size_t i = 0; i < ready.size(); ++i)
+		{
+			// the listener may remove watches while we go
+			iter = mWatches.find(ready[i]);
+			if(iter == mWatches.end())
+				continue;
+
+			Watch* watch = iter->second;
+			Changeset changes;
+			take(watch, changes);
+
+			if(!changes.empty() && watch->mListener)
+				watch->mListener->handleChangeset(ready[i], changes);
+		}
+	}
+
+	//--------
+	FileWatchListener* ChangesetCollector::release(WatchID watchid, Changeset& changes)
+	{
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return 0;
+
+		Watch* watch = iter->second;
+		FileWatchListener* listener = watch->mListener;
+		take(watch, changes);
+		delete watch;
+		mWatches.erase(iter);
+		return listener;
+	}
+
+	//--------
+	void ChangesetCollector::take(Watch* watch, Changeset& changes)
+	{
+		changes.reserve(watch->mByPath.size());
+		for(size_t i = 0; i < watch->mChanges.size(); ++i)
+		{
+			if(watch->mChanges[i].action)
+				changes.push_back(watch->mChanges[i]);
+		}
+
+		watch->mChanges.clear();
+		watch->mByPath.clear();
+		if(watch->mOpen)
+		{
+			watch->mOpen = false;
+			--mPending;
+		}
+	}
+
+	//--------
+	int ChangesetCollector::timeUntilDue() const
+	{
+		if(!mPending)
+			return -1;
+
+		Clock::time_point now = currentTime();
+		Clock::time_point next = Clock::time_point::max();
+		std::unordered_map<WatchID, Watch*>::const_iterator iter = mWatches.begin();
+		for(; iter != mWatches.end(); ++iter)
+		{
+			if(iter->second->mOpen)
+				next = std::min(next, due(iter->second));
+		}
+
+		if(next <= now)
+			return 0;
+		// round up, waking early only means another wait
+		return (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+	}
+
+};//namespace FW
@@ -0,0 +1,260 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/DispatchPool.h>
+
+#include <functional>
+
+/// Shards per worker thread
+#define SHARDS_PER_WORKER 8
+/// Callbacks a worker runs from one shard before giving others a turn
+#define DRAIN_BATCH 32
+
+namespace FW
+{
+
+	//--------
+	DispatchPool::DispatchPool(unsigned int threads)
+		: mPending(0), mQueued(0), mStop(false)
+	{
+		if(threads == 0)
+			threads = 1;
+
+		mShards.resize(threads * SHARDS_PER_WORKER);
+		for(size_t i = 0; i < mShards.size(); ++i)
+		{
+			mShards[i] = new Shard();
+			mShards[i]->mScheduled = false;
+		}
+
+		mWorkers.resize(threads);
+		for(size_t i = 0; i < mWorkers.size(); ++i)
+			mWorkers[i] = new Worker();
+		for(size_t i = 0; i < mWorkers.size(); ++i)
+			mWorkers[i]->mThread = std::thread(&DispatchPool::run, this, i);
+	}
+
+	//--------
+	DispatchPool::~DispatchPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mIdleMutex);
+			mStop = true;
+		}
+		mWork.notify_all();
+
+		for(size_t i = 0; i < mWorkers.size(); ++i)
+		{
+			mWorkers[i]->mThread.join();
+			delete mWorkers[i];
+		}
+		for(size_t i = 0; i < mShards.size(); ++i)
+			delete mShards[i];
+	}
+
+	//--------
+	void DispatchPool::setListener(WatchID watchid, FileWatchListener* listener)
+	{
+		mListeners[watchid] = listener;
+	}
+
+	//--------
+	void DispatchPool::removeListener(WatchID watchid)
+	{
+		mListeners.erase(watchid);
+	}
+
+	//--------
+	void DispatchPool::handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		handleFileEvent(watchid, dir, filename, action, FileInfo());
+	}
+
+	//--------
+	void DispatchPool::handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		std::unordered_map<WatchID, FileWatchListener*>::iterator listener = mListeners.find(watchid);
+		if(listener == mListeners.end() || !listener->second)
+			return;
+
+		std::hash<String> hasher;
+		size_t hash = hasher(dir) * 31 + hasher(filename);
+		hash ^= (size_t)watchid * 0x9e3779b97f4a7c15ull;
+		size_t index = hash % mShards.size();
+
+		Task task;
+		task.mListener = listener->second;
+		task.mWatchID = watchid;
+		task.mDir = dir;
+		task.mFilename = filename;
+		task.mAction = action;
+		task.mInfo = info;
+
+		++mPending;
+
+		Shard* shard = mShards[index];
+		bool schedule = false;
+		{
+			std::lock_guard<std::mutex> lock(shard->mMutex);
+			shard->mTasks.push_back(task);
+			if(!shard->mScheduled)
+			{
+				shard->mScheduled = true;
+				schedule = true;
+			}
+		}
+
+		// a shard that is already queued or being drained picks the task up
+		if(schedule)
+			this->schedule(index, index % mWorkers.size());
+	}
+
+	//--------
+	void DispatchPool::handleChangeset(WatchID watchid, const Changeset& changes)
+	{
+		std::unordered_map<WatchID, FileWatchListener*>::iterator listener = mListeners.find(watchid);
+		if(listener == mListeners.end() || !listener->second)
+			return;
+
+		// changesets run on the calling thread, after the events queued before
+		flush();
+		listener->second->handleChangeset(watchid, changes);
+	}
+
+	//--------
+	void DispatchPool::flush()
+	{
+		std::unique_lock<std::mutex> lock(mIdleMutex);
+		while(mPending.load() != 0)
+			mIdle.wait(lock);
+	}
+
+	//--------
+	void DispatchPool::schedule(size_t shard, size_t worker)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mWorkers[worker]->mMutex);
+			mWorkers[worker]->mShards.push_back(shard);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mIdleMutex);
+			++mQueued;
+		}
+		mWork.notify_one();
+	}
+
+	//--------
+	bool DispatchPool::take(size_t index, size_t& shard)
+	{
+		Worker* own = mWorkers[index];
+		{
+			std::lock_guard<std::mutex> lock(own->mMutex);
+			if(!own->mShards.empty())
+			{
+				shard = own->mShards.front();
+				own->mShards.pop_front();
+				return true;
+			}
+		}
+
+		// steal from the back of the others
+		for(size_t i = 1; i < mWorkers.size(); ++i)
+		{
+			Worker* victim = mWorkers[(index + i) % mWorkers.size()];
+			std::lock_guard<std::mutex> lock(victim->mMutex);
+			if(!victim->mShards.empty())
+			{
+				shard = victim->mShards.back();
+				victim->mShards.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//--------
+	void DispatchPool::run(size_t index)
+	{
+		while(true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mIdleMutex);
+				while(!mStop && mQueued == 0)
+					mWork.wait(lock);
+				if(mQueued == 0)
+					return;
+
+				// claim one of the queued shards; take() is bound to find it
+				--mQueued;
+			}
+
+			size_t shard;
+			while(!take(index, shard))
+				std::this_thread::yield();
+
+			drain(index, shard);
+		}
+	}
+
+	//--------
+	void DispatchPool::drain(size_t index, size_t index_shard)
+	{
+		Shard* shard = mShards[index_shard];
+
+		for(int count = 0; ; ++count)
+		{
+			Task task;
+			{
+				std::lock_guard<std::mutex> lock(shard->mMutex);
+				if(shard->mTasks.empty())
+				{
+					shard->mScheduled = false;
+					return;
+				}
+
+				if(count == DRAIN_BATCH)
+					break;
+
+				Task& front = shard->mTasks.front();
+				task.mListener = front.mListener;
+				task.mWatchID = front.mWatchID;
+				task.mDir.swap(front.mDir);
+				task.mFilename.swap(front.mFilename);
+				task.mAction = front.mAction;
+				task.mInfo = front.mInfo;
+				shard->mTasks.pop_front();
+			}
+
+			task.mListener->handleFileEvent(task.mWatchID, task.mDir, task.mFilename, task.mAction, task.mInfo);
+
+			if(--mPending == 0)
+			{
+				std::lock_guard<std::mutex> lock(mIdleMutex);
+				mIdle.notify_all();
+			}
+		}
+
+		// still busy, go to the back of the line so other shards get a turn
+		schedule(index_shard, index);
+	}
+
+};//namespace FW
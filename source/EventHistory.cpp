@@ -0,0 +1,272 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/EventHistory.h>
+#include <FileWatcher/EventQueue.h>
+
+#include <algorithm>
+
+/// Events kept per path; older ones are dropped and truncate the history
+#define EVENTS_PER_PATH 16
+
+namespace FW
+{
+
+	//--------
+	static String historyKey(const String& dir, const String& filename)
+	{
+		String key;
+		key.reserve(dir.size() + filename.size() + 1);
+		key += dir;
+		key += '/';
+		key += filename;
+		return key;
+	}
+
+	//--------
+	EventHistory::EventHistory()
+		: mClock(0)
+	{
+	}
+
+	//--------
+	EventHistory::~EventHistory()
+	{
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.begin();
+		for(; iter != mWatches.end(); ++iter)
+			destroy(iter->second);
+	}
+
+	//--------
+	void EventHistory::destroy(Watch* watch)
+	{
+		std::list<PathHistory*>::iterator iter = watch->mOrder.begin();
+		for(; iter != watch->mOrder.end(); ++iter)
+			delete *iter;
+		delete watch;
+	}
+
+	//--------
+	void EventHistory::setListener(WatchID watchid, FileWatchListener* listener, const String& directory, size_t historySize)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		Watch*& watch = mWatches[watchid];
+		if(!watch)
+		{
+			watch = new Watch();
+			// the history starts now
+			watch->mTruncated = mClock;
+		}
+		watch->mListener = listener;
+		watch->mDirectory = directory;
+		watch->mLimit = historySize ? historySize : 1;
+	}
+
+	//--------
+	void EventHistory::removeListener(WatchID watchid)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return;
+
+		destroy(iter->second);
+		mWatches.erase(iter);
+	}
+
+	//--------
+	void EventHistory::removeDirectory(const String& directory)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.begin();
+		for(; iter != mWatches.end(); ++iter)
+		{
+			if(iter->second->mDirectory == directory)
+			{
+				destroy(iter->second);
+				mWatches.erase(iter);
+				return;
+			}
+		}
+	}
+
+	//--------
+	void EventHistory::handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		handleFileEvent(watchid, dir, filename, action, FileInfo());
+	}
+
+	//--------
+	void EventHistory::handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		// the listener may query, so it runs without the lock
+		FileWatchListener* listener = record(watchid, dir, filename, action, info);
+		if(listener)
+			listener->handleFileEvent(watchid, dir, filename, action, info);
+	}
+
+	//--------
+	void EventHistory::handleChangeset(WatchID watchid, const Changeset& changes)
+	{
+		FileWatchListener* listener = 0;
+		for(size_t i = 0; i < changes.size(); ++i)
+			listener = record(watchid, changes[i].dir, changes[i].filename, changes[i].action, changes[i].info);
+		if(listener)
+			listener->handleChangeset(watchid, changes);
+	}
+
+	//--------
+	FileWatchListener* EventHistory::record(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::unordered_map<WatchID, Watch*>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return 0;
+
+		Watch* watch = iter->second;
+		if(action == Actions::StormBegin || action == Actions::StormEnd)
+			return watch->mListener;
+
+		ClockToken clock = ++mClock;
+
+		// events were lost or collapsed, nothing before this point can be
+		// answered
+		if(action == Actions::Overflow || action == Actions::Dirty)
+		{
+			watch->mTruncated = clock;
+			return watch->mListener;
+		}
+
+		String key = historyKey(dir, filename);
+		PathHistory*& path = watch->mPaths[key];
+		if(!path)
+		{
+			path = new PathHistory();
+			path->mDir = dir;
+			path->mFilename = filename;
+			path->mOrder = watch->mOrder.insert(watch->mOrder.end(), path);
+		}
+		else
+		{
+			watch->mOrder.splice(watch->mOrder.end(), watch->mOrder, path->mOrder);
+		}
+		path->mInfo = info;
+
+		Event event;
+		event.mClock = clock;
+		event.mAction = action;
+
+		// a later Modified answers every query the earlier one did
+		std::vector<Event>& events = path->mEvents;
+		if(action == Actions::Modified && !events.empty() && events.back().mAction == Actions::Modified)
+			events.back() = event;
+		else
+			events.push_back(event);
+
+		if(events.size() > EVENTS_PER_PATH)
+		{
+			watch->mTruncated = std::max(watch->mTruncated, events.front().mClock);
+			events.erase(events.begin());
+		}
+
+		// forget the path that changed longest ago
+		if(watch->mPaths.size() > watch->mLimit)
+		{
+			PathHistory* oldest = watch->mOrder.front();
+			watch->mTruncated = std::max(watch->mTruncated, oldest->mEvents.back().mClock);
+			watch->mOrder.pop_front();
+			watch->mPaths.erase(historyKey(oldest->mDir, oldest->mFilename));
+			delete oldest;
+		}
+
+		return watch->mListener;
+	}
+
+	//--------
+	ClockToken EventHistory::getClock() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mClock;
+	}
+
+	//--------
+	HistoryResult EventHistory::query(WatchID watchid, ClockToken since) const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		HistoryResult result;
+		result.clock = mClock;
+
+		std::unordered_map<WatchID, Watch*>::const_iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end() || since < iter->second->mTruncated || since > mClock)
+		{
+			result.freshInstance = true;
+			return result;
+		}
+
+		// most recently changed last, so walk back until the paths are older
+		const Watch* watch = iter->second;
+		std::vector<std::pair<ClockToken, Change> > changes;
+		std::list<PathHistory*>::const_reverse_iterator path = watch->mOrder.rbegin();
+		for(; path != watch->mOrder.rend() && (*path)->mEvents.back().mClock > since; ++path)
+		{
+			const std::vector<Event>& events = (*path)->mEvents;
+			size_t first = events.size();
+			while(first > 0 && events[first - 1].mClock > since)
+				--first;
+
+			Change change;
+			change.dir = (*path)->mDir;
+			change.filename = (*path)->mFilename;
+			change.action = events[first].mAction;
+			change.info = (*path)->mInfo;
+
+			bool live = true;
+			for(size_t i = first + 1; i < events.size(); ++i)
+			{
+				if(!live)
+				{
+					// gone again and back, the path exists as new
+					change.action = events[i].mAction;
+					live = true;
+				}
+				else if(!mergeAction(change.action, events[i].mAction))
+				{
+					live = false;
+				}
+			}
+
+			if(live)
+				changes.push_back(std::make_pair(events[first].mClock, change));
+		}
+
+		// in the order the paths first changed
+		std::sort(changes.begin(), changes.end(),
+			[](const std::pair<ClockToken, Change>& a, const std::pair<ClockToken, Change>& b) { return a.first < b.first; });
+
+		result.changes.reserve(changes.size());
+		for(size_t i = 0; i < changes.size(); ++i)
+			result.changes.push_back(changes[i].second);
+		return result;
+	}
+
+};//namespace FW
@@ -0,0 +1,385 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/EventQueue.h>
+
+#include <vector>
+
+/// Entries moved out of the queue per lock during dispatch
+#define DISPATCH_BATCH 64
+
+namespace FW
+{
+
+	//--------
+	bool mergeAction(Action& pending, Action next)
+	{
+		switch(pending)
+		{
+		case Actions::Add:
+			// a new file that is gone again never happened
+			if(next == Actions::Delete)
+				return false;
+			break;
+		case Actions::Delete:
+			// deleted and recreated, the content changed
+			pending = (next == Actions::Delete) ? Actions::Delete : Actions::Modified;
+			break;
+		default:
+			pending = (next == Actions::Delete) ? Actions::Delete : Actions::Modified;
+			break;
+		}
+		return true;
+	}
+
+	//--------
+	static String pathKey(WatchID watchid, const String& dir, const String& filename)
+	{
+		String key;
+		key.reserve(sizeof(WatchID) + dir.size() + filename.size() + 1);
+		key.append((const char*)&watchid, sizeof(WatchID));
+		key += dir;
+		key += '/';
+		key += filename;
+		return key;
+	}
+
+	//--------
+	EventQueue::EventQueue(const QueueOptions& options, bool blockingPush)
+		: mOptions(options), mBlockingPush(blockingPush), mClosed(false), mNextSequence(0), mRemovals(0)
+	{
+		if(mOptions.capacity == 0)
+			mOptions.capacity = 1;
+	}
+
+	//--------
+	EventQueue::~EventQueue()
+	{
+		close();
+	}
+
+	//--------
+	void EventQueue::setListener(WatchID watchid, FileWatchListener* listener)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mListeners[watchid] = listener;
+	}
+
+	//--------
+	void EventQueue::removeListener(WatchID watchid)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mListeners.erase(watchid);
+		++mRemovals;
+
+		for(size_t i = 0; i < mEntries.size(); ++i)
+		{
+			Entry& entry = mEntries[i];
+			if(entry.mLive && entry.mWatchID == watchid)
+			{
+				entry.mLive = false;
+				--mStats.depth;
+			}
+		}
+
+		OverflowMap::iterator iter = mOverflows.begin();
+		while(iter != mOverflows.end())
+		{
+			if(iter->first.first == watchid)
+				mOverflows.erase(iter++);
+			else
+				++iter;
+		}
+
+		if(mOptions.policy == QueuePolicies::Coalesce)
+		{
+			std::unordered_map<String, unsigned long long>::iterator key = mByPath.begin();
+			while(key != mByPath.end())
+			{
+				if(key->first.compare(0, sizeof(WatchID), (const char*)&watchid, sizeof(WatchID)) == 0)
+					key = mByPath.erase(key);
+				else
+					++key;
+			}
+		}
+
+		trimFront();
+		mNotFull.notify_all();
+	}
+
+	//--------
+	void EventQueue::setBlockingPush(bool blockingPush)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mBlockingPush = blockingPush;
+		mNotFull.notify_all();
+	}
+
+	//--------
+	void EventQueue::handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		handleFileEvent(watchid, dir, filename, action, FileInfo());
+	}
+
+	//--------
+	void EventQueue::handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		push(watchid, dir, filename, action, info, std::shared_ptr<const Changeset>());
+	}
+
+	//--------
+	void EventQueue::handleChangeset(WatchID watchid, const Changeset& changes)
+	{
+		if(changes.empty())
+			return;
+
+		// the directory of the first change stands in if the entry is dropped
+		const Change& first = changes.front();
+		push(watchid, first.dir, "", first.action, first.info, std::make_shared<const Changeset>(changes));
+	}
+
+	//--------
+	void EventQueue::push(WatchID watchid, const String& dir, const String& filename, Action action,
+		const FileInfo& info, const std::shared_ptr<const Changeset>& changes)
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		if(mClosed)
+			return;
+
+		std::unordered_map<WatchID, FileWatchListener*>::iterator listener = mListeners.find(watchid);
+		if(listener == mListeners.end())
+			return;
+
+		String key;
+		if(mOptions.policy == QueuePolicies::Coalesce && !isDirectoryAction(action) && !changes)
+		{
+			key = pathKey(watchid, dir, filename);
+			std::unordered_map<String, unsigned long long>::iterator pending = mByPath.find(key);
+			if(pending != mByPath.end())
+			{
+				Entry& entry = mEntries[pending->second - mEntries.front().mSequence];
+				++mStats.coalesced;
+				entry.mInfo = info;
+				if(!mergeAction(entry.mAction, action))
+				{
+					entry.mLive = false;
+					--mStats.depth;
+					mByPath.erase(pending);
+					trimFront();
+					mNotFull.notify_all();
+				}
+				return;
+			}
+		}
+
+		while(mStats.depth >= mOptions.capacity)
+		{
+			if(mOptions.policy != QueuePolicies::Block)
+			{
+				dropOldest();
+				continue;
+			}
+
+			// a reader that dispatches itself stops reading instead, see isFull
+			if(!mBlockingPush)
+				break;
+
+			++mStats.blocked;
+			mNotFull.wait(lock);
+			if(mClosed)
+				return;
+
+			listener = mListeners.find(watchid);
+			if(listener == mListeners.end())
+				return;
+		}
+
+		Entry entry;
+		entry.mWatchID = watchid;
+		entry.mListener = listener->second;
+		entry.mDir = dir;
+		entry.mFilename = filename;
+		entry.mAction = action;
+		entry.mInfo = info;
+		entry.mChangeset = changes;
+		entry.mSequence = mNextSequence++;
+		entry.mLive = true;
+		mEntries.push_back(entry);
+
+		if(!key.empty())
+			mByPath[key] = entry.mSequence;
+
+		if(++mStats.depth > mStats.highWater)
+			mStats.highWater = mStats.depth;
+
+		mNotEmpty.notify_one();
+	}
+
+	//--------
+	bool EventQueue::isFull() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mOptions.policy == QueuePolicies::Block && mStats.depth >= mOptions.capacity;
+	}
+
+	//--------
+	void EventQueue::dropOldest()
+	{
+		Entry entry;
+		if(!popFront(entry))
+			return;
+
+		// keep the first listener seen for the directory
+		mOverflows.insert(std::make_pair(std::make_pair(entry.mWatchID, entry.mDir), entry.mListener));
+		++mStats.dropped;
+	}
+
+	//--------
+	void EventQueue::trimFront()
+	{
+		while(!mEntries.empty() && !mEntries.front().mLive)
+			mEntries.pop_front();
+	}
+
+	//--------
+	bool EventQueue::popFront(Entry& entry)
+	{
+		trimFront();
+		if(mEntries.empty())
+			return false;
+
+		Entry& front = mEntries.front();
+		entry.mWatchID = front.mWatchID;
+		entry.mListener = front.mListener;
+		entry.mDir.swap(front.mDir);
+		entry.mFilename.swap(front.mFilename);
+		entry.mAction = front.mAction;
+		entry.mInfo = front.mInfo;
+		entry.mChangeset.swap(front.mChangeset);
+		entry.mSequence = front.mSequence;
+		entry.mLive = true;
+
+		if(mOptions.policy == QueuePolicies::Coalesce && !entry.mChangeset)
+			mByPath.erase(pathKey(entry.mWatchID, entry.mDir, entry.mFilename));
+
+		mEntries.pop_front();
+		--mStats.depth;
+		trimFront();
+		return true;
+	}
+
+	//--------
+	bool EventQueue::isListening(WatchID watchid, unsigned long removals) const
+	{
+		// a watch removed while the batch was out must not see more events
+		if(removals == mRemovals)
+			return true;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mListeners.find(watchid) != mListeners.end();
+	}
+
+	//--------
+	size_t EventQueue::dispatch()
+	{
+		size_t dispatched = 0;
+		std::vector<Entry> batch;
+		OverflowMap overflows;
+
+		while(true)
+		{
+			unsigned long removals;
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				overflows.swap(mOverflows);
+
+				batch.clear();
+				Entry entry;
+				while(batch.size() < DISPATCH_BATCH && popFront(entry))
+					batch.push_back(entry);
+
+				removals = mRemovals;
+				if(!batch.empty())
+					mNotFull.notify_all();
+			}
+
+			if(batch.empty() && overflows.empty())
+				break;
+
+			// tell listeners about lost events before anything newer
+			OverflowMap::iterator iter = overflows.begin();
+			for(; iter != overflows.end(); ++iter)
+			{
+				if(iter->second && isListening(iter->first.first, removals))
+					iter->second->handleFileAction(iter->first.first, iter->first.second, "", Actions::Overflow);
+			}
+			overflows.clear();
+
+			for(size_t i = 0; i < batch.size(); ++i)
+			{
+				const Entry& entry = batch[i];
+				if(!isListening(entry.mWatchID, removals))
+					continue;
+
+				if(entry.mListener && entry.mChangeset)
+					entry.mListener->handleChangeset(entry.mWatchID, *entry.mChangeset);
+				else if(entry.mListener)
+					entry.mListener->handleFileEvent(entry.mWatchID, entry.mDir, entry.mFilename, entry.mAction, entry.mInfo);
+				++dispatched;
+			}
+		}
+
+		return dispatched;
+	}
+
+	//--------
+	bool EventQueue::waitAndDispatch(std::chrono::milliseconds timeout)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			if(!mClosed && mStats.depth == 0 && mOverflows.empty())
+				mNotEmpty.wait_for(lock, timeout);
+			if(mClosed)
+				return false;
+		}
+
+		dispatch();
+		return true;
+	}
+
+	//--------
+	void EventQueue::close()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mClosed = true;
+		mNotFull.notify_all();
+		mNotEmpty.notify_all();
+	}
+
+	//--------
+	QueueStats EventQueue::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mStats;
+	}
+
+};//namespace FW
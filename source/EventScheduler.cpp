@@ -0,0 +1,327 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/EventScheduler.h>
+#include <FileWatcher/EventQueue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+
+namespace FW
+{
+
+	struct EventScheduler::Queue
+	{
+		struct Event
+		{
+			String mDir;
+			String mFilename;
+			Action mAction;
+			FileInfo mInfo;
+			unsigned long long mSequence;
+			/// false once cancelled by a later event on the path
+			bool mLive;
+		};
+
+		WatchID mWatchID;
+		FileWatchListener* mListener;
+		int mPriority;
+		unsigned int mWeight;
+		unsigned int mRateLimit;
+		/// token bucket for the rate limit
+		double mTokens;
+		std::chrono::steady_clock::time_point mRefill;
+		/// events this queue may still dispatch in the current round
+		long mDeficit;
+		std::deque<Event> mEvents;
+		/// cancelled events still in mEvents
+		size_t mDead;
+		unsigned long long mNextSequence;
+		/// sequence of the queued event per path, used to coalesce events
+		/// held back by the rate limit
+		std::unordered_map<String, unsigned long long> mHeld;
+		/// counted in mScheduledQueues
+		bool mScheduled;
+		bool mRemoved;
+	};
+
+	//--------
+	static String heldKey(const String& dir, const String& filename)
+	{
+		String key;
+		key.reserve(dir.size() + filename.size() + 1);
+		key += dir;
+		key += '/';
+		key += filename;
+		return key;
+	}
+
+	//--------
+	static bool takeToken(EventScheduler::Queue* queue, std::chrono::steady_clock::time_point now)
+	{
+		double elapsed = std::chrono::duration<double>(now - queue->mRefill).count();
+		queue->mRefill = now;
+		queue->mTokens = std::min<double>(queue->mRateLimit, queue->mTokens + elapsed * queue->mRateLimit);
+
+		if(queue->mTokens < 1.0)
+			return false;
+
+		queue->mTokens -= 1.0;
+		return true;
+	}
+
+	//--------
+	EventScheduler::EventScheduler()
+		: mScheduledQueues(0), mPending(0), mCoalesced(0), mDispatching(false), mHasRemoved(false)
+	{
+	}
+
+	//--------
+	EventScheduler::~EventScheduler()
+	{
+		for(size_t i = 0; i < mQueues.size(); ++i)
+			delete mQueues[i];
+		for(size_t i = 0; i < mAddedQueues.size(); ++i)
+			delete mAddedQueues[i];
+	}
+
+	//--------
+	EventScheduler::Queue* EventScheduler::addQueue(WatchID watchid, FileWatchListener* listener, const WatchOptions& options)
+	{
+		Queue* queue = new Queue();
+		queue->mWatchID = watchid;
+		queue->mListener = listener;
+		queue->mPriority = options.priority;
+		queue->mWeight = options.weight ? options.weight : 1;
+		queue->mRateLimit = options.rateLimit;
+		queue->mTokens = options.rateLimit;
+		queue->mRefill = std::chrono::steady_clock::now();
+		queue->mDeficit = 0;
+		queue->mDead = 0;
+		queue->mNextSequence = 0;
+		queue->mRemoved = false;
+
+		queue->mScheduled = queue->mPriority != 0 || queue->mWeight != 1 || queue->mRateLimit != 0;
+		if(queue->mScheduled)
+			++mScheduledQueues;
+
+		if(mDispatching)
+		{
+			mAddedQueues.push_back(queue);
+			return queue;
+		}
+
+		// keep the order of arrival among equal priorities
+		std::vector<Queue*>::iterator iter = mQueues.begin();
+		while(iter != mQueues.end() && (*iter)->mPriority >= queue->mPriority)
+			++iter;
+		mQueues.insert(iter, queue);
+		return queue;
+	}
+
+	//--------
+	void EventScheduler::setListener(Queue* queue, FileWatchListener* listener)
+	{
+		queue->mListener = listener;
+	}
+
+	//--------
+	void EventScheduler::removeQueue(Queue* queue)
+	{
+		if(!queue || queue->mRemoved)
+			return;
+
+		if(queue->mScheduled)
+			--mScheduledQueues;
+
+		mPending -= queue->mEvents.size() - queue->mDead;
+		queue->mEvents.clear();
+		queue->mDead = 0;
+		queue->mHeld.clear();
+		queue->mRemoved = true;
+		mHasRemoved = true;
+
+		if(!mDispatching)
+			purge();
+	}
+
+	//--------
+	void EventScheduler::push(Queue* queue, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		if(queue->mRemoved)
+			return;
+
+		if(queue->mRateLimit && !isDirectoryAction(action))
+		{
+			String key = heldKey(dir, filename);
+			std::unordered_map<String, unsigned long long>::iterator iter = queue->mHeld.find(key);
+			if(iter != queue->mHeld.end() && !queue->mEvents.empty()
+				&& iter->second >= queue->mEvents.front().mSequence)
+			{
+				// the held event reports the net change and what the entry
+				// looks like now
+				Queue::Event& held = queue->mEvents[iter->second - queue->mEvents.front().mSequence];
+				held.mInfo = info;
+				++mCoalesced;
+				if(!mergeAction(held.mAction, action))
+				{
+					held.mLive = false;
+					++queue->mDead;
+					--mPending;
+					queue->mHeld.erase(iter);
+				}
+				return;
+			}
+			queue->mHeld[key] = queue->mNextSequence;
+		}
+
+		Queue::Event event;
+		event.mDir = dir;
+		event.mFilename = filename;
+		event.mAction = action;
+		event.mInfo = info;
+		event.mSequence = queue->mNextSequence++;
+		event.mLive = true;
+		queue->mEvents.push_back(event);
+		++mPending;
+	}
+
+	//--------
+	void EventScheduler::dispatch()
+	{
+		if(mDispatching)
+			return;
+		mDispatching = true;
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		size_t begin = 0;
+		while(mPending && begin < mQueues.size())
+		{
+			size_t end = begin;
+			while(end < mQueues.size() && mQueues[end]->mPriority == mQueues[begin]->mPriority)
+				++end;
+
+			// deficit round robin over the watches of this priority
+			bool progress = true;
+			while(progress)
+			{
+				progress = false;
+				for(size_t i = begin; i < end; ++i)
+				{
+					Queue* queue = mQueues[i];
+					if(queue->mEvents.empty())
+						continue;
+
+					queue->mDeficit += queue->mWeight;
+					while(queue->mDeficit > 0 && !queue->mEvents.empty())
+					{
+						if(!queue->mEvents.front().mLive)
+						{
+							queue->mEvents.pop_front();
+							--queue->mDead;
+							continue;
+						}
+
+						if(queue->mRateLimit && !takeToken(queue, now))
+						{
+							queue->mDeficit = 0;
+							break;
+						}
+
+						Queue::Event event;
+						event.mDir.swap(queue->mEvents.front().mDir);
+						event.mFilename.swap(queue->mEvents.front().mFilename);
+						event.mAction = queue->mEvents.front().mAction;
+						event.mInfo = queue->mEvents.front().mInfo;
+						event.mSequence = queue->mEvents.front().mSequence;
+						queue->mEvents.pop_front();
+						--mPending;
+						--queue->mDeficit;
+						progress = true;
+
+						if(queue->mRateLimit)
+						{
+							String key = heldKey(event.mDir, event.mFilename);
+							std::unordered_map<String, unsigned long long>::iterator iter = queue->mHeld.find(key);
+							if(iter != queue->mHeld.end() && iter->second == event.mSequence)
+								queue->mHeld.erase(iter);
+						}
+
+						if(queue->mListener)
+							queue->mListener->handleFileEvent(queue->mWatchID, event.mDir, event.mFilename, event.mAction, event.mInfo);
+					}
+
+					if(queue->mEvents.empty())
+						queue->mDeficit = 0;
+				}
+			}
+
+			begin = end;
+		}
+
+		mDispatching = false;
+		purge();
+	}
+
+	//--------
+	void EventScheduler::purge()
+	{
+		if(mHasRemoved)
+		{
+			std::vector<Queue*>::iterator iter = mQueues.begin();
+			while(iter != mQueues.end())
+			{
+				if((*iter)->mRemoved)
+				{
+					delete *iter;
+					iter = mQueues.erase(iter);
+				}
+				else
+				{
+					++iter;
+				}
+			}
+			mHasRemoved = false;
+		}
+
+		// queues a listener added while we were dispatching
+		for(size_t i = 0; i < mAddedQueues.size(); ++i)
+		{
+			Queue* queue = mAddedQueues[i];
+			if(queue->mRemoved)
+			{
+				delete queue;
+				continue;
+			}
+
+			std::vector<Queue*>::iterator iter = mQueues.begin();
+			while(iter != mQueues.end() && (*iter)->mPriority >= queue->mPriority)
+				++iter;
+			mQueues.insert(iter, queue);
+		}
+		mAddedQueues.clear();
+	}
+
+};//namespace FW
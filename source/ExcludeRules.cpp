@@ -0,0 +1,254 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/ExcludeRules.h>
+
+#include <fstream>
+#include <string.h>
+
+namespace FW
+{
+
+	//--------
+	static bool matchClass(const char*& pattern, char c)
+	{
+		// pattern points at '[', left past the closing ']' on success
+		const char* p = pattern + 1;
+		bool negate = (*p == '!' || *p == '^');
+		if(negate)
+			++p;
+
+		bool found = false;
+		const char* start = p;
+		for(; *p && (*p != ']' || p == start); ++p)
+		{
+			if(p[1] == '-' && p[2] && p[2] != ']')
+			{
+				if(c >= p[0] && c <= p[2])
+					found = true;
+				p += 2;
+			}
+			else if(*p == c)
+			{
+				found = true;
+			}
+		}
+
+		// no closing bracket, the '[' is literal
+		if(!*p)
+			return false;
+
+		pattern = p + 1;
+		return found != negate;
+	}
+
+	//--------
+	static bool matchGlob(const char* pattern, const char* text)
+	{
+		while(*pattern)
+		{
+			if(pattern[0] == '*' && pattern[1] == '*')
+			{
+				pattern += 2;
+				if(!*pattern)
+					return true;
+
+				if(*pattern == '/')
+				{
+					// zero or more whole directories
+					++pattern;
+					for(const char* next = text; next; next = strchr(next, '/'))
+					{
+						if(next != text)
+							++next;
+						if(matchGlob(pattern, next))
+							return true;
+					}
+					return false;
+				}
+
+				for(;; ++text)
+				{
+					if(matchGlob(pattern, text))
+						return true;
+					if(!*text)
+						return false;
+				}
+			}
+
+			if(*pattern == '*')
+			{
+				++pattern;
+				for(;; ++text)
+				{
+					if(matchGlob(pattern, text))
+						return true;
+					if(!*text || *text == '/')
+						return false;
+				}
+			}
+
+			if(!*text)
+				return false;
+
+			if(*pattern == '?')
+			{
+				if(*text == '/')
+					return false;
+			}
+			else if(*pattern == '[' && strchr(pattern, ']'))
+			{
+				if(*text == '/' || !matchClass(pattern, *text))
+					return false;
+				++text;
+				continue;
+			}
+			else
+			{
+				if(*pattern == '\\' && pattern[1])
+					++pattern;
+				if(*pattern != *text)
+					return false;
+			}
+
+			++pattern;
+			++text;
+		}
+		return !*text;
+	}
+
+	//--------
+	ExcludeRules::ExcludeRules()
+		: mNegations(false)
+	{
+	}
+
+	//--------
+	void ExcludeRules::add(const String& line, const String& base)
+	{
+		String pattern(line);
+
+		// trailing blanks are ignored unless escaped
+		while(!pattern.empty() && (pattern[pattern.size() - 1] == ' ' || pattern[pattern.size() - 1] == '\r')
+			&& !(pattern.size() > 1 && pattern[pattern.size() - 2] == '\\'))
+			pattern.erase(pattern.size() - 1);
+
+		if(pattern.empty() || pattern[0] == '#')
+			return;
+
+		Rule rule;
+		rule.mNegate = pattern[0] == '!';
+		if(rule.mNegate)
+			pattern.erase(0, 1);
+		else if(pattern[0] == '\\')
+			pattern.erase(0, 1);
+
+		rule.mDirectory = !pattern.empty() && pattern[pattern.size() - 1] == '/';
+		if(rule.mDirectory)
+			pattern.erase(pattern.size() - 1);
+
+		rule.mAnchored = pattern.find('/') != String::npos;
+		if(!pattern.empty() && pattern[0] == '/')
+			pattern.erase(0, 1);
+		if(pattern.empty())
+			return;
+
+		// patterns below the watched directory only apply there
+		if(!base.empty())
+		{
+			if(!rule.mAnchored)
+				pattern = "**/" + pattern;
+			pattern = base + "/" + pattern;
+			rule.mAnchored = true;
+		}
+
+		rule.mLiteral = pattern.find_first_of("*?[\\") == String::npos;
+		rule.mPattern = pattern;
+		mRules.push_back(rule);
+
+		if(rule.mNegate)
+			mNegations = true;
+		else if(rule.mLiteral && !rule.mAnchored)
+			(rule.mDirectory ? mDirectoryNames : mNames).insert(pattern);
+	}
+
+	//--------
+	bool ExcludeRules::load(const String& file, const String& base)
+	{
+		std::ifstream stream(file.c_str());
+		if(!stream)
+			return false;
+
+		String line;
+		while(std::getline(stream, line))
+			add(line, base);
+		return true;
+	}
+
+	//--------
+	bool ExcludeRules::matches(const Rule& rule, const String& path, const char* name, bool directory) const
+	{
+		if(rule.mDirectory && !directory)
+			return false;
+
+		if(rule.mLiteral)
+			return rule.mAnchored ? rule.mPattern == path : rule.mPattern == name;
+
+		return matchGlob(rule.mPattern.c_str(), rule.mAnchored ? path.c_str() : name);
+	}
+
+	//--------
+	bool ExcludeRules::excluded(const String& path, bool directory) const
+	{
+		if(mRules.empty())
+			return false;
+
+		size_t slash = path.rfind('/');
+		const char* name = path.c_str() + (slash == String::npos ? 0 : slash + 1);
+
+		if(mNegations)
+		{
+			for(size_t i = mRules.size(); i > 0; --i)
+			{
+				if(matches(mRules[i - 1], path, name, directory))
+					return !mRules[i - 1].mNegate;
+			}
+			return false;
+		}
+
+		if(!mNames.empty() || !mDirectoryNames.empty())
+		{
+			String key(name);
+			if(mNames.count(key) || (directory && mDirectoryNames.count(key)))
+				return true;
+		}
+
+		for(size_t i = 0; i < mRules.size(); ++i)
+		{
+			const Rule& rule = mRules[i];
+			if((!rule.mLiteral || rule.mAnchored) && matches(rule, path, name, directory))
+				return true;
+		}
+		return false;
+	}
+
+};//namespace FW
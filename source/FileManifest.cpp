@@ -0,0 +1,236 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/FileManifest.h>
+
+#include <fstream>
+
+/// Filter bits per listed file, for about 2% false positives
+#define FILTER_BITS_PER_FILE 8
+/// Bits tested per lookup
+#define FILTER_PROBES 4
+
+namespace FW
+{
+
+	//--------
+	static String trimPath(const String& path)
+	{
+		String trimmed = path;
+		while(trimmed.size() > 1 && trimmed[trimmed.size() - 1] == '/')
+			trimmed.erase(trimmed.size() - 1);
+		return trimmed;
+	}
+
+	//--------
+	static unsigned long long hashBytes(unsigned long long hash, const char* bytes, size_t size)
+	{
+		for(size_t i = 0; i < size; ++i)
+		{
+			hash ^= (unsigned char)bytes[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	//--------
+	FileManifest::FileManifest()
+		: mFilterMask(0), mStale(0)
+	{
+		rebuildFilter();
+	}
+
+	//--------
+	bool FileManifest::add(const String& path)
+	{
+		String file = trimPath(path);
+		if(file.size() < 2 || file[0] != '/')
+			return false;
+		if(!mFiles.insert(file).second)
+			return false;
+
+		countDirectories(file, 1);
+		if(mFiles.size() * FILTER_BITS_PER_FILE > mFilterMask + 1)
+			rebuildFilter();
+		else
+			setBits(hash(file, String()));
+		return true;
+	}
+
+	//--------
+	bool FileManifest::remove(const String& path)
+	{
+		String file = trimPath(path);
+		if(!mFiles.erase(file))
+			return false;
+
+		countDirectories(file, -1);
+		// stale bits only cost lookups in the set, clear them once they
+		// outnumber the live ones
+		if(++mStale > mFiles.size())
+			rebuildFilter();
+		return true;
+	}
+
+	//--------
+	bool FileManifest::load(const String& file)
+	{
+		std::ifstream stream(file.c_str());
+		if(!stream)
+			return false;
+
+		String line;
+		while(std::getline(stream, line))
+		{
+			if(!line.empty() && line[line.size() - 1] == '\r')
+				line.erase(line.size() - 1);
+			if(!line.empty())
+				add(line);
+		}
+		return true;
+	}
+
+	//--------
+	bool FileManifest::contains(const String& dir, const String& filename) const
+	{
+		if(!testBits(hash(dir, filename)))
+			return false;
+
+		String path;
+		path.reserve(dir.size() + filename.size() + 1);
+		path += dir;
+		if(path.empty() || path[path.size() - 1] != '/')
+			path += '/';
+		path += filename;
+		return mFiles.count(path) != 0;
+	}
+
+	//--------
+	bool FileManifest::covers(const String& directory) const
+	{
+		return mDirectories.count(trimPath(directory)) != 0;
+	}
+
+	//--------
+	std::vector<String> FileManifest::getDirectories() const
+	{
+		std::unordered_set<String> directories;
+		std::unordered_set<String>::const_iterator iter = mFiles.begin();
+		for(; iter != mFiles.end(); ++iter)
+		{
+			size_t slash = iter->rfind('/');
+			directories.insert(slash ? iter->substr(0, slash) : String("/"));
+		}
+		return std::vector<String>(directories.begin(), directories.end());
+	}
+
+	//--------
+	String FileManifest::getCommonDirectory() const
+	{
+		// the directories every file is below have the full count, the
+		// deepest of them is the longest
+		String common;
+		std::unordered_map<String, size_t>::const_iterator iter = mDirectories.begin();
+		for(; iter != mDirectories.end(); ++iter)
+		{
+			if(iter->second == mFiles.size() && iter->first.size() > common.size())
+				common = iter->first;
+		}
+		return common;
+	}
+
+	//--------
+	unsigned long long FileManifest::hash(const String& dir, const String& filename)
+	{
+		unsigned long long value = hashBytes(0xcbf29ce484222325ull, dir.data(), dir.size());
+		if(!filename.empty())
+		{
+			if(dir.empty() || dir[dir.size() - 1] != '/')
+				value = hashBytes(value, "/", 1);
+			value = hashBytes(value, filename.data(), filename.size());
+		}
+		return value;
+	}
+
+	//--------
+	void FileManifest::setBits(unsigned long long hash)
+	{
+		// double hashing, the second hash is odd so the probes differ
+		unsigned long long step = (hash >> 32 | hash << 32) | 1;
+		for(int i = 0; i < FILTER_PROBES; ++i, hash += step)
+			mFilter[(hash & mFilterMask) >> 6] |= 1ull << (hash & 63);
+	}
+
+	//--------
+	bool FileManifest::testBits(unsigned long long hash) const
+	{
+		unsigned long long step = (hash >> 32 | hash << 32) | 1;
+		for(int i = 0; i < FILTER_PROBES; ++i, hash += step)
+		{
+			if(!(mFilter[(hash & mFilterMask) >> 6] & (1ull << (hash & 63))))
+				return false;
+		}
+		return true;
+	}
+
+	//--------
+	void FileManifest::rebuildFilter()
+	{
+		// room to grow, so adds do not rebuild it every time
+		unsigned long long bits = 1024;
+		while(bits < mFiles.size() * FILTER_BITS_PER_FILE * 2)
+			bits <<= 1;
+
+		mFilter.assign(bits / 64, 0);
+		mFilterMask = bits - 1;
+		mStale = 0;
+
+		std::unordered_set<String>::const_iterator iter = mFiles.begin();
+		for(; iter != mFiles.end(); ++iter)
+			setBits(hash(*iter, String()));
+	}
+
+	//--------
+	void FileManifest::countDirectories(const String& path, int delta)
+	{
+		size_t slash = path.rfind('/');
+		while(slash != String::npos)
+		{
+			String directory = slash ? path.substr(0, slash) : String("/");
+			if(delta > 0)
+			{
+				++mDirectories[directory];
+			}
+			else
+			{
+				std::unordered_map<String, size_t>::iterator iter = mDirectories.find(directory);
+				if(iter != mDirectories.end() && --iter->second == 0)
+					mDirectories.erase(iter);
+			}
+
+			if(!slash)
+				break;
+			slash = path.rfind('/', slash - 1);
+		}
+	}
+
+};//namespace FW
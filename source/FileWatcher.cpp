@@ -22,6 +22,14 @@
 
 #include <FileWatcher/FileWatcher.h>
 #include <FileWatcher/FileWatcherImpl.h>
+#include <FileWatcher/ChangesetCollector.h>
+#include <FileWatcher/DispatchPool.h>
+#include <FileWatcher/EventHistory.h>
+#include <FileWatcher/EventQueue.h>
+#include <FileWatcher/FileManifest.h>
+#include <FileWatcher/HeavyHitters.h>
+
+#include <algorithm>
 
 #if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_WIN32
 #	include <FileWatcher/FileWatcherWin32.h>
@@ -32,15 +40,40 @@
 #elif FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
 #	include <FileWatcher/FileWatcherLinux.h>
 #	define FILEWATCHER_IMPL FileWatcherLinux
+#	include <pthread.h>
+#	include <sched.h>
 #endif
 
+/// Number of latency buckets, the last one takes everything from about a minute
+#define LATENCY_BUCKETS 27
+
 namespace FW
 {
 
+	//--------
+	static String manifestWatch(const FileManifest& manifest, WatchOptions& options)
+	{
+		options.recursive = true;
+		options.manifest = std::make_shared<FileManifest>(manifest);
+		return manifest.getCommonDirectory();
+	}
+
 	//--------
 	FileWatcher::FileWatcher()
+		: mPool(0), mPooledWatches(0), mCollector(0), mPaused(0), mWaitForDispatch(false)
 	{
 		mImpl = new FILEWATCHER_IMPL();
+		// up front, so queries from other threads never see it change
+		mHistory = new EventHistory();
+		mHeavyHitters = new HeavyHitters();
+	}
+
+	//--------
+	FileWatcher::FileWatcher(FileWatcherImpl* impl)
+		: mImpl(impl), mPool(0), mPooledWatches(0), mCollector(0), mPaused(0), mWaitForDispatch(false)
+	{
+		mHistory = new EventHistory();
+		mHeavyHitters = new HeavyHitters();
 	}
 
 	//--------
@@ -48,23 +81,148 @@ namespace FW
 	{
 		delete mImpl;
 		mImpl = 0;
+
+		// runs what is still queued
+		delete mPool;
+		mPool = 0;
+
+		delete mCollector;
+		mCollector = 0;
+
+		delete mPaused;
+		mPaused = 0;
+
+		delete mHistory;
+		mHistory = 0;
+
+		delete mHeavyHitters;
+		mHeavyHitters = 0;
 	}
 
 	//--------
 	WatchID FileWatcher::addWatch(const String& directory, FileWatchListener* watcher)
 	{
-		return mImpl->addWatch(directory, watcher, false);
+		return addWatch(directory, watcher, false);
 	}
 
 	//--------
 	WatchID FileWatcher::addWatch(const String& directory, FileWatchListener* watcher, bool recursive)
 	{
-		return mImpl->addWatch(directory, watcher, recursive);
+		if(!mPool && !mHeavyHitters->isEnabled())
+		{
+			WatchID watchid = mImpl->addWatch(directory, watcher, recursive);
+			addWatchEntry(watchid, directory, watcher);
+			return watchid;
+		}
+
+		WatchOptions options;
+		options.recursive = recursive;
+		return addWatch(directory, watcher, options);
+	}
+
+	//--------
+	WatchID FileWatcher::addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options)
+	{
+		// the stage that calls watcher, the history goes in front of it
+		FileWatchListener* target = watcher;
+		if(options.settleTime)
+		{
+			if(!mCollector)
+				mCollector = new ChangesetCollector(mImpl);
+			target = mCollector;
+		}
+		else if(mPool)
+		{
+			target = mPool;
+		}
+
+		// the heavy hitters count first, then the history records
+		FileWatchListener* first = options.historySize ? mHistory : target;
+		bool counted = mHeavyHitters->isEnabled();
+
+		WatchID watchid = mImpl->addWatch(directory, counted ? mHeavyHitters : first, options);
+
+		// already covered, the stages of the existing watch stay as they are
+		Watch* watch = addWatchEntry(watchid, directory, target);
+		if(!watch)
+			return watchid;
+		watch->mPooled = target == mPool;
+		watch->mCounted = counted;
+		watch->mHistorySize = options.historySize;
+
+		if(counted)
+			mHeavyHitters->setListener(watchid, first, directory);
+		if(options.historySize)
+			mHistory->setListener(watchid, target, directory, options.historySize);
+
+		if(options.settleTime)
+		{
+			mCollector->setListener(watchid, watcher, directory, options);
+		}
+		else if(mPool)
+		{
+			mPool->setListener(watchid, watcher);
+			++mPooledWatches;
+		}
+		return watchid;
+	}
+
+	//--------
+	FileWatcher::Watch* FileWatcher::addWatchEntry(WatchID watchid, const String& directory, FileWatchListener* target)
+	{
+		if(mWatches.count(watchid))
+			return 0;
+
+		Watch& watch = mWatches[watchid];
+		watch.mDirectory = directory;
+		watch.mPooled = false;
+		watch.mCounted = false;
+		watch.mHistorySize = 0;
+		watch.mTarget = target;
+		watch.mPaused = false;
+		return &watch;
+	}
+
+	//--------
+	bool FileWatcher::connectTarget(WatchID watchid, const Watch& watch, FileWatchListener* target)
+	{
+		if(watch.mHistorySize)
+		{
+			mHistory->setListener(watchid, target, watch.mDirectory, watch.mHistorySize);
+			return true;
+		}
+		if(watch.mCounted)
+		{
+			mHeavyHitters->setListener(watchid, target, watch.mDirectory);
+			return true;
+		}
+
+		String directory;
+		return mImpl->swapListener(watchid, target, directory) != 0;
+	}
+
+	//--------
+	WatchID FileWatcher::addWatch(const FileManifest& manifest, FileWatchListener* watcher, const WatchOptions& options)
+	{
+		WatchOptions manifestOptions = options;
+		String directory = manifestWatch(manifest, manifestOptions);
+		return addWatch(directory, watcher, manifestOptions);
 	}
 
 	//--------
 	void FileWatcher::removeWatch(const String& directory)
 	{
+		std::map<WatchID, Watch>::iterator iter = mWatches.begin();
+		for(; iter != mWatches.end(); ++iter)
+		{
+			if(iter->second.mDirectory == directory)
+			{
+				removeWatch(iter->first);
+				return;
+			}
+		}
+
+		// not added through this watcher, so no stages to clean up
 		mImpl->removeWatch(directory);
 	}
 
@@ -72,33 +230,346 @@ namespace FW
 	void FileWatcher::removeWatch(WatchID watchid)
 	{
 		mImpl->removeWatch(watchid);
+
+		bool pooled = false;
+		std::map<WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter != mWatches.end())
+		{
+			pooled = iter->second.mPooled;
+			mWatches.erase(iter);
+		}
+
+		mHeavyHitters->removeListener(watchid);
+		mHistory->removeListener(watchid);
+		if(mCollector)
+			mCollector->removeListener(watchid);
+		if(mPaused)
+			mPaused->removeListener(watchid);
+
+		if(mPool)
+		{
+			mPool->removeListener(watchid);
+			// the listener may be destroyed once this returns
+			mPool->flush();
+			if(pooled)
+				--mPooledWatches;
+		}
+	}
+
+	//--------
+	bool FileWatcher::updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed)
+	{
+		return mImpl->updateManifest(watchid, added, removed);
 	}
 
 	//--------
 	void FileWatcher::update()
 	{
 		mImpl->update();
+
+		if(mCollector)
+			mCollector->flush();
+
+		if(mPool && mWaitForDispatch)
+			mPool->flush();
+	}
+
+	//--------
+	MemoryUsage FileWatcher::getMemoryUsage() const
+	{
+		return mImpl->getMemoryUsage();
+	}
+
+	//--------
+	bool FileWatcher::setEventReader(EventReader reader)
+	{
+		return mImpl->setEventReader(reader);
+	}
+
+	//--------
+	bool FileWatcher::setEventRing(EventRing* ring, unsigned long long tag)
+	{
+		return mImpl->setEventRing(ring, tag);
+	}
+
+	//--------
+	void FileWatcher::completeRead(int result)
+	{
+		mImpl->completeRead(result);
+
+		if(mCollector)
+			mCollector->flush();
+
+		if(mPool && mWaitForDispatch)
+			mPool->flush();
+	}
+
+	//--------
+	bool FileWatcher::setWatchLimit(size_t watches, unsigned int pollInterval)
+	{
+		return mImpl->setWatchLimit(watches, pollInterval);
+	}
+
+	//--------
+	bool FileWatcher::setDispatchThreads(unsigned int threads, bool waitInUpdate)
+	{
+		if(mPooledWatches > 0)
+			return false;
+
+		delete mPool;
+		mPool = threads > 0 ? new DispatchPool(threads) : 0;
+		mWaitForDispatch = waitInUpdate;
+		return true;
+	}
+
+	//--------
+	void FileWatcher::flush()
+	{
+		if(mPool)
+			mPool->flush();
+	}
+
+	//--------
+	bool FileWatcher::wait(int timeout)
+	{
+		// wake up in time to deliver the next changeset
+		int due = mCollector ? mCollector->timeUntilDue() : -1;
+		if(due >= 0 && (timeout < 0 || due < timeout))
+			timeout = due;
+
+		int ready = mImpl->wait(timeout);
+		if(ready >= 0)
+			return ready > 0;
+
+		if(timeout > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		return true;
+	}
+
+	//--------
+	void FileWatcher::wake()
+	{
+		mImpl->wake();
+	}
+
+	//--------
+	ClockToken FileWatcher::getClock() const
+	{
+		return mHistory->getClock();
+	}
+
+	//--------
+	HistoryResult FileWatcher::query(WatchID watchid, ClockToken since) const
+	{
+		return mHistory->query(watchid, since);
+	}
+
+	//--------
+	void FileWatcher::enableHeavyHitters(const HeavyHitterOptions& options)
+	{
+		mHeavyHitters->enable(options);
+	}
+
+	//--------
+	HeavyHitterReport FileWatcher::getHeavyHitters() const
+	{
+		return mHeavyHitters->getReport();
+	}
+
+	//--------
+	bool FileWatcher::pause(WatchID watchid)
+	{
+		std::map<WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end() || iter->second.mPaused)
+			return false;
+
+		if(!mPaused)
+			mPaused = new ChangesetCollector(mImpl);
+
+		// the collector stands in behind the history and the heavy hitters
+		// and is never flushed, so it holds everything until resume
+		Watch& watch = iter->second;
+		if(!connectTarget(watchid, watch, mPaused))
+			return false;
+
+		mPaused->setListener(watchid, watch.mTarget, watch.mDirectory, WatchOptions());
+		watch.mPaused = true;
+		return true;
+	}
+
+	//--------
+	bool FileWatcher::resume(WatchID watchid)
+	{
+		std::map<WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end() || !iter->second.mPaused)
+			return false;
+
+		Changeset changes;
+		FileWatchListener* target = mPaused->release(watchid, changes);
+		iter->second.mPaused = false;
+		connectTarget(watchid, iter->second, target);
+
+		if(!changes.empty())
+			target->handleChangeset(watchid, changes);
+		return true;
+	}
+
+	static void pin_current_thread(int cpu)
+	{
+#if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
 	}
 
 	void async_filewatcher_thread(AsyncFileWatcher* arg)
 	{
+		typedef std::chrono::steady_clock clock;
+
 		AsyncFileWatcher& watcher_handle = *arg;
 		BufferedFileWatcher& watcher = watcher_handle.m_watch;
+		const ReaderOptions& options = watcher_handle.m_reader;
 
+		if (options.cpu >= 0)
+			pin_current_thread(options.cpu);
+
+		clock::time_point spinUntil;
 		while (watcher_handle.m_running)
 		{
+			// right after events, check without blocking for a while
+			bool ready = false;
+			bool spun = false;
+			clock::time_point now = clock::now();
+			if (now < spinUntil)
+			{
+				clock::time_point start = now;
+				while (watcher_handle.m_running && !(ready = watcher.m_watcher.wait(0)) && now < spinUntil)
+					now = clock::now();
+				spun = ready;
+
+				if (options.measureLatency)
+				{
+					std::lock_guard<std::mutex> lock(watcher_handle.m_statsMutex);
+					watcher_handle.m_stats.spinTime += std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+				}
+			}
+
+			if (!ready)
+			{
+				// the reader has to wait for room in the queue, not for events
+				if (watcher.m_queue && watcher.m_queue->isFull())
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				else
+					ready = watcher.m_watcher.wait(options.maxWait);
+			}
+
+			clock::time_point wakeup = clock::now();
 			watcher.update();
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			if (ready && options.measureLatency)
+				watcher_handle.recordLatency(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - wakeup).count(), spun);
+			if (ready && options.spin)
+				spinUntil = clock::now() + std::chrono::microseconds(options.spin);
+		}
+	}
+
+	void async_dispatch_thread(AsyncFileWatcher* arg)
+	{
+		EventQueue& queue = *arg->m_watch.m_queue;
+
+		while (queue.waitAndDispatch(std::chrono::milliseconds(50)))
+		{
 		}
 	}
 
-	BufferedFileWatcher::BufferedFileWatcher()
+	struct batch_command
+	{
+		std::vector<command_struct> commands;
+		/// set when the batch was submitted with a callback
+		BatchCallback completion;
+		std::promise<std::vector<WatchResult> > results;
+	};
+
+	void WatchBatch::addWatch(const String & directory, FileWatchListener * watcher, bool recursive)
+	{
+		WatchOptions options;
+		options.recursive = recursive;
+		addWatch(directory, watcher, options);
+	}
+
+	void WatchBatch::addWatch(const String & directory, FileWatchListener * watcher, const WatchOptions& options)
+	{
+		command_struct str;
+		str.Type = AddWatch;
+		str.path = directory;
+		str.Add.watcher = watcher;
+		str.Add.recursive = options.recursive;
+		str.Add.target = NULL;
+		str.options = options;
+		m_commands.push_back(str);
+	}
+
+	void WatchBatch::removeWatch(const String & directory)
+	{
+		command_struct str;
+		str.Type = RemoveWatchStr;
+		str.path = directory;
+		m_commands.push_back(str);
+	}
+
+	void WatchBatch::removeWatch(WatchID watchid)
+	{
+		command_struct str;
+		str.Type = RemoveWatchID;
+		str.RemoveID.id = watchid;
+		m_commands.push_back(str);
+	}
+
+	void WatchBatch::pause(WatchID watchid)
+	{
+		command_struct str;
+		str.Type = PauseWatch;
+		str.Pause.id = watchid;
+		m_commands.push_back(str);
+	}
+
+	void WatchBatch::resume(WatchID watchid)
 	{
+		command_struct str;
+		str.Type = ResumeWatch;
+		str.Pause.id = watchid;
+		m_commands.push_back(str);
+	}
+
+	void WatchBatch::updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed)
+	{
+		command_struct str;
+		str.Type = UpdateManifest;
+		str.Pause.id = watchid;
+		str.added = added;
+		str.removed = removed;
+		m_commands.push_back(str);
+	}
+
+	BufferedFileWatcher::BufferedFileWatcher(const QueueOptions& queue)
+		: m_queue(NULL), m_dispatch(true)
+	{
+		if (queue.capacity > 0)
+			m_queue = new EventQueue(queue, false);
+	}
+
+	BufferedFileWatcher::BufferedFileWatcher(FileWatcherImpl* impl, const QueueOptions& queue)
+		: m_watcher(impl), m_queue(NULL), m_dispatch(true)
+	{
+		if (queue.capacity > 0)
+			m_queue = new EventQueue(queue, false);
 	}
 
 	BufferedFileWatcher::~BufferedFileWatcher()
 	{
+		delete m_queue;
 	}
 
 	void BufferedFileWatcher::addWatch(const String & directory, FileWatchListener * watcher, WatchID* target)
@@ -107,18 +578,33 @@ namespace FW
 	}
 
 	void BufferedFileWatcher::addWatch(const String & directory, FileWatchListener * watcher, bool recursive, WatchID* target)
+	{
+		WatchOptions options;
+		options.recursive = recursive;
+		addWatch(directory, watcher, options, target);
+	}
+
+	void BufferedFileWatcher::addWatch(const String & directory, FileWatchListener * watcher, const WatchOptions& options, WatchID* target)
 	{
 		command_struct str;
 		str.Type = AddWatch;
 		str.path = directory;
 		str.Add.watcher = watcher;
-		str.Add.recursive = recursive;
+		str.Add.recursive = options.recursive;
 		str.Add.target = target;
+		str.options = options;
 
 		std::lock_guard<std::mutex> lock(m_mutex);
 		m_commands.push(str);
 	}
 
+	void BufferedFileWatcher::addWatch(const FileManifest& manifest, FileWatchListener * watcher, const WatchOptions& options, WatchID* target)
+	{
+		WatchOptions manifestOptions = options;
+		String directory = manifestWatch(manifest, manifestOptions);
+		addWatch(directory, watcher, manifestOptions, target);
+	}
+
 	void BufferedFileWatcher::removeWatch(const String & directory)
 	{
 		command_struct str;
@@ -139,67 +625,327 @@ namespace FW
 		m_commands.push(str);
 	}
 
+	void BufferedFileWatcher::pause(WatchID watchid)
+	{
+		command_struct str;
+		str.Type = PauseWatch;
+		str.Pause.id = watchid;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_commands.push(str);
+	}
+
+	void BufferedFileWatcher::resume(WatchID watchid)
+	{
+		command_struct str;
+		str.Type = ResumeWatch;
+		str.Pause.id = watchid;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_commands.push(str);
+	}
+
+	void BufferedFileWatcher::updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed)
+	{
+		command_struct str;
+		str.Type = UpdateManifest;
+		str.Pause.id = watchid;
+		str.added = added;
+		str.removed = removed;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_commands.push(str);
+	}
+
+	std::future<std::vector<WatchResult> > BufferedFileWatcher::submit(const WatchBatch& batch)
+	{
+		command_struct str;
+		str.Type = RunBatch;
+		str.batch = std::make_shared<batch_command>();
+		str.batch->commands = batch.m_commands;
+		std::future<std::vector<WatchResult> > results = str.batch->results.get_future();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_commands.push(str);
+		return results;
+	}
+
+	void BufferedFileWatcher::submit(const WatchBatch& batch, const BatchCallback& completion)
+	{
+		command_struct str;
+		str.Type = RunBatch;
+		str.batch = std::make_shared<batch_command>();
+		str.batch->commands = batch.m_commands;
+		str.batch->completion = completion;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_commands.push(str);
+	}
+
 	void BufferedFileWatcher::update()
 	{
-		if (!m_commands.empty())
+		// take the commands as a whole, so producers are never blocked by a
+		// command that crawls a large tree
+		std::queue<command_struct> commands;
 		{
 			std::lock_guard<std::mutex> lock(m_mutex);
-			while (!m_commands.empty())
-			{
-				auto cmd = m_commands.front();
-				m_commands.pop();
+			commands.swap(m_commands);
+		}
 
-				switch (cmd.Type)
-				{
-				case AddWatch:
+		while (!commands.empty())
+		{
+			try
+			{
+				runCommand(commands.front());
+			}
+			catch (...)
+			{
+				// the commands after the failed one run on the next update
+				commands.pop();
+				std::lock_guard<std::mutex> lock(m_mutex);
+				while (!m_commands.empty())
 				{
-					auto ret = m_watcher.addWatch(cmd.path, cmd.Add.watcher, cmd.Add.recursive);
-					if (cmd.Add.target != NULL)
-						*cmd.Add.target = ret;
-					break;
+					commands.push(m_commands.front());
+					m_commands.pop();
 				}
-				case RemoveWatchID:
-					m_watcher.removeWatch(cmd.RemoveID.id);
-					break;
-				case RemoveWatchStr:
-					m_watcher.removeWatch(cmd.path);
-					break;
+				commands.swap(m_commands);
+				throw;
+			}
+			commands.pop();
+		}
+
+		// with the Block policy, events stay in the kernel until there is room
+		if (!m_queue || !m_queue->isFull())
+			m_watcher.update();
+
+		if (m_queue && m_dispatch)
+			m_queue->dispatch();
+	}
+
+	WatchID BufferedFileWatcher::runCommand(const command_struct& cmd)
+	{
+		switch (cmd.Type)
+		{
+		case AddWatch:
+		{
+			auto ret = m_queue ? addQueuedWatch(cmd) : m_watcher.addWatch(cmd.path, cmd.Add.watcher, cmd.options);
+			if (cmd.Add.target != NULL)
+				*cmd.Add.target = ret;
+			return ret;
+		}
+		case RemoveWatchID:
+			m_watcher.removeWatch(cmd.RemoveID.id);
+			if (m_queue)
+			{
+				m_queue->removeListener(cmd.RemoveID.id);
+				for (auto iter = m_paths.begin(); iter != m_paths.end(); ++iter)
+				{
+					if (iter->second == cmd.RemoveID.id)
+					{
+						m_paths.erase(iter);
+						break;
+					}
 				}
 			}
+			return cmd.RemoveID.id;
+		case RemoveWatchStr:
+		{
+			auto iter = m_paths.find(cmd.path);
+			if (iter != m_paths.end())
+			{
+				WatchID watchid = iter->second;
+				m_watcher.removeWatch(watchid);
+				m_queue->removeListener(watchid);
+				m_paths.erase(iter);
+				return watchid;
+			}
+
+			m_watcher.removeWatch(cmd.path);
+			return 0;
+		}
+		case PauseWatch:
+			return m_watcher.pause(cmd.Pause.id) ? cmd.Pause.id : 0;
+		case ResumeWatch:
+			return m_watcher.resume(cmd.Pause.id) ? cmd.Pause.id : 0;
+		case UpdateManifest:
+			return m_watcher.updateManifest(cmd.Pause.id, cmd.added, cmd.removed) ? cmd.Pause.id : 0;
+		case RunBatch:
+			runBatch(*cmd.batch);
+			break;
 		}
+		return 0;
+	}
 
-		m_watcher.update();
+	void BufferedFileWatcher::runBatch(batch_command& batch)
+	{
+		std::vector<WatchResult> results(batch.commands.size());
+		for (size_t i = 0; i < batch.commands.size(); ++i)
+		{
+			try
+			{
+				results[i].watchid = runCommand(batch.commands[i]);
+			}
+			catch (const std::exception& e)
+			{
+				results[i].error = std::current_exception();
+				results[i].message = e.what();
+			}
+			catch (...)
+			{
+				results[i].error = std::current_exception();
+			}
+		}
+
+		if (batch.completion)
+			batch.completion(results);
+		else
+			batch.results.set_value(results);
 	}
 
-	AsyncFileWatcher::AsyncFileWatcher() : m_running(true)
+	WatchID BufferedFileWatcher::addQueuedWatch(const command_struct& cmd)
 	{
+		// the queue stands in for every listener and routes by WatchID
+		WatchID watchid = m_watcher.addWatch(cmd.path, m_queue, cmd.options);
+
+		// already covered by a watch, whose listener stays in place
+		for (auto iter = m_paths.begin(); iter != m_paths.end(); ++iter)
+		{
+			if (iter->second == watchid)
+				return watchid;
+		}
+
+		m_queue->setListener(watchid, cmd.Add.watcher);
+		m_paths.insert(std::make_pair(cmd.path, watchid));
+		return watchid;
+	}
+
+	QueueStats BufferedFileWatcher::getQueueStats() const
+	{
+		return m_queue ? m_queue->getStats() : QueueStats();
+	}
+
+	ClockToken BufferedFileWatcher::getClock() const
+	{
+		return m_watcher.getClock();
+	}
+
+	HistoryResult BufferedFileWatcher::query(WatchID watchid, ClockToken since) const
+	{
+		return m_watcher.query(watchid, since);
+	}
+
+	void BufferedFileWatcher::enableHeavyHitters(const HeavyHitterOptions& options)
+	{
+		m_watcher.enableHeavyHitters(options);
+	}
+
+	HeavyHitterReport BufferedFileWatcher::getHeavyHitters() const
+	{
+		return m_watcher.getHeavyHitters();
+	}
+
+	AsyncFileWatcher::AsyncFileWatcher(const QueueOptions& queue, const ReaderOptions& reader)
+		: m_watch(queue), m_reader(reader), m_latencies(LATENCY_BUCKETS), m_latencySum(0), m_running(true)
+	{
+		start();
+	}
+
+	AsyncFileWatcher::AsyncFileWatcher(FileWatcherImpl* impl, const QueueOptions& queue, const ReaderOptions& reader)
+		: m_watch(impl, queue), m_reader(reader), m_latencies(LATENCY_BUCKETS), m_latencySum(0), m_running(true)
+	{
+		start();
+	}
+
+	void AsyncFileWatcher::start()
+	{
+		if (m_watch.m_queue)
+		{
+			// listeners run on their own thread, so the reader may block on a full queue
+			m_watch.m_dispatch = false;
+			m_watch.m_queue->setBlockingPush(true);
+			m_dispatchThr = std::thread(async_dispatch_thread, this);
+		}
+
 		m_thr = std::thread(async_filewatcher_thread, this);
 	}
 
 	AsyncFileWatcher::~AsyncFileWatcher()
 	{
 		m_running = false;
+		m_watch.m_watcher.wake();
+		if (m_watch.m_queue)
+			m_watch.m_queue->close();
+
 		m_thr.join();
+		if (m_dispatchThr.joinable())
+			m_dispatchThr.join();
 	}
 
 	void AsyncFileWatcher::addWatch(const String & directory, FileWatchListener * watcher, WatchID * target)
 	{
 		m_watch.addWatch(directory, watcher, target);
+		m_watch.m_watcher.wake();
 	}
 
 	void AsyncFileWatcher::addWatch(const String & directory, FileWatchListener * watcher, bool recursive, WatchID * target)
 	{
 		m_watch.addWatch(directory, watcher, recursive, target);
+		m_watch.m_watcher.wake();
+	}
+
+	void AsyncFileWatcher::addWatch(const String & directory, FileWatchListener * watcher, const WatchOptions& options, WatchID * target)
+	{
+		m_watch.addWatch(directory, watcher, options, target);
+		m_watch.m_watcher.wake();
+	}
+
+	void AsyncFileWatcher::addWatch(const FileManifest& manifest, FileWatchListener * watcher, const WatchOptions& options, WatchID * target)
+	{
+		m_watch.addWatch(manifest, watcher, options, target);
+		m_watch.m_watcher.wake();
 	}
 
 	void AsyncFileWatcher::removeWatch(const String & directory)
 	{
 		m_watch.removeWatch(directory);
+		m_watch.m_watcher.wake();
 	}
 
 	void AsyncFileWatcher::removeWatch(WatchID watchid)
 	{
 		m_watch.removeWatch(watchid);
+		m_watch.m_watcher.wake();
+	}
+
+	void AsyncFileWatcher::pause(WatchID watchid)
+	{
+		m_watch.pause(watchid);
+		m_watch.m_watcher.wake();
+	}
+
+	void AsyncFileWatcher::resume(WatchID watchid)
+	{
+		m_watch.resume(watchid);
+		m_watch.m_watcher.wake();
+	}
+
+	void AsyncFileWatcher::updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed)
+	{
+		m_watch.updateManifest(watchid, added, removed);
+		m_watch.m_watcher.wake();
+	}
+
+	std::future<std::vector<WatchResult> > AsyncFileWatcher::submit(const WatchBatch& batch)
+	{
+		std::future<std::vector<WatchResult> > results = m_watch.submit(batch);
+		m_watch.m_watcher.wake();
+		return results;
+	}
+
+	void AsyncFileWatcher::submit(const WatchBatch& batch, const BatchCallback& completion)
+	{
+		m_watch.submit(batch, completion);
+		m_watch.m_watcher.wake();
 	}
 
 	void AsyncFileWatcher::update()
@@ -207,4 +953,73 @@ namespace FW
 		// no-op, handled by our thread
 	}
 
+	QueueStats AsyncFileWatcher::getQueueStats() const
+	{
+		return m_watch.getQueueStats();
+	}
+
+	ClockToken AsyncFileWatcher::getClock() const
+	{
+		return m_watch.getClock();
+	}
+
+	HistoryResult AsyncFileWatcher::query(WatchID watchid, ClockToken since) const
+	{
+		return m_watch.query(watchid, since);
+	}
+
+	void AsyncFileWatcher::enableHeavyHitters(const HeavyHitterOptions& options)
+	{
+		m_watch.enableHeavyHitters(options);
+	}
+
+	HeavyHitterReport AsyncFileWatcher::getHeavyHitters() const
+	{
+		return m_watch.getHeavyHitters();
+	}
+
+	LatencyStats AsyncFileWatcher::getLatencyStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_statsMutex);
+		LatencyStats stats = m_stats;
+		if (!stats.wakeups)
+			return stats;
+
+		stats.mean = (double)m_latencySum / stats.wakeups;
+
+		// upper bound of the bucket holding the percentile, capped at the maximum
+		size_t seen = 0;
+		for (size_t i = 0; i < m_latencies.size(); ++i)
+		{
+			seen += m_latencies[i];
+			unsigned long long bound = std::min(1ull << i, stats.max);
+			if (!stats.p50 && seen * 2 >= stats.wakeups)
+				stats.p50 = bound;
+			if (seen * 100 >= stats.wakeups * 99)
+			{
+				stats.p99 = bound;
+				break;
+			}
+		}
+		return stats;
+	}
+
+	void AsyncFileWatcher::recordLatency(unsigned long long micros, bool spun)
+	{
+		size_t bucket = 0;
+		while (bucket + 1 < LATENCY_BUCKETS && (1ull << bucket) <= micros)
+			++bucket;
+
+		std::lock_guard<std::mutex> lock(m_statsMutex);
+		if (!m_stats.wakeups || micros < m_stats.min)
+			m_stats.min = micros;
+		if (micros > m_stats.max)
+			m_stats.max = micros;
+		++m_stats.wakeups;
+		if (spun)
+			++m_stats.spinWakeups;
+		m_latencySum += micros;
+		++m_latencies[bucket];
+	}
+
 };//namespace FW
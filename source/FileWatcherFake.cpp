@@ -0,0 +1,359 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/FileWatcherFake.h>
+#include <FileWatcher/FileManifest.h>
+
+#include <algorithm>
+
+namespace FW
+{
+
+	//--------
+	static String trimSlash(const String& directory)
+	{
+		String dir = directory;
+		while(dir.size() > 1 && dir[dir.size() - 1] == '/')
+			dir.erase(dir.size() - 1);
+		return dir;
+	}
+
+	//--------
+	FileWatcherFake::FileWatcherFake()
+		: mLastWatchID(0), mRemovals(0), mDelivered(0), mTime(0), mWoken(false)
+	{
+	}
+
+	//--------
+	FileWatcherFake::~FileWatcherFake()
+	{
+	}
+
+	//--------
+	WatchID FileWatcherFake::addWatch(const String& directory, FileWatchListener* watcher, bool recursive)
+	{
+		WatchOptions options;
+		options.recursive = recursive;
+		return addWatch(directory, watcher, options);
+	}
+
+	//--------
+	WatchID FileWatcherFake::addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options)
+	{
+		String dir = trimSlash(directory);
+
+		// like the Linux backend, a directory that is already covered gets
+		// the id of the watch that covers it
+		WatchID watchid = 0;
+		if(route(dir, watchid))
+			return watchid;
+
+		Watch& watch = mWatches[++mLastWatchID];
+		watch.mDirectory = dir;
+		watch.mListener = watcher;
+		watch.mRecursive = options.recursive;
+		if(options.manifest)
+			watch.mManifest = std::make_shared<FileManifest>(*options.manifest);
+		mByDirectory[dir] = mLastWatchID;
+		return mLastWatchID;
+	}
+
+	//--------
+	void FileWatcherFake::removeWatch(const String& directory)
+	{
+		std::unordered_map<String, WatchID>::iterator iter = mByDirectory.find(trimSlash(directory));
+		if(iter != mByDirectory.end())
+			removeWatch(iter->second);
+	}
+
+	//--------
+	void FileWatcherFake::removeWatch(WatchID watchid)
+	{
+		std::map<WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return;
+
+		mByDirectory.erase(iter->second.mDirectory);
+		mWatches.erase(iter);
+		++mRemovals;
+	}
+
+	//--------
+	const FileWatcherFake::Watch* FileWatcherFake::route(const String& dir, WatchID& watchid) const
+	{
+		String path = trimSlash(dir);
+		bool nested = false;
+		for(;;)
+		{
+			std::unordered_map<String, WatchID>::const_iterator iter = mByDirectory.find(path);
+			if(iter != mByDirectory.end())
+			{
+				const Watch& watch = mWatches.find(iter->second)->second;
+				if(!nested || watch.mRecursive)
+				{
+					watchid = iter->second;
+					return &watch;
+				}
+			}
+
+			String::size_type slash = path.rfind('/');
+			if(slash == String::npos || path.size() == 1)
+				return 0;
+			path.erase(slash ? slash : 1);
+			nested = true;
+		}
+	}
+
+	//--------
+	void FileWatcherFake::update()
+	{
+		// puts the events a throwing listener left undelivered back in
+		// front of the pending ones
+		struct Remainder
+		{
+			Remainder(FileWatcherFake& fake) : mFake(fake), mNext(0), mDone(0) {}
+
+			~Remainder()
+			{
+				std::vector<Event>& events = mFake.mDelivering;
+				if(mNext < events.size())
+				{
+					events[mNext].mCount -= mDone;
+					if(!events[mNext].mCount)
+						++mNext;
+				}
+
+				std::lock_guard<std::mutex> lock(mFake.mMutex);
+				mFake.mPending.insert(mFake.mPending.begin(), events.begin() + std::min(mNext, events.size()), events.end());
+				events.clear();
+			}
+
+			FileWatcherFake& mFake;
+			// first event not delivered in full
+			size_t mNext;
+			// times mNext was delivered
+			size_t mDone;
+		};
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mDelivering.swap(mPending);
+		}
+
+		Remainder remainder(*this);
+		for(size_t i = 0; i < mDelivering.size(); remainder.mNext = ++i, remainder.mDone = 0)
+		{
+			const Event& event = mDelivering[i];
+			WatchID watchid = event.mWatchID;
+			const Watch* watch = 0;
+			if(watchid)
+			{
+				std::map<WatchID, Watch>::const_iterator iter = mWatches.find(watchid);
+				if(iter != mWatches.end())
+					watch = &iter->second;
+			}
+			else
+			{
+				watch = route(event.mDir, watchid);
+			}
+			if(!watch)
+				continue;
+
+			// the listener may remove the watch, so nothing of it is kept
+			FileWatchListener* listener = watch->mListener;
+			String dir = event.mWatchID ? watch->mDirectory : event.mDir;
+			if(watch->mManifest && !isDirectoryAction(event.mAction) && !watch->mManifest->contains(dir, event.mFilename))
+				continue;
+			unsigned long long removals = mRemovals;
+			for(size_t j = 0; j < event.mCount; ++j)
+			{
+				if(removals != mRemovals)
+				{
+					if(!mWatches.count(watchid))
+						break;
+					removals = mRemovals;
+				}
+
+				remainder.mDone = j + 1;
+				++mDelivered;
+				listener->handleFileEvent(watchid, dir, event.mFilename, event.mAction, event.mInfo);
+			}
+		}
+	}
+
+	//--------
+	int FileWatcherFake::wait(int timeout)
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		if(timeout < 0)
+			mCondition.wait(lock, [this] { return !mPending.empty() || mWoken; });
+		else
+			mCondition.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return !mPending.empty() || mWoken; });
+
+		mWoken = false;
+		return mPending.empty() ? 0 : 1;
+	}
+
+	//--------
+	void FileWatcherFake::wake()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mWoken = true;
+		mCondition.notify_all();
+	}
+
+	//--------
+	std::chrono::steady_clock::time_point FileWatcherFake::now() const
+	{
+		return std::chrono::steady_clock::time_point() + std::chrono::milliseconds(getTime());
+	}
+
+	//--------
+	FileWatchListener* FileWatcherFake::swapListener(WatchID watchid, FileWatchListener* listener, String& directory)
+	{
+		std::map<WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return 0;
+
+		FileWatchListener* previous = iter->second.mListener;
+		iter->second.mListener = listener;
+		directory = iter->second.mDirectory;
+		return previous;
+	}
+
+	//--------
+	bool FileWatcherFake::updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed)
+	{
+		std::map<WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end() || !iter->second.mManifest)
+			return false;
+
+		FileManifest& manifest = *iter->second.mManifest;
+		for(size_t i = 0; i < removed.size(); ++i)
+			manifest.remove(removed[i]);
+
+		String prefix = iter->second.mDirectory == "/" ? String("/") : iter->second.mDirectory + "/";
+		bool inside = true;
+		for(size_t i = 0; i < added.size(); ++i)
+		{
+			if(added[i].compare(0, prefix.size(), prefix) == 0)
+				manifest.add(added[i]);
+			else
+				inside = false;
+		}
+		return inside;
+	}
+
+	//--------
+	void FileWatcherFake::inject(const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		Event event;
+		event.mWatchID = 0;
+		event.mDir = dir;
+		event.mFilename = filename;
+		event.mAction = action;
+		event.mInfo = info;
+		event.mCount = 1;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPending.push_back(event);
+		mCondition.notify_all();
+	}
+
+	//--------
+	void FileWatcherFake::inject(WatchID watchid, const String& filename, Action action, size_t count)
+	{
+		if(!count)
+			return;
+
+		Event event;
+		event.mWatchID = watchid;
+		event.mFilename = filename;
+		event.mAction = action;
+		event.mCount = count;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPending.push_back(event);
+		mCondition.notify_all();
+	}
+
+	//--------
+	void FileWatcherFake::injectAt(unsigned long long time, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		Event event;
+		event.mWatchID = 0;
+		event.mDir = dir;
+		event.mFilename = filename;
+		event.mAction = action;
+		event.mInfo = info;
+		event.mCount = 1;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		if(time <= mTime)
+		{
+			mPending.push_back(event);
+			mCondition.notify_all();
+		}
+		else
+		{
+			mScheduled.insert(std::make_pair(time, event));
+		}
+	}
+
+	//--------
+	void FileWatcherFake::advance(unsigned long long milliseconds)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTime += milliseconds;
+
+		// in time order, and in injection order for the same time
+		std::multimap<unsigned long long, Event>::iterator iter = mScheduled.begin();
+		for(; iter != mScheduled.end() && iter->first <= mTime; ++iter)
+			mPending.push_back(iter->second);
+		mScheduled.erase(mScheduled.begin(), iter);
+
+		// a wait for a settle time may be due now too
+		mWoken = true;
+		mCondition.notify_all();
+	}
+
+	//--------
+	unsigned long long FileWatcherFake::getTime() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mTime;
+	}
+
+	//--------
+	size_t FileWatcherFake::getPendingCount() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		size_t count = 0;
+		for(size_t i = 0; i < mPending.size(); ++i)
+			count += mPending[i].mCount;
+		std::multimap<unsigned long long, Event>::const_iterator iter = mScheduled.begin();
+		for(; iter != mScheduled.end(); ++iter)
+			count += iter->second.mCount;
+		return count;
+	}
+
+};//namespace FW
@@ -23,6 +23,9 @@
 */
 
 #include <FileWatcher/FileWatcherLinux.h>
+#include <FileWatcher/ExcludeRules.h>
+#include <FileWatcher/FileManifest.h>
+#include <FileWatcher/IoUringReader.h>
 
 #if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
 
@@ -33,80 +36,577 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
 
 #define BUFF_SIZE ((sizeof(struct inotify_event)+FILENAME_MAX)*1024)
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM | IN_DELETE)
+/// Default milliseconds between two polls of a directory without kernel watch
+#define POLL_INTERVAL 1000
+/// Most directories polled in one update
+#define POLL_BATCH 256
+/// Milliseconds over which the event rate of a storm watch is measured
+#define STORM_WINDOW 100
+/// Fewest events that start a storm; low thresholds get a longer window
+#define STORM_MIN_EVENTS 10
+/// Most files per directory remembered for the rescan after a storm
+#define STORM_NAMES 4096
 
 namespace FW
 {
 
+	/// A watched directory, one per kernel watch. The directories of a
+	/// recursive watch form a tree and only the root stores a full path,
+	/// so moving a directory is a single relink.
 	struct WatchStruct
+	{
+		/// inotify watch descriptor
+		int mWD;
+		/// interned in FileWatcherLinux::mDirNames. The full path for a root,
+		/// the directory name otherwise
+		const String* mName;
+		WatchStruct* mParent;
+		WatchStruct* mFirstChild;
+		WatchStruct* mNextSibling;
+		WatchStruct* mPrevSibling;
+		/// the watch this directory is the root of, 0 for subdirectories
+		WatchRoot* mRoot;
+		/// neighbours in the eviction order while there is a kernel watch
+		WatchStruct* mLruPrev;
+		WatchStruct* mLruNext;
+		/// clock of the last change seen, 0 if there was none
+		unsigned long long mLastActive;
+		/// set while the directory is polled, mWD is -1 then
+		PollState* mPoll;
+	};
+
+	/// An entry of a polled directory
+	struct PollEntry
+	{
+		String mName;
+		long long mMTime;
+		off_t mSize;
+		bool mDirectory;
+
+		bool operator<(const PollEntry& other) const { return mName < other.mName; }
+	};
+
+	/// Last listing of a directory whose kernel watch was evicted
+	struct PollState
+	{
+		/// 0 once the directory is gone or has a kernel watch again
+		WatchStruct* mWatch;
+		/// sorted by name
+		std::vector<PollEntry> mEntries;
+		unsigned long long mNextPoll;
+	};
+
+	/// A difference between two listings, as an inotify mask
+	struct PollChange
+	{
+		String mName;
+		unsigned long mMask;
+	};
+
+	/// A directory that had events during a storm
+	struct StormDir
+	{
+		/// events since the last Actions::Dirty
+		size_t mEvents;
+		/// first action of every file in the storm, which tells whether the
+		/// file existed before it
+		std::unordered_map<String, Action> mFiles;
+		/// more than STORM_NAMES files changed, the directory is reported
+		/// with Actions::Overflow after the storm
+		bool mTruncated;
+
+		StormDir() : mEvents(0), mTruncated(false) {}
+	};
+
+	/// Storm detection of a watch with WatchOptions::stormThreshold
+	struct StormState
+	{
+		/// events per mWindow that start a storm
+		size_t mLimit;
+		/// milliseconds, STORM_WINDOW or long enough to hold STORM_MIN_EVENTS
+		unsigned long long mWindow;
+		unsigned int mCooldown;
+		unsigned long long mWindowStart;
+		size_t mWindowEvents;
+		/// clock of the last window that reached the limit
+		unsigned long long mLastBusy;
+		bool mActive;
+		/// set while the files of the dirty directories are reported
+		bool mRescan;
+		std::map<String, StormDir> mDirs;
+	};
+
+	/// A watch added through addWatch
+	struct WatchRoot
 	{
 		WatchID mWatchID;
-		String mDirName;
-		FileWatchListener* mListener;		
+		FileWatchListener* mListener;
+		/// 0 once the root directory is gone
+		WatchStruct* mDir;
+		/// pending events while the scheduler is active
+		EventScheduler::Queue* mQueue;
+		/// entries left out of the watch, 0 if none
+		ExcludeRules* mExclude;
+		bool mRecursive;
+		/// events carry size, mtime and inode
+		bool mMetadata;
+		/// 0 without WatchOptions::stormThreshold
+		StormState* mStorm;
+		/// files the watch is limited to, 0 without a manifest
+		FileManifest* mManifest;
+		/// the watch whose tree reached the root directory when it was
+		/// crawled, 0 if none
+		WatchRoot* mOuter;
+		/// directory of that tree holding the root directory
+		WatchStruct* mAnchor;
 	};
 
+	//--------
+	static void linkChild(WatchStruct* parent, WatchStruct* child)
+	{
+		child->mParent = parent;
+		child->mPrevSibling = 0;
+		child->mNextSibling = parent->mFirstChild;
+		if(parent->mFirstChild)
+			parent->mFirstChild->mPrevSibling = child;
+		parent->mFirstChild = child;
+	}
+
+	//--------
+	static void unlinkChild(WatchStruct* child)
+	{
+		if(!child->mParent)
+			return;
+
+		if(child->mPrevSibling)
+			child->mPrevSibling->mNextSibling = child->mNextSibling;
+		else
+			child->mParent->mFirstChild = child->mNextSibling;
+		if(child->mNextSibling)
+			child->mNextSibling->mPrevSibling = child->mPrevSibling;
+
+		child->mParent = 0;
+		child->mPrevSibling = 0;
+		child->mNextSibling = 0;
+	}
+
+	//--------
+	static WatchRoot* findRoot(WatchStruct* watch)
+	{
+		while(watch->mParent)
+			watch = watch->mParent;
+		return watch->mRoot;
+	}
+
+	//--------
+	static bool isCrawled(const WatchRoot* root)
+	{
+		// the subdirectories of a flat watch are watched for the one around it
+		return root->mRecursive || root->mOuter;
+	}
+
+	//--------
+	static String joinPath(const String& dir, const String& name)
+	{
+		if(!dir.empty() && dir[dir.size() - 1] == '/')
+			return dir + name;
+		return dir + "/" + name;
+	}
+
+	//--------
+	static String relativePath(const WatchStruct* watch)
+	{
+		// the path below the watched directory, "" for the root
+		String path;
+		for(; watch->mParent; watch = watch->mParent)
+			path = path.empty() ? *watch->mName : *watch->mName + "/" + path;
+		return path;
+	}
+
+	//--------
+	static bool isExcluded(WatchStruct* watch, const String& name, bool directory)
+	{
+		const ExcludeRules* rules = findRoot(watch)->mExclude;
+		if(!rules)
+			return false;
+
+		String path = relativePath(watch);
+		return rules->excluded(path.empty() ? name : path + "/" + name, directory);
+	}
+
+	//--------
+	static bool isExcludedFrom(const WatchRoot* root, const String& dir, const String& name, bool directory)
+	{
+		// dir lies in the tree of root, but not necessarily in the tree of
+		// the node it is built from
+		const String& base = *root->mDir->mName;
+		String path = dir.size() > base.size() ? dir.substr(joinPath(base, "").size()) : String();
+		return root->mExclude->excluded(path.empty() ? name : path + "/" + name, directory);
+	}
+
+	//--------
+	static ExcludeRules* compileRules(const String& directory, const WatchOptions& options)
+	{
+		if(options.exclude.empty() && options.excludeFrom.empty())
+			return 0;
+
+		ExcludeRules* rules = new ExcludeRules();
+		for(size_t i = 0; i < options.exclude.size(); ++i)
+			rules->add(options.exclude[i]);
+
+		String prefix = joinPath(directory, "");
+		for(size_t i = 0; i < options.excludeFrom.size(); ++i)
+		{
+			const String& file = options.excludeFrom[i];
+			String path = !file.empty() && file[0] == '/' ? file : prefix + file;
+
+			// a file below the watched directory applies to its own directory
+			String base;
+			if(path.compare(0, prefix.size(), prefix) == 0)
+			{
+				size_t slash = path.rfind('/');
+				if(slash > prefix.size())
+					base = path.substr(prefix.size(), slash - prefix.size());
+			}
+
+			// a missing ignore file just adds nothing
+			rules->load(path, base);
+		}
+
+		if(rules->empty())
+		{
+			delete rules;
+			return 0;
+		}
+		return rules;
+	}
+
+	//--------
+	static unsigned long long monotonicMillis()
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	}
+
+	//--------
+	static size_t systemWatchLimit()
+	{
+		// shared by all inotify instances of the user, the real room may be less
+		size_t limit = (size_t)-1;
+		FILE* file = fopen("/proc/sys/fs/inotify/max_user_watches", "r");
+		if(file)
+		{
+			unsigned long value;
+			if(fscanf(file, "%lu", &value) == 1 && value > 0)
+				limit = value;
+			fclose(file);
+		}
+		return limit;
+	}
+
+	//--------
+	static FileType fileType(mode_t mode)
+	{
+		if(S_ISREG(mode))
+			return FileTypes::File;
+		if(S_ISDIR(mode))
+			return FileTypes::Directory;
+		if(S_ISLNK(mode))
+			return FileTypes::Symlink;
+		return FileTypes::Other;
+	}
+
+	//--------
+	static void inspectEntry(int dirfd, const String& name, FileInfo& info)
+	{
+#ifdef STATX_TYPE
+		struct statx attrib;
+		if(statx(dirfd, name.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+			STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO, &attrib) != 0)
+			return;
+
+		info.type = fileType(attrib.stx_mode);
+		info.size = attrib.stx_size;
+		info.mtime = attrib.stx_mtime.tv_sec * 1000000000LL + attrib.stx_mtime.tv_nsec;
+		info.inode = attrib.stx_ino;
+#else
+		struct stat attrib;
+		if(fstatat(dirfd, name.c_str(), &attrib, AT_SYMLINK_NOFOLLOW) != 0)
+			return;
+
+		info.type = fileType(attrib.st_mode);
+		info.size = attrib.st_size;
+		info.mtime = attrib.st_mtim.tv_sec * 1000000000LL + attrib.st_mtim.tv_nsec;
+		info.inode = attrib.st_ino;
+#endif
+		info.hasStat = true;
+	}
+
+	//--------
+	static bool scanDirectory(const String& path, std::vector<PollEntry>& entries)
+	{
+		DIR* handle = opendir(path.c_str());
+		if(!handle)
+			return false;
+
+		struct dirent* entry;
+		while((entry = readdir(handle)) != NULL)
+		{
+			if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+				continue;
+
+			struct stat attrib;
+			if(fstatat(dirfd(handle), entry->d_name, &attrib, AT_SYMLINK_NOFOLLOW) != 0)
+				continue;
+
+			PollEntry polled;
+			polled.mName = entry->d_name;
+			polled.mMTime = (long long)attrib.st_mtim.tv_sec * 1000000000 + attrib.st_mtim.tv_nsec;
+			polled.mSize = attrib.st_size;
+			polled.mDirectory = S_ISDIR(attrib.st_mode);
+			entries.push_back(polled);
+		}
+
+		closedir(handle);
+		std::sort(entries.begin(), entries.end());
+		return true;
+	}
+
+	//--------
+	static void diffEntries(const std::vector<PollEntry>& before, const std::vector<PollEntry>& after, std::vector<PollChange>& changes)
+	{
+		// deletes go first, so a renamed directory is dropped before its new
+		// name is watched
+		std::vector<PollChange> added;
+		size_t i = 0, j = 0;
+		while(i < before.size() || j < after.size())
+		{
+			PollChange change;
+			if(j == after.size() || (i < before.size() && before[i] < after[j]))
+			{
+				const PollEntry& entry = before[i++];
+				change.mName = entry.mName;
+				change.mMask = IN_DELETE | (entry.mDirectory ? IN_ISDIR : 0);
+				changes.push_back(change);
+			}
+			else if(i == before.size() || after[j] < before[i])
+			{
+				const PollEntry& entry = after[j++];
+				change.mName = entry.mName;
+				change.mMask = IN_CREATE | (entry.mDirectory ? IN_ISDIR : 0);
+				added.push_back(change);
+			}
+			else
+			{
+				const PollEntry& old = before[i++];
+				const PollEntry& entry = after[j++];
+				change.mName = entry.mName;
+				if(old.mDirectory != entry.mDirectory)
+				{
+					change.mMask = IN_DELETE | (old.mDirectory ? IN_ISDIR : 0);
+					changes.push_back(change);
+					change.mMask = IN_CREATE | (entry.mDirectory ? IN_ISDIR : 0);
+					added.push_back(change);
+				}
+				else if(!entry.mDirectory && (old.mMTime != entry.mMTime || old.mSize != entry.mSize))
+				{
+					change.mMask = IN_CLOSE_WRITE;
+					added.push_back(change);
+				}
+			}
+		}
+		changes.insert(changes.end(), added.begin(), added.end());
+	}
+
+	//--------
+	static bool isDirectory(const String& path, const struct dirent* entry)
+	{
+		if(entry->d_type != DT_UNKNOWN)
+			return entry->d_type == DT_DIR;
+
+		struct stat attrib;
+		return lstat(path.c_str(), &attrib) == 0 && S_ISDIR(attrib.st_mode);
+	}
+
 	//--------
 	FileWatcherLinux::FileWatcherLinux()
+		: mLruHead(0), mLruTail(0), mWatchLimit(systemWatchLimit()), mPollInterval(POLL_INTERVAL),
+		mPolled(0), mStorms(0), mNested(0), mNow(monotonicMillis()), mPathCacheWatch(0), mLastWatchID(0), mRingReader(0),
+		mEventRing(0), mEventRingTag(0), mEventRingPending(false)
 	{
 		mFD = inotify_init();
 		if (mFD < 0)
 			fprintf (stderr, "Error: %s\n", strerror(errno));
+
+		mWakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 		
 		mTimeOut.tv_sec = 0;
 		mTimeOut.tv_usec = 0;
 	   		
 		FD_ZERO(&mDescriptorSet);
+
+		mBuffer = new char[BUFF_SIZE];
 	}
 
 	//--------
 	FileWatcherLinux::~FileWatcherLinux()
 	{
-		WatchMap::iterator iter = mWatches.begin();
-		WatchMap::iterator end = mWatches.end();
-		for(; iter != end; ++iter)
+		// the ring has to go first, it waits for the read into mBuffer
+		delete mRingReader;
+		mRingReader = 0;
+
+		// closing the descriptor drops every kernel watch at once
+		if(mFD >= 0)
+			close(mFD);
+		if(mWakeFD >= 0)
+			close(mWakeFD);
+		// a read the application did not cancel may still write to the
+		// buffer, it is left to it rather than freed
+		if(!mEventRingPending)
+			delete[] mBuffer;
+
+		// the trees go one by one, none is covered any more
+		mNested = 0;
+		while(!mRoots.empty())
 		{
-			delete iter->second;
+			WatchRoot* root = *mRoots.begin();
+			mRoots.erase(root->mWatchID);
+			if(root->mDir)
+				destroyTree(root->mDir, false);
+			delete root->mExclude;
+			delete root->mStorm;
+			delete root->mManifest;
+			mRootPool.destroy(root);
 		}
-		mWatches.clear();
+
+		for(size_t i = 0; i < mPollQueue.size(); ++i)
+			delete mPollQueue[i];
 	}
 
 	//--------
 	WatchID FileWatcherLinux::addWatch(const String& directory, FileWatchListener* watcher, bool recursive)
 	{
-		int wd = inotify_add_watch (mFD, directory.c_str(), 
-			IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM | IN_DELETE);
+		WatchOptions options;
+		options.recursive = recursive;
+		return addWatch(directory, watcher, options);
+	}
+
+	//--------
+	WatchID FileWatcherLinux::addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options)
+	{
+		int wd = addKernelWatch(directory, WATCH_MASK, 0);
 		if (wd < 0)
 		{
-			if(errno == ENOENT)
+			// out of kernel watches, the directory is polled instead
+			int error = errno;
+			struct stat attrib;
+			if(error == ENOSPC && stat(directory.c_str(), &attrib) != 0)
+				error = errno;
+
+			if(error == ENOENT)
 				throw FileNotFoundException(directory);
-			else
-				throw Exception(strerror(errno));
+			else if(error != ENOSPC)
+				throw Exception(strerror(error));
 
 //			fprintf (stderr, "Error: %s\n", strerror(errno));
 //			return -1;
 		}
-		
-		WatchStruct* pWatch = new WatchStruct();
-		pWatch->mListener = watcher;
-		pWatch->mWatchID = wd;
-		pWatch->mDirName = directory;
-		
-		mWatches.insert(std::make_pair(wd, pWatch));
+
+		WatchStruct* dir = wd >= 0 ? mWatches.find(wd) : 0;
+		if(dir)
+		{
+			// the watch whose tree covers the directory
+			WatchRoot* root = findRoot(dir);
+			while(!root->mRecursive && dir != root->mDir && root->mOuter)
+				root = root->mOuter;
+			return root->mWatchID;
+		}
+
+		dir = mWatchPool.create();
+		dir->mWD = wd;
+		dir->mName = mDirNames.intern(directory);
+		dir->mParent = 0;
+		dir->mFirstChild = 0;
+		dir->mNextSibling = 0;
+		dir->mPrevSibling = 0;
+		dir->mLastActive = 0;
+		dir->mPoll = 0;
+
+		WatchRoot* root = mRootPool.create();
+		root->mWatchID = ++mLastWatchID;
+		root->mListener = watcher;
+		root->mDir = dir;
+		root->mRecursive = options.recursive;
+		root->mMetadata = options.metadata;
+		root->mStorm = 0;
+		if(options.stormThreshold)
+		{
+			root->mStorm = new StormState();
+			unsigned long long threshold = options.stormThreshold;
+			root->mStorm->mWindow = std::max<unsigned long long>(STORM_WINDOW, (STORM_MIN_EVENTS * 1000ull + threshold - 1) / threshold);
+			root->mStorm->mLimit = (size_t)((threshold * root->mStorm->mWindow + 999) / 1000);
+			root->mStorm->mCooldown = options.stormCooldown;
+			root->mStorm->mWindowStart = mNow;
+			root->mStorm->mWindowEvents = 0;
+			root->mStorm->mLastBusy = 0;
+			root->mStorm->mActive = false;
+			root->mStorm->mRescan = false;
+		}
+		root->mExclude = compileRules(directory, options);
+		root->mManifest = options.manifest ? new FileManifest(*options.manifest) : 0;
+		root->mOuter = 0;
+		root->mAnchor = 0;
+		root->mQueue = mScheduler.addQueue(root->mWatchID, watcher, options);
+		dir->mRoot = root;
+		mRoots.insert(root->mWatchID, root);
+
+		if(wd >= 0)
+		{
+			mWatches.insert(wd, dir);
+			lruInsert(dir);
+		}
+		else
+		{
+			startPolling(dir);
+		}
+
+		if(options.recursive)
+		{
+			try
+			{
+				addChildren(dir, directory, false);
+			}
+			catch(...)
+			{
+				removeWatch(root->mWatchID);
+				throw;
+			}
+		}
 	
-		return wd;
+		return root->mWatchID;
 	}
 
 	//--------
 	void FileWatcherLinux::removeWatch(const String& directory)
 	{
-		WatchMap::iterator iter = mWatches.begin();
-		WatchMap::iterator end = mWatches.end();
+		RootMap::const_iterator iter = mRoots.begin();
+		RootMap::const_iterator end = mRoots.end();
 		for(; iter != end; ++iter)
 		{
-			if(directory == iter->second->mDirName)
+			if((*iter)->mDir && directory == *(*iter)->mDir->mName)
 			{
-				removeWatch(iter->first);
+				removeWatch(iter.key());
 				return;
 			}
 		}
@@ -115,70 +615,1338 @@ namespace FW
 	//--------
 	void FileWatcherLinux::removeWatch(WatchID watchid)
 	{
-		WatchMap::iterator iter = mWatches.find(watchid);
+		WatchRoot* root = mRoots.erase(watchid);
 
-		if(iter == mWatches.end())
+		if(!root)
 			return;
 
-		WatchStruct* watch = iter->second;
-		mWatches.erase(iter);
-	
-		inotify_rm_watch(mFD, watchid);
-		
-		delete watch;
-		watch = 0;
+		if(root->mOuter)
+		{
+			// the watches inside move on to the one around it
+			RootMap::const_iterator iter = mRoots.begin();
+			RootMap::const_iterator end = mRoots.end();
+			for(; iter != end; ++iter)
+			{
+				if((*iter)->mOuter == root)
+					(*iter)->mOuter = root->mOuter;
+			}
+			--mNested;
+
+			// which keeps the tree as part of its own
+			WatchStruct* dir = root->mDir;
+			if(dir)
+			{
+				String path = *dir->mName;
+				while(path.size() > 1 && path[path.size() - 1] == '/')
+					path.erase(path.size() - 1);
+				const String* interned = mDirNames.intern(path.substr(path.rfind('/') + 1));
+				mDirNames.release(dir->mName);
+				dir->mName = interned;
+				dir->mRoot = 0;
+				linkChild(root->mAnchor, dir);
+				mPathCacheWatch = 0;
+			}
+		}
+		else if(root->mDir)
+		{
+			destroyTree(root->mDir, true);
+		}
+
+		mScheduler.removeQueue(root->mQueue);
+		delete root->mExclude;
+		if(root->mStorm && root->mStorm->mActive)
+			--mStorms;
+		delete root->mStorm;
+		delete root->mManifest;
+		mRootPool.destroy(root);
 	}
 
 	//--------
-	void FileWatcherLinux::update()
+	WatchStruct* FileWatcherLinux::createWatch(const String& path, WatchStruct* parent, const String& name, unsigned long long activity)
 	{
-		FD_SET(mFD, &mDescriptorSet);
+		int wd = addKernelWatch(path, WATCH_MASK | IN_ONLYDIR | IN_DONT_FOLLOW, activity);
+		if(wd < 0 && errno != ENOSPC)
+			return 0;
+
+		// already covered, e.g. the root of another watch
+		WatchStruct* existing = wd >= 0 ? mWatches.find(wd) : 0;
+		if(existing)
+		{
+			if(existing->mRoot && existing->mRoot->mAnchor != parent)
+				nestRoot(existing->mRoot, parent);
+			errno = EEXIST;
+			return 0;
+		}
 
-		int ret = select(mFD + 1, &mDescriptorSet, NULL, NULL, &mTimeOut);
-		if(ret < 0)
+		WatchStruct* watch = mWatchPool.create();
+		watch->mWD = wd;
+		watch->mName = mDirNames.intern(name);
+		watch->mFirstChild = 0;
+		watch->mRoot = 0;
+		watch->mLastActive = activity;
+		watch->mPoll = 0;
+		linkChild(parent, watch);
+
+		if(wd >= 0)
 		{
-			perror("select");
+			mWatches.insert(wd, watch);
+			lruInsert(watch);
 		}
-		else if(FD_ISSET(mFD, &mDescriptorSet))
+		else
 		{
-			ssize_t len, i = 0;
-			char action[81+FILENAME_MAX] = {0};
-			char buff[BUFF_SIZE] = {0};
+			startPolling(watch);
+		}
+		return watch;
+	}
 
-			len = read (mFD, buff, BUFF_SIZE);
-		   
-			while (i < len)
+	//--------
+	int FileWatcherLinux::addKernelWatch(const String& path, unsigned int mask, unsigned long long activity)
+	{
+		while(true)
+		{
+			if(mWatches.size() >= mWatchLimit && !evictColdest(activity))
 			{
-				struct inotify_event *pevent = (struct inotify_event *)&buff[i];
+				errno = ENOSPC;
+				return -1;
+			}
+
+			int wd = inotify_add_watch(mFD, path.c_str(), mask);
+			if(wd >= 0 || errno != ENOSPC)
+				return wd;
+
+			// other processes use part of the per user limit, settle for
+			// what we hold
+			mWatchLimit = mWatches.size();
+			if(mWatchLimit == 0)
+				return -1;
+		}
+	}
+
+	//--------
+	bool FileWatcherLinux::evictColdest(unsigned long long activity)
+	{
+		WatchStruct* coldest = mLruTail;
+		if(!coldest || coldest->mLastActive >= activity)
+			return false;
+
+		evictWatch(coldest);
+		return true;
+	}
+
+	//--------
+	void FileWatcherLinux::evictWatch(WatchStruct* watch)
+	{
+		// list first, so changes made before the watch goes are either in
+		// the listing or already queued by the kernel
+		startPolling(watch);
+
+		inotify_rm_watch(mFD, watch->mWD);
+		mWatches.erase(watch->mWD);
+		// events queued before the removal still arrive until IN_IGNORED
+		mRetired.insert(watch->mWD, watch);
+		lruRemove(watch);
+		watch->mWD = -1;
+	}
+
+	//--------
+	void FileWatcherLinux::startPolling(WatchStruct* watch)
+	{
+		PollState* state = new PollState();
+		state->mWatch = watch;
+		state->mNextPoll = mNow + mPollInterval;
+		scanDirectory(getPath(watch), state->mEntries);
+
+		watch->mPoll = state;
+		mPollQueue.push_back(state);
+		++mPolled;
+	}
+
+	//--------
+	bool FileWatcherLinux::promoteWatch(WatchStruct* watch)
+	{
+		watch->mLastActive = mNow;
+
+		// a copy, evicting another directory rebuilds the path cache
+		String path = getPath(watch);
+		int wd = addKernelWatch(path, WATCH_MASK | IN_ONLYDIR | IN_DONT_FOLLOW, mNow);
+		if(wd < 0 || mWatches.find(wd))
+			return false;
+
+		watch->mWD = wd;
+		mWatches.insert(wd, watch);
+		lruInsert(watch);
+
+		// the state is freed by pollDirectories
+		watch->mPoll->mWatch = 0;
+		watch->mPoll = 0;
+		--mPolled;
+		return true;
+	}
+
+	//--------
+	void FileWatcherLinux::pollDirectories()
+	{
+		for(int count = 0; count < POLL_BATCH && !mPollQueue.empty(); ++count)
+		{
+			PollState* state = mPollQueue.front();
+			if(state->mWatch && state->mNextPoll > mNow)
+				break;
+
+			mPollQueue.pop_front();
+			if(state->mWatch)
+				pollDirectory(state);
 
-				WatchStruct* watch = mWatches[pevent->wd];
-				handleAction(watch, pevent->name, pevent->mask);
-				i += sizeof(struct inotify_event) + pevent->len;
+			if(state->mWatch)
+			{
+				state->mNextPoll = mNow + mPollInterval;
+				mPollQueue.push_back(state);
+			}
+			else
+			{
+				delete state;
 			}
 		}
+
+		flushHeldEvents();
 	}
 
 	//--------
-	void FileWatcherLinux::handleAction(WatchStruct* watch, const String& filename, unsigned long action)
+	void FileWatcherLinux::pollDirectory(PollState* state)
 	{
-		if(!watch->mListener)
+		WatchStruct* watch = state->mWatch;
+		String path = getPath(watch);
+
+		std::vector<PollEntry> entries;
+		if(!scanDirectory(path, entries))
+		{
+			// gone, its parent reports the delete
+			if(errno == ENOENT || errno == ENOTDIR)
+				destroyTree(watch, true);
 			return;
+		}
 
-		if(IN_CLOSE_WRITE & action)
+		std::vector<PollChange> changes;
+		diffEntries(state->mEntries, entries, changes);
+		if(changes.empty())
+			return;
+
+		// active again. Changes after the kernel watch is back in place show
+		// up in the kernel events and possibly in the second listing, but
+		// none get lost
+		int wd = -1;
+		if(promoteWatch(watch))
 		{
-			watch->mListener->handleFileAction(watch->mWatchID, watch->mDirName, filename,
-								Actions::Modified);
+			wd = watch->mWD;
+			std::vector<PollEntry> current;
+			if(scanDirectory(path, current))
+			{
+				changes.clear();
+				diffEntries(state->mEntries, current, changes);
+			}
 		}
-		if(IN_MOVED_TO & action || IN_CREATE & action)
+		state->mEntries.swap(entries);
+
+		bool recursive = isCrawled(findRoot(watch));
+		for(size_t i = 0; i < changes.size(); ++i)
 		{
-			watch->mListener->handleFileAction(watch->mWatchID, watch->mDirName, filename,
-								Actions::Add);
+			// the listener may have removed the watch
+			if(wd < 0 ? state->mWatch != watch : mWatches.find(wd) != watch)
+				return;
+
+			const PollChange& change = changes[i];
+			handleAction(watch, change.mName, change.mMask);
+
+			if(wd < 0 ? state->mWatch != watch : mWatches.find(wd) != watch)
+				return;
+			if(!recursive || !(change.mMask & IN_ISDIR))
+				continue;
+
+			if(change.mMask & IN_CREATE)
+			{
+				handleDirectoryAction(watch, change.mName, IN_CREATE, 0);
+				continue;
+			}
+
+			const String* interned = mDirNames.find(change.mName);
+			for(WatchStruct* child = watch->mFirstChild; interned && child; child = child->mNextSibling)
+			{
+				if(child->mName == interned)
+				{
+					destroyTree(child, true);
+					break;
+				}
+			}
 		}
-		if(IN_MOVED_FROM & action || IN_DELETE & action)
+	}
+
+	//--------
+	void FileWatcherLinux::touch(WatchStruct* watch)
+	{
+		watch->mLastActive = mNow;
+		if(watch->mWD >= 0 && watch != mLruHead)
+		{
+			lruRemove(watch);
+			lruInsert(watch);
+		}
+	}
+
+	//--------
+	void FileWatcherLinux::lruInsert(WatchStruct* watch)
+	{
+		// directories that never changed queue up at the cold end
+		if(watch->mLastActive)
+		{
+			watch->mLruPrev = 0;
+			watch->mLruNext = mLruHead;
+			if(mLruHead)
+				mLruHead->mLruPrev = watch;
+			else
+				mLruTail = watch;
+			mLruHead = watch;
+		}
+		else
 		{
-			watch->mListener->handleFileAction(watch->mWatchID, watch->mDirName, filename,
-								Actions::Delete);
+			watch->mLruNext = 0;
+			watch->mLruPrev = mLruTail;
+			if(mLruTail)
+				mLruTail->mLruNext = watch;
+			else
+				mLruHead = watch;
+			mLruTail = watch;
+		}
+	}
+
+	//--------
+	void FileWatcherLinux::lruRemove(WatchStruct* watch)
+	{
+		if(watch->mLruPrev)
+			watch->mLruPrev->mLruNext = watch->mLruNext;
+		else
+			mLruHead = watch->mLruNext;
+		if(watch->mLruNext)
+			watch->mLruNext->mLruPrev = watch->mLruPrev;
+		else
+			mLruTail = watch->mLruPrev;
+
+		watch->mLruPrev = 0;
+		watch->mLruNext = 0;
+	}
+
+	//--------
+	bool FileWatcherLinux::setWatchLimit(size_t watches, unsigned int pollInterval)
+	{
+		mWatchLimit = watches ? watches : systemWatchLimit();
+		mPollInterval = pollInterval;
+
+		while(mWatches.size() > mWatchLimit && evictColdest((unsigned long long)-1))
+			;
+		return true;
+	}
+
+	//--------
+	void FileWatcherLinux::addChildren(WatchStruct* watch, const String& path, bool emitEvents)
+	{
+		const ExcludeRules* rules = findRoot(watch)->mExclude;
+		const FileManifest* manifest = findRoot(watch)->mManifest;
+
+		std::vector<std::pair<WatchStruct*, String> > pending;
+		pending.push_back(std::make_pair(watch, path));
+
+		while(!pending.empty())
+		{
+			WatchStruct* dir = pending.back().first;
+			String dirPath;
+			dirPath.swap(pending.back().second);
+			pending.pop_back();
+
+			DIR* handle = opendir(dirPath.c_str());
+			if(!handle)
+				continue;
+
+			String relative;
+			if(rules)
+			{
+				relative = relativePath(dir);
+				if(!relative.empty())
+					relative += '/';
+			}
+
+			struct dirent* entry;
+			while((entry = readdir(handle)) != NULL)
+			{
+				if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+					continue;
+
+				String name(entry->d_name);
+				String childPath = joinPath(dirPath, name);
+				bool directory = isDirectory(childPath, entry);
+
+				// excluded subtrees are never crawled or watched
+				if(rules && rules->excluded(relative + name, directory))
+					continue;
+				// and neither are the ones without listed files
+				if(manifest && directory && !manifest->covers(childPath))
+					continue;
+
+				// entries created before the watch was in place would be lost otherwise
+				if(emitEvents)
+					handleAction(dir, name, IN_CREATE | (directory ? IN_ISDIR : 0));
+
+				if(!directory)
+					continue;
+
+				WatchStruct* child = createWatch(childPath, dir, name, 0);
+				if(child)
+				{
+					pending.push_back(std::make_pair(child, childPath));
+				}
+				else if(errno != ENOENT && errno != ENOTDIR && errno != EACCES && errno != EEXIST)
+				{
+					int error = errno;
+					closedir(handle);
+					throw Exception(strerror(error));
+				}
+			}
+
+			closedir(handle);
+		}
+	}
+
+	//--------
+	void FileWatcherLinux::destroyTree(WatchStruct* watch, bool removeKernelWatch)
+	{
+		unlinkChild(watch);
+		if(watch->mRoot)
+			watch->mRoot->mDir = 0;
+
+		std::vector<WatchStruct*> pending(1, watch);
+		std::vector<WatchRoot*> uncovered;
+		while(!pending.empty())
+		{
+			WatchStruct* dir = pending.back();
+			pending.pop_back();
+
+			for(WatchStruct* child = dir->mFirstChild; child; child = child->mNextSibling)
+				pending.push_back(child);
+
+			if(mNested)
+			{
+				RootMap::const_iterator iter = mRoots.begin();
+				RootMap::const_iterator end = mRoots.end();
+				for(; iter != end; ++iter)
+				{
+					if((*iter)->mAnchor == dir)
+						uncovered.push_back(*iter);
+				}
+			}
+
+			if(dir->mWD >= 0)
+			{
+				if(removeKernelWatch)
+					inotify_rm_watch(mFD, dir->mWD);
+				mWatches.erase(dir->mWD);
+				lruRemove(dir);
+			}
+			if(dir->mPoll)
+			{
+				// freed when it comes up in the poll queue
+				dir->mPoll->mWatch = 0;
+				--mPolled;
+			}
+			if(!mRetired.empty())
+			{
+				std::vector<WatchID> retired;
+				for(WatchMap::const_iterator iter = mRetired.begin(); iter != mRetired.end(); ++iter)
+				{
+					if(*iter == dir)
+						retired.push_back(iter.key());
+				}
+				for(size_t i = 0; i < retired.size(); ++i)
+					mRetired.erase(retired[i]);
+			}
+
+			if(dir == mPathCacheWatch)
+				mPathCacheWatch = 0;
+			for(size_t i = 0; i < mPendingMoves.size(); ++i)
+			{
+				if(mPendingMoves[i].mWatch == dir)
+					mPendingMoves.erase(mPendingMoves.begin() + i--);
+			}
+
+			mDirNames.release(dir->mName);
+			mWatchPool.destroy(dir);
+		}
+
+		for(size_t i = 0; i < uncovered.size(); ++i)
+		{
+			// possibly uncovered along with another one already
+			if(uncovered[i]->mOuter)
+				uncoverRoot(uncovered[i]);
+		}
+	}
+
+	//--------
+	void FileWatcherLinux::nestRoot(WatchRoot* root, WatchStruct* anchor)
+	{
+		// directory loops through bind mounts
+		WatchRoot* outer = findRoot(anchor);
+		for(WatchRoot* iter = outer; iter; iter = iter->mOuter)
+		{
+			if(iter == root)
+				return;
+		}
+
+		bool crawled = isCrawled(root);
+		if(!root->mOuter)
+			++mNested;
+		root->mOuter = outer;
+		root->mAnchor = anchor;
+		if(crawled || !root->mDir)
+			return;
+
+		// the outer watch sees the whole tree, a flat one is crawled for it
+		try
+		{
+			addChildren(root->mDir, *root->mDir->mName, false);
+		}
+		catch(const Exception& e)
+		{
+			fprintf (stderr, "Error: %s\n", e.what());
+		}
+	}
+
+	//--------
+	void FileWatcherLinux::uncoverRoot(WatchRoot* root)
+	{
+		root->mOuter = 0;
+		root->mAnchor = 0;
+		--mNested;
+		if(root->mRecursive || !root->mDir)
+			return;
+
+		// a flat watch again. The roots anchored below its directory are
+		// uncovered with the subtrees, the ones right in it are left
+		while(root->mDir && root->mDir->mFirstChild)
+			destroyTree(root->mDir->mFirstChild, true);
+
+		std::vector<WatchRoot*> inner;
+		RootMap::const_iterator iter = mRoots.begin();
+		RootMap::const_iterator end = mRoots.end();
+		for(; iter != end; ++iter)
+		{
+			if((*iter)->mOuter == root)
+				inner.push_back(*iter);
+		}
+		for(size_t i = 0; i < inner.size(); ++i)
+			uncoverRoot(inner[i]);
+	}
+
+	//--------
+	void FileWatcherLinux::handleDirectoryAction(WatchStruct* watch, const String& name, unsigned long action, unsigned int cookie)
+	{
+		if(action & IN_MOVED_FROM)
+		{
+			const String* interned = mDirNames.find(name);
+			if(!interned)
+				return;
+
+			for(WatchStruct* child = watch->mFirstChild; child; child = child->mNextSibling)
+			{
+				if(child->mName == interned)
+				{
+					PendingMove move = { cookie, child, 0 };
+					mPendingMoves.push_back(move);
+					return;
+				}
+			}
+		}
+		else if(action & (IN_CREATE | IN_MOVED_TO))
+		{
+			bool excluded = isExcluded(watch, name, true) || !isListed(watch, name, true);
+
+			if(action & IN_MOVED_TO)
+			{
+				for(size_t i = 0; i < mPendingMoves.size(); ++i)
+				{
+					if(mPendingMoves[i].mCookie != cookie)
+						continue;
+
+					// a rename inside the watched tree only relinks the node,
+					// the kernel watches below it stay valid
+					WatchStruct* moved = mPendingMoves[i].mWatch;
+					mPendingMoves.erase(mPendingMoves.begin() + i);
+
+					// renamed to an excluded name
+					if(excluded)
+					{
+						destroyTree(moved, true);
+						return;
+					}
+
+					const String* interned = mDirNames.intern(name);
+					mDirNames.release(moved->mName);
+					moved->mName = interned;
+					unlinkChild(moved);
+					linkChild(watch, moved);
+					mPathCacheWatch = 0;
+					return;
+				}
+			}
+
+			if(excluded)
+				return;
+
+			String path = joinPath(getPath(watch), name);
+			WatchStruct* child = createWatch(path, watch, name, mNow);
+			if(!child)
+			{
+				if(errno != ENOENT && errno != ENOTDIR && errno != EEXIST)
+					fprintf (stderr, "Error: %s\n", strerror(errno));
+				return;
+			}
+
+			try
+			{
+				addChildren(child, path, true);
+			}
+			catch(const Exception& e)
+			{
+				fprintf (stderr, "Error: %s\n", e.what());
+			}
+		}
+	}
+
+	//--------
+	bool FileWatcherLinux::isListed(WatchStruct* watch, const String& name, bool directory)
+	{
+		const FileManifest* manifest = findRoot(watch)->mManifest;
+		if(!manifest)
+			return true;
+
+		if(directory)
+			return manifest->covers(joinPath(getPath(watch), name));
+		return manifest->contains(getPath(watch), name);
+	}
+
+	//--------
+	bool FileWatcherLinux::updateManifest(WatchID watchid, const std::vector<String>& added, const std::vector<String>& removed)
+	{
+		WatchRoot* root = mRoots.find(watchid);
+		if(!root || !root->mManifest || !root->mDir)
+			return false;
+
+		for(size_t i = 0; i < removed.size(); ++i)
+		{
+			if(root->mManifest->remove(removed[i]) && root->mRecursive)
+				syncManifest(root, removed[i]);
+		}
+
+		String prefix = joinPath(*root->mDir->mName, "");
+		bool inside = true;
+		for(size_t i = 0; i < added.size(); ++i)
+		{
+			if(added[i].compare(0, prefix.size(), prefix) != 0)
+			{
+				inside = false;
+				continue;
+			}
+			if(root->mManifest->add(added[i]) && root->mRecursive)
+				syncManifest(root, added[i]);
+		}
+		return inside;
+	}
+
+	//--------
+	void FileWatcherLinux::syncManifest(WatchRoot* root, const String& file)
+	{
+		String path = *root->mDir->mName;
+		String prefix = joinPath(path, "");
+		if(file.compare(0, prefix.size(), prefix) != 0)
+			return;
+
+		WatchStruct* watch = root->mDir;
+		size_t start = prefix.size();
+		size_t slash;
+		while((slash = file.find('/', start)) != String::npos)
+		{
+			String name = file.substr(start, slash - start);
+			String childPath = joinPath(path, name);
+			start = slash + 1;
+
+			WatchStruct* child = 0;
+			const String* interned = mDirNames.find(name);
+			for(WatchStruct* iter = watch->mFirstChild; interned && iter; iter = iter->mNextSibling)
+			{
+				if(iter->mName == interned)
+				{
+					child = iter;
+					break;
+				}
+			}
+
+			bool covered = root->mManifest->covers(childPath) && !isExcluded(watch, name, true);
+			if(child && !covered)
+			{
+				destroyTree(child, true);
+				return;
+			}
+			if(!child)
+			{
+				// the directory is crawled as a whole, or watched once created
+				if(covered && (child = createWatch(childPath, watch, name, mNow)))
+					addChildren(child, childPath, false);
+				return;
+			}
+
+			watch = child;
+			path.swap(childPath);
+		}
+	}
+
+	//--------
+	void FileWatcherLinux::expirePendingMoves()
+	{
+		for(size_t i = 0; i < mPendingMoves.size(); ++i)
+			++mPendingMoves[i].mAge;
+
+		// unmatched for a whole update, the directory left the watched tree
+		for(size_t i = 0; i < mPendingMoves.size();)
+		{
+			if(mPendingMoves[i].mAge > 1)
+			{
+				WatchStruct* moved = mPendingMoves[i].mWatch;
+				mPendingMoves.erase(mPendingMoves.begin() + i);
+				destroyTree(moved, true);
+				i = 0;
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	//--------
+	const String& FileWatcherLinux::getPath(const WatchStruct* watch)
+	{
+		if(watch == mPathCacheWatch)
+			return mPathCache;
+
+		size_t length = 0;
+		const WatchStruct* dir = watch;
+		for(; dir->mParent; dir = dir->mParent)
+			length += dir->mName->size() + 1;
+
+		const String& base = *dir->mName;
+		length += base.size();
+		if(length > base.size() && !base.empty() && base[base.size() - 1] == '/')
+			--length;
+
+		mPathCache.resize(length);
+		size_t pos = length;
+		for(dir = watch; dir->mParent; dir = dir->mParent)
+		{
+			pos -= dir->mName->size();
+			mPathCache.replace(pos, dir->mName->size(), *dir->mName);
+			mPathCache[--pos] = '/';
+		}
+		mPathCache.replace(0, base.size(), base);
+
+		mPathCacheWatch = watch;
+		return mPathCache;
+	}
+
+	//--------
+	void FileWatcherLinux::update()
+	{
+		mNow = monotonicMillis();
+
+		if(mEventRing)
+		{
+			// reads complete through completeRead
+			submitRingRead();
+		}
+		else if(mRingReader)
+		{
+			int result;
+			if(mRingReader->poll(result))
+			{
+				if(result > 0)
+					processEvents(mBuffer, result);
+				else if(result < 0 && result != -EINTR && result != -EAGAIN && result != -ECANCELED)
+				{
+					fprintf (stderr, "Error: io_uring read: %s\n", strerror(-result));
+					delete mRingReader;
+					mRingReader = 0;
+				}
+			}
+
+			if(mRingReader && !mRingReader->submit())
+			{
+				// continue with select on the next update
+				perror("io_uring_enter");
+				delete mRingReader;
+				mRingReader = 0;
+			}
+		}
+		else
+		{
+			FD_SET(mFD, &mDescriptorSet);
+
+			int ret = select(mFD + 1, &mDescriptorSet, NULL, NULL, &mTimeOut);
+			if(ret < 0)
+			{
+				perror("select");
+			}
+			else if(FD_ISSET(mFD, &mDescriptorSet))
+			{
+				ssize_t len = read (mFD, mBuffer, BUFF_SIZE);
+				processEvents(mBuffer, len);
+			}
+		}
+
+		pollDirectories();
+		expirePendingMoves();
+		updateStorms();
+		mScheduler.dispatch();
+	}
+
+	//--------
+	void FileWatcherLinux::processEvents(const char* buffer, ssize_t length)
+	{
+		ssize_t i = 0;
+		while (i < length)
+		{
+			const struct inotify_event *pevent = (const struct inotify_event *)&buffer[i];
+			i += sizeof(struct inotify_event) + pevent->len;
+
+			if(pevent->mask & IN_Q_OVERFLOW)
+			{
+				handleOverflow();
+				continue;
+			}
+
+			// events can still arrive for a watch that was just removed
+			WatchStruct* watch = mWatches.find(pevent->wd);
+			if(!watch)
+			{
+				// or for one that was evicted, those are still reported
+				watch = mRetired.find(pevent->wd);
+				if(!watch)
+					continue;
+				if(pevent->mask & IN_IGNORED)
+				{
+					mRetired.erase(pevent->wd);
+					continue;
+				}
+			}
+			else if(pevent->mask & IN_IGNORED)
+			{
+				// the kernel dropped the watch because the directory is gone
+				destroyTree(watch, true);
+				continue;
+			}
+
+			touch(watch);
+
+			const char* name = pevent->len ? pevent->name : "";
+			handleAction(watch, name, pevent->mask);
+
+			// the listener may have removed the watch
+			watch = mWatches.find(pevent->wd);
+			if(!watch)
+				watch = mRetired.find(pevent->wd);
+			if(watch && (pevent->mask & IN_ISDIR) && isCrawled(findRoot(watch)))
+				handleDirectoryAction(watch, name, pevent->mask, pevent->cookie);
+		}
+
+		flushHeldEvents();
+	}
+
+	//--------
+	bool FileWatcherLinux::setEventReader(EventReader reader)
+	{
+		if(reader == EventReaders::IoUring)
+		{
+			if(mRingReader)
+				return true;
+
+			IoUringReader* ringReader = new IoUringReader();
+			if(!ringReader->init(mFD, mBuffer, BUFF_SIZE) || !ringReader->submit())
+			{
+				delete ringReader;
+				return false;
+			}
+
+			mRingReader = ringReader;
+			return true;
+		}
+
+		if(mRingReader)
+		{
+			// the read in flight may already have taken events
+			int result;
+			if(mRingReader->cancel(result) && result > 0)
+			{
+				mNow = monotonicMillis();
+				processEvents(mBuffer, result);
+			}
+
+			delete mRingReader;
+			mRingReader = 0;
+		}
+		return reader == EventReaders::Default;
+	}
+
+	//--------
+	bool FileWatcherLinux::setEventRing(EventRing* ring, unsigned long long tag)
+	{
+		// the queued read still owns mBuffer
+		if(mEventRingPending && ring != mEventRing)
+			return false;
+
+		if(ring && mRingReader)
+			setEventReader(EventReaders::Default);
+
+		mEventRing = ring;
+		mEventRingTag = tag;
+		submitRingRead();
+		return true;
+	}
+
+	//--------
+	void FileWatcherLinux::completeRead(int result)
+	{
+		mEventRingPending = false;
+		mNow = monotonicMillis();
+
+		if(result > 0)
+			processEvents(mBuffer, result);
+		else if(result < 0 && result != -EINTR && result != -EAGAIN && result != -ECANCELED)
+			fprintf (stderr, "Error: %s\n", strerror(-result));
+
+		expirePendingMoves();
+		updateStorms();
+		mScheduler.dispatch();
+
+		// a cancelled read means the application is detaching
+		if(result != -ECANCELED)
+			submitRingRead();
+	}
+
+	//--------
+	int FileWatcherLinux::wait(int timeout)
+	{
+		// reads in flight on a ring take the events before poll sees them
+		if(mRingReader || mEventRing || mFD < 0 || mWakeFD < 0)
+			return -1;
+
+		// rate limited events and polled directories fall due on their own
+		if(mScheduler.pending() && (timeout < 0 || timeout > 1))
+			timeout = 1;
+		// storms end after a quiet spell, which no descriptor signals
+		if(mStorms && (timeout < 0 || timeout > STORM_WINDOW))
+			timeout = STORM_WINDOW;
+		if(!mPollQueue.empty())
+		{
+			unsigned long long now = monotonicMillis();
+			unsigned long long due = mPollQueue.front()->mNextPoll;
+			int left = due > now ? (int)std::min<unsigned long long>(due - now, 0x7fffffff) : 0;
+			if(timeout < 0 || left < timeout)
+				timeout = left;
+		}
+
+		struct pollfd fds[2];
+		fds[0].fd = mFD;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = mWakeFD;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+
+		if(poll(fds, 2, timeout) <= 0)
+			return 0;
+
+		if(fds[1].revents & POLLIN)
+		{
+			eventfd_t value;
+			eventfd_read(mWakeFD, &value);
+		}
+		return (fds[0].revents & POLLIN) ? 1 : 0;
+	}
+
+	//--------
+	void FileWatcherLinux::wake()
+	{
+		if(mWakeFD >= 0)
+			eventfd_write(mWakeFD, 1);
+	}
+
+	//--------
+	FileWatchListener* FileWatcherLinux::swapListener(WatchID watchid, FileWatchListener* listener, String& directory)
+	{
+		WatchRoot* root = mRoots.find(watchid);
+		if(!root)
+			return 0;
+
+		FileWatchListener* previous = root->mListener;
+		root->mListener = listener;
+		mScheduler.setListener(root->mQueue, listener);
+		if(root->mDir)
+			directory = *root->mDir->mName;
+		return previous;
+	}
+
+	//--------
+	void FileWatcherLinux::submitRingRead()
+	{
+		if(mEventRing && !mEventRingPending)
+			mEventRingPending = mEventRing->submitRead(mFD, mBuffer, BUFF_SIZE, mEventRingTag);
+	}
+
+	//--------
+	void FileWatcherLinux::handleAction(WatchStruct* watch, const String& filename, unsigned long action)
+	{
+		WatchRoot* root = findRoot(watch);
+		if(root->mOuter)
+		{
+			handleNestedAction(root, watch, filename, action);
+			return;
+		}
+		if(!root->mListener || !(action & WATCH_MASK))
+			return;
+
+		if(root->mExclude && isExcluded(watch, filename, (action & IN_ISDIR) != 0))
+			return;
+		// directories only matter for reaching the listed files
+		if(root->mManifest && ((action & IN_ISDIR) || !root->mManifest->contains(getPath(watch), filename)))
+			return;
+
+		dispatchEvent(root, getPath(watch), filename, action);
+	}
+
+	//--------
+	void FileWatcherLinux::handleNestedAction(WatchRoot* root, WatchStruct* watch, const String& filename, unsigned long action)
+	{
+		if(!(action & WATCH_MASK))
+			return;
+
+		bool directory = (action & IN_ISDIR) != 0;
+		String dir = getPath(watch);
+
+		// the watches around root see the directory as part of their trees
+		std::vector<WatchID> watchids;
+		for(WatchRoot* iter = root; iter; iter = iter->mOuter)
+		{
+			if(!iter->mListener || (!iter->mRecursive && watch != iter->mDir))
+				continue;
+			if(iter->mExclude && isExcludedFrom(iter, dir, filename, directory))
+				continue;
+			if(iter->mManifest && (directory || !iter->mManifest->contains(dir, filename)))
+				continue;
+			watchids.push_back(iter->mWatchID);
+		}
+
+		for(size_t i = 0; i < watchids.size(); ++i)
+		{
+			// the listener may have removed the watch
+			WatchRoot* target = mRoots.find(watchids[i]);
+			if(target && target->mListener)
+				dispatchEvent(target, dir, filename, action);
+		}
+	}
+
+	//--------
+	void FileWatcherLinux::dispatchEvent(WatchRoot* root, const String& dir, const String& filename, unsigned long action)
+	{
+		FileInfo info;
+		info.type = (action & IN_ISDIR) ? FileTypes::Directory : FileTypes::File;
+
+		if(IN_CLOSE_WRITE & action)
+			dispatchAction(root, dir, filename, Actions::Modified, info);
+		if(IN_MOVED_TO & action || IN_CREATE & action)
+			dispatchAction(root, dir, filename, Actions::Add, info);
+		if(IN_MOVED_FROM & action || IN_DELETE & action)
+			dispatchAction(root, dir, filename, Actions::Delete, info);
+	}
+
+	//--------
+	void FileWatcherLinux::dispatchAction(WatchRoot* root, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		if(root->mStorm && !isDirectoryAction(action) && collapseStorm(root, dir, filename, action))
+			return;
+
+		// later events queue up behind held ones to keep the order
+		if(!root->mMetadata && mHeldEvents.empty())
+		{
+			deliverAction(root, dir, filename, action, info);
+			return;
+		}
+
+		HeldEvent event;
+		event.mWatchID = root->mWatchID;
+		event.mDir = dir;
+		event.mFilename = filename;
+		event.mAction = action;
+		event.mInfo = info;
+		event.mInspect = root->mMetadata && action != Actions::Delete && !isDirectoryAction(action);
+		mHeldEvents.push_back(event);
+	}
+
+	//--------
+	void FileWatcherLinux::deliverAction(WatchRoot* root, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		// dispatched by priority at the end of the update
+		if(mScheduler.isActive())
+			mScheduler.push(root->mQueue, dir, filename, action, info);
+		else
+			root->mListener->handleFileEvent(root->mWatchID, dir, filename, action, info);
+	}
+
+	//--------
+	void FileWatcherLinux::flushHeldEvents()
+	{
+		if(mHeldEvents.empty())
+			return;
+
+		std::vector<HeldEvent> events;
+		events.swap(mHeldEvents);
+
+		// visit the entries one directory at a time, so each directory is
+		// looked up once and the names are resolved relative to it
+		std::vector<size_t> order;
+		for(size_t i = 0; i < events.size(); ++i)
+		{
+			if(events[i].mInspect && !events[i].mFilename.empty())
+				order.push_back(i);
+		}
+		std::stable_sort(order.begin(), order.end(), [&events](size_t a, size_t b) {
+			return events[a].mDir < events[b].mDir;
+		});
+
+		int dirfd = -1;
+		const String* current = 0;
+		for(size_t i = 0; i < order.size(); ++i)
+		{
+			HeldEvent& event = events[order[i]];
+			if(!current || *current != event.mDir)
+			{
+				if(dirfd >= 0)
+					close(dirfd);
+				dirfd = open(event.mDir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+				current = &event.mDir;
+			}
+
+			if(dirfd >= 0)
+				inspectEntry(dirfd, event.mFilename, event.mInfo);
+		}
+		if(dirfd >= 0)
+			close(dirfd);
+
+		for(size_t i = 0; i < events.size(); ++i)
+		{
+			// the listener may have removed the watch
+			const HeldEvent& event = events[i];
+			WatchRoot* root = mRoots.find(event.mWatchID);
+			if(root && root->mListener)
+				deliverAction(root, event.mDir, event.mFilename, event.mAction, event.mInfo);
+		}
+	}
+
+	//--------
+	void FileWatcherLinux::handleOverflow()
+	{
+		// the kernel dropped events, every watch has to rescan
+		std::vector<WatchID> watchids;
+		RootMap::const_iterator iter = mRoots.begin();
+		RootMap::const_iterator end = mRoots.end();
+		for(; iter != end; ++iter)
+			watchids.push_back(iter.key());
+
+		for(size_t i = 0; i < watchids.size(); ++i)
+		{
+			// a listener may remove watches while we go
+			WatchRoot* root = mRoots.find(watchids[i]);
+			if(root && root->mDir && root->mListener)
+				dispatchAction(root, *root->mDir->mName, "", Actions::Overflow, FileInfo());
+		}
+	}
+
+	//--------
+	bool FileWatcherLinux::collapseStorm(WatchRoot* root, const String& dir, const String& filename, Action action)
+	{
+		StormState* storm = root->mStorm;
+		if(storm->mRescan)
+			return false;
+
+		if(mNow >= storm->mWindowStart + storm->mWindow)
+		{
+			storm->mWindowStart = mNow;
+			storm->mWindowEvents = 0;
+		}
+
+		if(++storm->mWindowEvents >= storm->mLimit)
+		{
+			storm->mLastBusy = mNow;
+			if(!storm->mActive)
+			{
+				storm->mActive = true;
+				++mStorms;
+				if(root->mDir)
+					dispatchAction(root, *root->mDir->mName, "", Actions::StormBegin, FileInfo());
+			}
+		}
+
+		if(!storm->mActive)
+			return false;
+
+		StormDir& stormDir = storm->mDirs[dir];
+		++stormDir.mEvents;
+		if(!stormDir.mTruncated && stormDir.mFiles.find(filename) == stormDir.mFiles.end())
+		{
+			if(stormDir.mFiles.size() < STORM_NAMES)
+			{
+				stormDir.mFiles.insert(std::make_pair(filename, action));
+			}
+			else
+			{
+				stormDir.mTruncated = true;
+				stormDir.mFiles.clear();
+			}
+		}
+		return true;
+	}
+
+	//--------
+	void FileWatcherLinux::updateStorms()
+	{
+		if(!mStorms)
+			return;
+
+		std::vector<WatchID> watchids;
+		RootMap::const_iterator iter = mRoots.begin();
+		RootMap::const_iterator end = mRoots.end();
+		for(; iter != end; ++iter)
+		{
+			if((*iter)->mStorm && (*iter)->mStorm->mActive)
+				watchids.push_back(iter.key());
+		}
+
+		for(size_t i = 0; i < watchids.size(); ++i)
+		{
+			// a listener may remove watches while we go
+			WatchRoot* root = mRoots.find(watchids[i]);
+			if(!root)
+				continue;
+
+			// taken out first, the storm goes away with the watch
+			std::vector<std::pair<String, size_t> > dirty;
+			std::map<String, StormDir>::iterator dir = root->mStorm->mDirs.begin();
+			for(; dir != root->mStorm->mDirs.end(); ++dir)
+			{
+				if(!dir->second.mEvents)
+					continue;
+
+				dirty.push_back(std::make_pair(dir->first, dir->second.mEvents));
+				dir->second.mEvents = 0;
+			}
+
+			for(size_t j = 0; j < dirty.size(); ++j)
+			{
+				root = mRoots.find(watchids[i]);
+				if(!root)
+					break;
+
+				FileInfo info;
+				info.events = dirty[j].second;
+				dispatchAction(root, dirty[j].first, "", Actions::Dirty, info);
+			}
+
+			root = mRoots.find(watchids[i]);
+			if(root && mNow >= root->mStorm->mLastBusy + root->mStorm->mCooldown)
+				endStorm(root);
+		}
+
+		flushHeldEvents();
+	}
+
+	//--------
+	void FileWatcherLinux::endStorm(WatchRoot* root)
+	{
+		StormState* storm = root->mStorm;
+		storm->mActive = false;
+		--mStorms;
+
+		std::map<String, StormDir> dirs;
+		dirs.swap(storm->mDirs);
+		WatchID watchid = root->mWatchID;
+		if(root->mDir)
+			dispatchAction(root, *root->mDir->mName, "", Actions::StormEnd, FileInfo());
+
+		// the first action of a file tells whether it existed before the
+		// storm, a stat whether it exists now
+		storm->mRescan = true;
+		std::map<String, StormDir>::iterator dir = dirs.begin();
+		for(; dir != dirs.end(); ++dir)
+		{
+			// a listener may have removed the watch, taking the storm along
+			root = mRoots.find(watchid);
+			if(!root)
+				return;
+
+			if(dir->second.mTruncated)
+			{
+				dispatchAction(root, dir->first, "", Actions::Overflow, FileInfo());
+				continue;
+			}
+
+			int dirfd = open(dir->first.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+			std::unordered_map<String, Action>::const_iterator file = dir->second.mFiles.begin();
+			for(; file != dir->second.mFiles.end() && mRoots.find(watchid); ++file)
+			{
+				FileInfo info;
+				if(dirfd >= 0)
+					inspectEntry(dirfd, file->first, info);
+
+				bool existed = file->second != Actions::Add;
+				if(info.hasStat)
+					dispatchAction(root, dir->first, file->first, existed ? Actions::Modified : Actions::Add, info);
+				else if(existed)
+					dispatchAction(root, dir->first, file->first, Actions::Delete, FileInfo());
+			}
+
+			if(dirfd >= 0)
+				close(dirfd);
+		}
+
+		root = mRoots.find(watchid);
+		if(root)
+			root->mStorm->mRescan = false;
+	}
+
+	//--------
+	MemoryUsage FileWatcherLinux::getMemoryUsage() const
+	{
+		MemoryUsage usage;
+		usage.watches = mWatches.size();
+		usage.polled = mPolled;
+		usage.bytes = mWatchPool.memoryUsage() + mRootPool.memoryUsage() + mWatches.memoryUsage()
+			+ mRoots.memoryUsage() + mRetired.memoryUsage() + mDirNames.memoryUsage();
+
+		for(size_t i = 0; i < mPollQueue.size(); ++i)
+		{
+			const PollState* state = mPollQueue[i];
+			if(!state->mWatch)
+				continue;
+
+			usage.bytes += sizeof(PollState) + state->mEntries.capacity() * sizeof(PollEntry);
+			for(size_t j = 0; j < state->mEntries.size(); ++j)
+			{
+				if(state->mEntries[j].mName.capacity() > 15)
+					usage.bytes += state->mEntries[j].mName.capacity() + 1;
+			}
 		}
+		return usage;
 	}
 
 };//namespace FW
@@ -0,0 +1,321 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/HeavyHitters.h>
+
+#include <algorithm>
+#include <functional>
+
+/// Rows of the count-min sketch
+#define SKETCH_DEPTH 4
+
+namespace FW
+{
+
+	//--------
+	static unsigned long long mix(unsigned long long key)
+	{
+		// splitmix64 finalizer
+		key ^= key >> 30;
+		key *= 0xbf58476d1ce4e5b9ull;
+		key ^= key >> 27;
+		key *= 0x94d049bb133111ebull;
+		key ^= key >> 31;
+		return key;
+	}
+
+	//--------
+	static size_t actionSlot(Action action)
+	{
+		switch(action)
+		{
+		case Actions::Add:
+			return 0;
+		case Actions::Delete:
+			return 1;
+		case Actions::Modified:
+			return 2;
+		default:
+			return 3;
+		}
+	}
+
+	//--------
+	HeavyHitters::HeavyHitters()
+		: mEnabled(false), mTopK(0), mWidthMask(0), mEvents(0)
+	{
+	}
+
+	//--------
+	HeavyHitters::~HeavyHitters()
+	{
+		clear(mFiles);
+		clear(mDirectories);
+	}
+
+	//--------
+	void HeavyHitters::enable(const HeavyHitterOptions& options)
+	{
+		size_t width = 1;
+		while(width < options.width)
+			width <<= 1;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		clear(mFiles);
+		clear(mDirectories);
+		mSketch.assign(width * SKETCH_DEPTH, 0);
+		mWidthMask = width - 1;
+		mTopK = options.topK ? options.topK : 1;
+		mEvents = 0;
+		mEnabled = true;
+	}
+
+	//--------
+	void HeavyHitters::setListener(WatchID watchid, FileWatchListener* listener, const String& directory)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		Watch& watch = mWatches[watchid];
+		watch.mListener = listener;
+		watch.mDirectory = directory;
+	}
+
+	//--------
+	void HeavyHitters::removeListener(WatchID watchid)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mWatches.erase(watchid);
+	}
+
+	//--------
+	void HeavyHitters::removeDirectory(const String& directory)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::unordered_map<WatchID, Watch>::iterator iter = mWatches.begin();
+		for(; iter != mWatches.end(); ++iter)
+		{
+			if(iter->second.mDirectory == directory)
+			{
+				mWatches.erase(iter);
+				return;
+			}
+		}
+	}
+
+	//--------
+	void HeavyHitters::handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		handleFileEvent(watchid, dir, filename, action, FileInfo());
+	}
+
+	//--------
+	void HeavyHitters::handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		// the listener may ask for a report, so it runs without the lock
+		FileWatchListener* listener = count(watchid, dir, filename, action);
+		if(listener)
+			listener->handleFileEvent(watchid, dir, filename, action, info);
+	}
+
+	//--------
+	void HeavyHitters::handleChangeset(WatchID watchid, const Changeset& changes)
+	{
+		FileWatchListener* listener = 0;
+		for(size_t i = 0; i < changes.size(); ++i)
+			listener = count(watchid, changes[i].dir, changes[i].filename, changes[i].action);
+		if(listener)
+			listener->handleChangeset(watchid, changes);
+	}
+
+	//--------
+	HeavyHitterReport HeavyHitters::getReport() const
+	{
+		HeavyHitterReport result;
+		std::lock_guard<std::mutex> lock(mMutex);
+		result.events = mEvents;
+		report(mFiles, result.files);
+		report(mDirectories, result.directories);
+		return result;
+	}
+
+	//--------
+	FileWatchListener* HeavyHitters::count(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::unordered_map<WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return 0;
+
+		++mEvents;
+		std::hash<String> hash;
+		unsigned long long dirKey = mix(hash(dir) ^ mix((unsigned long long)watchid));
+		offer(mDirectories, dirKey, watchid, dir, String(), action);
+		if(!filename.empty())
+			offer(mFiles, mix(dirKey ^ hash(filename)), watchid, dir, filename, action);
+
+		return iter->second.mListener;
+	}
+
+	//--------
+	unsigned long long HeavyHitters::increment(unsigned long long key)
+	{
+		// conservative update: only the counters at the minimum grow, which
+		// keeps the overestimate of colliding keys down
+		size_t slots[SKETCH_DEPTH];
+		unsigned int estimate = ~0u;
+		for(size_t row = 0; row < SKETCH_DEPTH; ++row)
+		{
+			slots[row] = row * (mWidthMask + 1) + (size_t)(mix(key + row) & mWidthMask);
+			estimate = std::min(estimate, mSketch[slots[row]]);
+		}
+
+		if(estimate != ~0u)
+			++estimate;
+		for(size_t row = 0; row < SKETCH_DEPTH; ++row)
+		{
+			if(mSketch[slots[row]] < estimate)
+				mSketch[slots[row]] = estimate;
+		}
+		return estimate;
+	}
+
+	//--------
+	void HeavyHitters::offer(TopK& top, unsigned long long key, WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		unsigned long long estimate = increment(key);
+
+		std::unordered_map<unsigned long long, Candidate*>::iterator iter = top.mByKey.find(key);
+		if(iter != top.mByKey.end())
+		{
+			Candidate* candidate = iter->second;
+			++candidate->mCount;
+			++candidate->mActions[actionSlot(action)];
+			siftDown(top, candidate->mHeapIndex);
+			return;
+		}
+
+		Candidate* candidate;
+		if(top.mHeap.size() < mTopK)
+		{
+			candidate = new Candidate();
+			candidate->mHeapIndex = top.mHeap.size();
+			top.mHeap.push_back(candidate);
+		}
+		else if(estimate > top.mHeap[0]->mCount)
+		{
+			// the quietest candidate makes room
+			candidate = top.mHeap[0];
+			top.mByKey.erase(candidate->mKey);
+		}
+		else
+		{
+			return;
+		}
+
+		candidate->mKey = key;
+		candidate->mWatchID = watchid;
+		candidate->mDir = dir;
+		candidate->mFilename = filename;
+		candidate->mCount = estimate;
+		candidate->mError = estimate - 1;
+		std::fill(candidate->mActions, candidate->mActions + 4, 0);
+		++candidate->mActions[actionSlot(action)];
+		top.mByKey[key] = candidate;
+
+		siftUp(top, candidate->mHeapIndex);
+		siftDown(top, candidate->mHeapIndex);
+	}
+
+	//--------
+	void HeavyHitters::siftDown(TopK& top, size_t index)
+	{
+		std::vector<Candidate*>& heap = top.mHeap;
+		for(;;)
+		{
+			size_t smallest = index;
+			size_t left = index * 2 + 1;
+			size_t right = left + 1;
+			if(left < heap.size() && heap[left]->mCount < heap[smallest]->mCount)
+				smallest = left;
+			if(right < heap.size() && heap[right]->mCount < heap[smallest]->mCount)
+				smallest = right;
+			if(smallest == index)
+				return;
+
+			std::swap(heap[index], heap[smallest]);
+			heap[index]->mHeapIndex = index;
+			heap[smallest]->mHeapIndex = smallest;
+			index = smallest;
+		}
+	}
+
+	//--------
+	void HeavyHitters::siftUp(TopK& top, size_t index)
+	{
+		std::vector<Candidate*>& heap = top.mHeap;
+		while(index > 0)
+		{
+			size_t parent = (index - 1) / 2;
+			if(heap[parent]->mCount <= heap[index]->mCount)
+				return;
+
+			std::swap(heap[index], heap[parent]);
+			heap[index]->mHeapIndex = index;
+			heap[parent]->mHeapIndex = parent;
+			index = parent;
+		}
+	}
+
+	//--------
+	void HeavyHitters::clear(TopK& top)
+	{
+		for(size_t i = 0; i < top.mHeap.size(); ++i)
+			delete top.mHeap[i];
+		top.mHeap.clear();
+		top.mByKey.clear();
+	}
+
+	//--------
+	void HeavyHitters::report(const TopK& top, std::vector<HeavyHitter>& hitters)
+	{
+		hitters.reserve(top.mHeap.size());
+		for(size_t i = 0; i < top.mHeap.size(); ++i)
+		{
+			const Candidate* candidate = top.mHeap[i];
+			HeavyHitter hitter;
+			hitter.watchid = candidate->mWatchID;
+			hitter.dir = candidate->mDir;
+			hitter.filename = candidate->mFilename;
+			hitter.count = candidate->mCount;
+			hitter.error = candidate->mError;
+			hitter.adds = candidate->mActions[0];
+			hitter.deletes = candidate->mActions[1];
+			hitter.modifies = candidate->mActions[2];
+			hitter.others = candidate->mActions[3];
+			hitters.push_back(hitter);
+		}
+
+		std::sort(hitters.begin(), hitters.end(), [](const HeavyHitter& a, const HeavyHitter& b) {
+			return a.count > b.count;
+		});
+	}
+
+};//namespace FW
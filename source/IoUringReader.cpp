@@ -0,0 +1,277 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/IoUringReader.h>
+
+#if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#	if __has_include(<linux/io_uring.h>)
+#		include <linux/io_uring.h>
+#		define FILEWATCHER_IO_URING 1
+#	endif
+#endif
+
+namespace FW
+{
+	/// user_data of the read and of the cancel that ends it
+	enum
+	{
+		READ_TAG = 1,
+		CANCEL_TAG = 2
+	};
+
+	//--------
+	IoUringReader::IoUringReader()
+		: mRingFD(-1), mFD(-1), mBuffer(0), mSize(0), mFixed(false), mInFlight(false),
+		mSQRing(MAP_FAILED), mSQRingSize(0), mCQRing(MAP_FAILED), mCQRingSize(0),
+		mSQEs(MAP_FAILED), mSQEsSize(0)
+	{
+	}
+
+	//--------
+	IoUringReader::~IoUringReader()
+	{
+		release();
+	}
+
+	//--------
+	void IoUringReader::release()
+	{
+		// closing the ring cancels the read in flight only asynchronously,
+		// it may still write to the buffer afterwards
+		int result;
+		cancel(result);
+
+		if(mRingFD >= 0)
+			close(mRingFD);
+		if(mSQEs != MAP_FAILED)
+			munmap(mSQEs, mSQEsSize);
+		if(mCQRing != MAP_FAILED && mCQRing != mSQRing)
+			munmap(mCQRing, mCQRingSize);
+		if(mSQRing != MAP_FAILED)
+			munmap(mSQRing, mSQRingSize);
+
+		mRingFD = -1;
+		mSQRing = mCQRing = mSQEs = MAP_FAILED;
+		mInFlight = false;
+	}
+
+#if FILEWATCHER_IO_URING
+
+	//--------
+	bool IoUringReader::init(int fd, char* buffer, unsigned int size)
+	{
+		release();
+
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+
+		mRingFD = (int)syscall(__NR_io_uring_setup, 2, &params);
+		if(mRingFD < 0)
+			return false;
+
+		mSQRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		mCQRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+			mSQRingSize = mCQRingSize = (mSQRingSize > mCQRingSize ? mSQRingSize : mCQRingSize);
+		mSQEsSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+		mSQRing = mmap(0, mSQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			mRingFD, IORING_OFF_SQ_RING);
+		if(mSQRing != MAP_FAILED && (params.features & IORING_FEAT_SINGLE_MMAP))
+			mCQRing = mSQRing;
+		else if(mSQRing != MAP_FAILED)
+			mCQRing = mmap(0, mCQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				mRingFD, IORING_OFF_CQ_RING);
+		if(mCQRing != MAP_FAILED)
+			mSQEs = mmap(0, mSQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				mRingFD, IORING_OFF_SQES);
+
+		if(mSQEs == MAP_FAILED)
+		{
+			int error = errno;
+			release();
+			errno = error;
+			return false;
+		}
+
+		char* sq = (char*)mSQRing;
+		char* cq = (char*)mCQRing;
+		mSQTail = (unsigned int*)(sq + params.sq_off.tail);
+		mSQMask = (unsigned int*)(sq + params.sq_off.ring_mask);
+		mSQArray = (unsigned int*)(sq + params.sq_off.array);
+		mCQHead = (unsigned int*)(cq + params.cq_off.head);
+		mCQTail = (unsigned int*)(cq + params.cq_off.tail);
+		mCQMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+		mCQEs = cq + params.cq_off.cqes;
+
+		mFD = fd;
+		mBuffer = buffer;
+		mSize = size;
+
+		// registration pins the buffer; fall back to plain reads when that
+		// would exceed RLIMIT_MEMLOCK
+		struct iovec iov;
+		iov.iov_base = buffer;
+		iov.iov_len = size;
+		mFixed = syscall(__NR_io_uring_register, mRingFD, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+		return true;
+	}
+
+	//--------
+	bool IoUringReader::submit()
+	{
+		if(mInFlight)
+			return true;
+		if(mRingFD < 0)
+		{
+			errno = EBADF;
+			return false;
+		}
+
+		unsigned int tail = *mSQTail;
+		unsigned int index = tail & *mSQMask;
+		struct io_uring_sqe* sqe = (struct io_uring_sqe*)mSQEs + index;
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = mFixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->fd = mFD;
+		sqe->addr = (unsigned long long)(size_t)mBuffer;
+		sqe->len = mSize;
+		// inotify descriptors are not seekable, read from the current position
+		sqe->off = (unsigned long long)-1;
+		sqe->buf_index = 0;
+		sqe->user_data = READ_TAG;
+
+		mSQArray[index] = index;
+		__atomic_store_n(mSQTail, tail + 1, __ATOMIC_RELEASE);
+
+		if(syscall(__NR_io_uring_enter, mRingFD, 1, 0, 0, NULL, 0) < 0)
+		{
+			// take the entry back so the ring stays consistent
+			__atomic_store_n(mSQTail, tail, __ATOMIC_RELEASE);
+			return false;
+		}
+
+		mInFlight = true;
+		return true;
+	}
+
+	//--------
+	bool IoUringReader::poll(int& result)
+	{
+		if(!mInFlight)
+			return false;
+
+		unsigned int head = *mCQHead;
+		unsigned int tail = __atomic_load_n(mCQTail, __ATOMIC_ACQUIRE);
+		for(; head != tail; ++head)
+		{
+			// completions of cancels are skipped
+			struct io_uring_cqe* cqe = (struct io_uring_cqe*)mCQEs + (head & *mCQMask);
+			if(cqe->user_data != READ_TAG)
+				continue;
+
+			result = cqe->res;
+			__atomic_store_n(mCQHead, head + 1, __ATOMIC_RELEASE);
+			mInFlight = false;
+			return true;
+		}
+
+		__atomic_store_n(mCQHead, head, __ATOMIC_RELEASE);
+		return false;
+	}
+
+	//--------
+	bool IoUringReader::cancel(int& result)
+	{
+		if(!mInFlight)
+			return false;
+
+		unsigned int tail = *mSQTail;
+		unsigned int index = tail & *mSQMask;
+		struct io_uring_sqe* sqe = (struct io_uring_sqe*)mSQEs + index;
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = READ_TAG;
+		sqe->user_data = CANCEL_TAG;
+
+		mSQArray[index] = index;
+		__atomic_store_n(mSQTail, tail + 1, __ATOMIC_RELEASE);
+
+		// the read either ends with -ECANCELED or completed before the
+		// cancel got to it, in which case it may hold events
+		unsigned int submit = 1;
+		while(!poll(result))
+		{
+			if(syscall(__NR_io_uring_enter, mRingFD, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) >= 0)
+				submit = 0;
+			else if(errno != EINTR)
+				return false;
+		}
+		return true;
+	}
+
+#else
+
+	//--------
+	bool IoUringReader::init(int fd, char* buffer, unsigned int size)
+	{
+		errno = ENOSYS;
+		return false;
+	}
+
+	//--------
+	bool IoUringReader::submit()
+	{
+		errno = ENOSYS;
+		return false;
+	}
+
+	//--------
+	bool IoUringReader::poll(int& result)
+	{
+		return false;
+	}
+
+	//--------
+	bool IoUringReader::cancel(int& result)
+	{
+		return false;
+	}
+
+#endif//FILEWATCHER_IO_URING
+
+};//namespace FW
+
+#endif//FILEWATCHER_PLATFORM_LINUX
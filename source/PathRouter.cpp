@@ -0,0 +1,294 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/PathRouter.h>
+
+#include <algorithm>
+
+namespace FW
+{
+
+	/// Counts a running route, also when a listener throws
+	struct RouteScope
+	{
+		RouteScope(int& depth) : mDepth(depth) { ++mDepth; }
+		~RouteScope() { --mDepth; }
+
+		int& mDepth;
+	};
+
+	//--------
+	PathRouter::PathRouter()
+		: mLastID(0), mDepth(0)
+	{
+		mRoot.mParent = 0;
+	}
+
+	//--------
+	PathRouter::~PathRouter()
+	{
+		destroy(&mRoot);
+	}
+
+	//--------
+	void PathRouter::destroy(Node* node)
+	{
+		std::unordered_map<String, Node*>::iterator iter = node->mChildren.begin();
+		for(; iter != node->mChildren.end(); ++iter)
+		{
+			destroy(iter->second);
+			delete iter->second;
+		}
+		node->mChildren.clear();
+	}
+
+	//--------
+	WatchID PathRouter::subscribe(const String& directory, FileWatchListener* listener, bool recursive)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		Node* node = &mRoot;
+		size_t start = 0;
+		while(!atEnd(directory, start))
+		{
+			while(directory[start] == '/')
+				++start;
+			size_t end = directory.find('/', start);
+			if(end == String::npos)
+				end = directory.size();
+
+			String name = directory.substr(start, end - start);
+			start = end;
+
+			Node*& child = node->mChildren[name];
+			if(!child)
+			{
+				child = new Node();
+				child->mParent = node;
+				child->mName = name;
+			}
+			node = child;
+		}
+
+		Entry entry;
+		entry.mID = ++mLastID;
+		entry.mListener = listener;
+		entry.mRecursive = recursive;
+		node->mEntries.push_back(entry);
+		mByID[entry.mID] = node;
+		return entry.mID;
+	}
+
+	//--------
+	void PathRouter::unsubscribe(WatchID id)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		std::unordered_map<WatchID, Node*>::iterator iter = mByID.find(id);
+		if(iter == mByID.end())
+			return;
+
+		Node* node = iter->second;
+		mByID.erase(iter);
+		for(size_t i = 0; i < node->mEntries.size(); ++i)
+		{
+			if(node->mEntries[i].mID == id)
+			{
+				node->mEntries[i].mListener = 0;
+				break;
+			}
+		}
+
+		// a route may be walking the node, it is compacted afterwards
+		if(mDepth)
+			mDirty.push_back(node);
+		else
+			compact(node);
+	}
+
+	//--------
+	size_t PathRouter::size() const
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		return mByID.size();
+	}
+
+	//--------
+	void PathRouter::handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		handleFileEvent(watchid, dir, filename, action, FileInfo());
+	}
+
+	//--------
+	void PathRouter::handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		{
+			RouteScope scope(mDepth);
+			WatchID last = mLastID;
+			const Node* node = &mRoot;
+			size_t start = 0;
+			String key;
+			for(;;)
+			{
+				// recursive subscriptions above dir, then every one on it
+				bool final = atEnd(dir, start);
+				for(size_t i = 0; i < node->mEntries.size(); ++i)
+				{
+					Entry entry = node->mEntries[i];
+					if(entry.mListener && entry.mID <= last && (final || entry.mRecursive))
+						entry.mListener->handleFileEvent(entry.mID, dir, filename, action, info);
+				}
+
+				if(final || !(node = next(node, dir, start, key)))
+					break;
+			}
+		}
+
+		if(!mDepth && !mDirty.empty())
+			compact(0);
+	}
+
+	//--------
+	void PathRouter::handleChangeset(WatchID watchid, const Changeset& changes)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		{
+			RouteScope scope(mDepth);
+			WatchID last = mLastID;
+
+			// the changes of each subscription, in the order they first matched
+			std::vector<std::pair<Entry, Changeset> > batches;
+			std::unordered_map<WatchID, size_t> index;
+			std::vector<Entry> matches;
+			for(size_t i = 0; i < changes.size(); ++i)
+			{
+				matches.clear();
+				collect(changes[i].dir, last, matches);
+				for(size_t j = 0; j < matches.size(); ++j)
+				{
+					std::pair<std::unordered_map<WatchID, size_t>::iterator, bool> slot =
+						index.insert(std::make_pair(matches[j].mID, batches.size()));
+					if(slot.second)
+						batches.push_back(std::make_pair(matches[j], Changeset()));
+					batches[slot.first->second].second.push_back(changes[i]);
+				}
+			}
+
+			for(size_t i = 0; i < batches.size(); ++i)
+			{
+				// an earlier listener may have unsubscribed it
+				const Entry& entry = batches[i].first;
+				if(!mByID.count(entry.mID))
+					continue;
+
+				const Changeset& batch = batches[i].second;
+				entry.mListener->handleChangeset(entry.mID, batch.size() == changes.size() ? changes : batch);
+			}
+		}
+
+		if(!mDepth && !mDirty.empty())
+			compact(0);
+	}
+
+	//--------
+	PathRouter::Node* PathRouter::next(const Node* node, const String& path, size_t& start, String& key)
+	{
+		while(start < path.size() && path[start] == '/')
+			++start;
+		if(start >= path.size())
+			return 0;
+
+		size_t end = path.find('/', start);
+		if(end == String::npos)
+			end = path.size();
+
+		// reuses the buffer of key, so the walk does not allocate
+		key.assign(path, start, end - start);
+		start = end;
+
+		std::unordered_map<String, Node*>::const_iterator iter = node->mChildren.find(key);
+		return iter == node->mChildren.end() ? 0 : iter->second;
+	}
+
+	//--------
+	bool PathRouter::atEnd(const String& path, size_t start)
+	{
+		while(start < path.size() && path[start] == '/')
+			++start;
+		return start >= path.size();
+	}
+
+	//--------
+	void PathRouter::collect(const String& dir, WatchID last, std::vector<Entry>& matches) const
+	{
+		const Node* node = &mRoot;
+		size_t start = 0;
+		String key;
+		for(;;)
+		{
+			bool final = atEnd(dir, start);
+			for(size_t i = 0; i < node->mEntries.size(); ++i)
+			{
+				const Entry& entry = node->mEntries[i];
+				if(entry.mListener && entry.mID <= last && (final || entry.mRecursive))
+					matches.push_back(entry);
+			}
+
+			if(final || !(node = next(node, dir, start, key)))
+				break;
+		}
+	}
+
+	//--------
+	void PathRouter::compact(Node* node)
+	{
+		if(!node)
+		{
+			// a node may have been marked more than once
+			std::vector<Node*> dirty;
+			dirty.swap(mDirty);
+			std::sort(dirty.begin(), dirty.end());
+			dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+			for(size_t i = 0; i < dirty.size(); ++i)
+				compact(dirty[i]);
+			return;
+		}
+
+		std::vector<Entry>& entries = node->mEntries;
+		size_t kept = 0;
+		for(size_t i = 0; i < entries.size(); ++i)
+		{
+			if(entries[i].mListener)
+				entries[kept++] = entries[i];
+		}
+		entries.resize(kept);
+
+		// nodes without subscriptions at or below them go away
+		while(node != &mRoot && node->mEntries.empty() && node->mChildren.empty())
+		{
+			Node* parent = node->mParent;
+			parent->mChildren.erase(node->mName);
+			delete node;
+			node = parent;
+		}
+	}
+
+};//namespace FW
@@ -0,0 +1,501 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/SharedRing.h>
+
+#if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
+
+#include <atomic>
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef MFD_CLOEXEC
+#	define MFD_CLOEXEC 0x0001U
+#	define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+/// "FWRG"
+#define RING_MAGIC 0x47525746
+#define RING_VERSION 1
+/// The header takes the first page, the records follow
+#define RING_HEADER_SIZE 4096
+#define RING_MIN_CAPACITY (64 * 1024)
+
+namespace FW
+{
+
+	/// Start of the shared mapping. The cursors are byte positions that
+	/// only grow; a position maps to position & (capacity - 1).
+	struct SharedRingHeader
+	{
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint64_t mCapacity;
+
+		/// end of the last published record
+		alignas(64) std::atomic<uint64_t> mHead;
+		/// records starting below this may be overwritten
+		std::atomic<uint64_t> mTail;
+
+		/// bumped on every publish, readers sleep on it
+		alignas(64) std::atomic<uint32_t> mFutex;
+		/// readers inside wait
+		std::atomic<uint32_t> mWaiters;
+	};
+
+	/// A record in the ring, followed by the directory and the file name,
+	/// each NUL terminated, padded to 8 bytes
+	struct RingRecord
+	{
+		uint64_t mSequence;
+		uint64_t mWatchID;
+		uint32_t mSize;
+		uint16_t mDirLength;
+		uint16_t mFilenameLength;
+		uint8_t mAction;
+		/// the rest of the ring up to its end is unused
+		uint8_t mPadding;
+		uint8_t mReserved[6];
+	};
+
+	//--------
+	static int futex(std::atomic<uint32_t>* word, int op, uint32_t value, const struct timespec* timeout)
+	{
+		return (int)syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+	}
+
+	//--------
+	SharedRingWriter::SharedRingWriter()
+		: mFD(-1), mHeader(0), mData(0), mMapSize(0), mHead(0), mTail(0), mSequence(0)
+	{
+	}
+
+	//--------
+	SharedRingWriter::~SharedRingWriter()
+	{
+		release();
+	}
+
+	//--------
+	void SharedRingWriter::release()
+	{
+		if(mHeader)
+			munmap(mHeader, mMapSize);
+		if(mFD >= 0)
+			close(mFD);
+		mHeader = 0;
+		mData = 0;
+		mFD = -1;
+	}
+
+	//--------
+	bool SharedRingWriter::create(size_t capacity)
+	{
+		release();
+
+		size_t size = RING_MIN_CAPACITY;
+		while(size < capacity)
+			size <<= 1;
+
+#ifdef SYS_memfd_create
+		mFD = (int)syscall(SYS_memfd_create, "filewatcher-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+		errno = ENOSYS;
+#endif
+		if(mFD < 0)
+			return false;
+
+		mMapSize = RING_HEADER_SIZE + size;
+		if(ftruncate(mFD, mMapSize) < 0)
+		{
+			int error = errno;
+			release();
+			errno = error;
+			return false;
+		}
+
+		// readers cannot resize the ring under the writer
+		fcntl(mFD, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+		void* mapping = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFD, 0);
+		if(mapping == MAP_FAILED)
+		{
+			int error = errno;
+			release();
+			errno = error;
+			return false;
+		}
+
+		mHeader = new (mapping) SharedRingHeader();
+		mHeader->mMagic = RING_MAGIC;
+		mHeader->mVersion = RING_VERSION;
+		mHeader->mCapacity = size;
+		mHeader->mHead.store(0);
+		mHeader->mTail.store(0);
+		mHeader->mFutex.store(0);
+		mHeader->mWaiters.store(0);
+		mData = (char*)mapping + RING_HEADER_SIZE;
+		mHead = 0;
+		mTail = 0;
+		mSequence = 0;
+		return true;
+	}
+
+	//--------
+	bool SharedRingWriter::send(int socket) const
+	{
+		if(mFD < 0)
+		{
+			errno = EBADF;
+			return false;
+		}
+
+		char byte = 0;
+		struct iovec data = { &byte, 1 };
+
+		char control[CMSG_SPACE(sizeof(int))];
+		memset(control, 0, sizeof(control));
+
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(header), &mFD, sizeof(int));
+
+		return sendmsg(socket, &message, MSG_NOSIGNAL) == 1;
+	}
+
+	//--------
+	void SharedRingWriter::handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		if(!mHeader)
+			return;
+
+		size_t dirLength = dir.size() < 0xffff ? dir.size() : 0xffff;
+		size_t filenameLength = filename.size() < 0xffff ? filename.size() : 0xffff;
+		uint64_t size = (sizeof(RingRecord) + dirLength + filenameLength + 2 + 7) & ~(uint64_t)7;
+
+		uint64_t capacity = mHeader->mCapacity;
+		if(size > capacity / 4)
+			return;
+
+		uint64_t offset = mHead & (capacity - 1);
+		uint64_t padding = offset + size > capacity ? capacity - offset : 0;
+
+		// readers that are still behind the space we are about to reuse
+		// see that they were lapped
+		uint64_t end = mHead + padding + size;
+		if(end > capacity && end - capacity > mTail)
+		{
+			mTail = end - capacity;
+			mHeader->mTail.store(mTail, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+
+		if(padding)
+		{
+			if(padding >= sizeof(RingRecord))
+			{
+				RingRecord* pad = (RingRecord*)(mData + offset);
+				pad->mSize = (uint32_t)padding;
+				pad->mPadding = 1;
+			}
+			offset = 0;
+		}
+
+		RingRecord* record = (RingRecord*)(mData + offset);
+		record->mSequence = mSequence++;
+		record->mWatchID = watchid;
+		record->mSize = (uint32_t)size;
+		record->mDirLength = (uint16_t)dirLength;
+		record->mFilenameLength = (uint16_t)filenameLength;
+		record->mAction = (uint8_t)action;
+		record->mPadding = 0;
+
+		char* names = (char*)(record + 1);
+		memcpy(names, dir.data(), dirLength);
+		names[dirLength] = 0;
+		memcpy(names + dirLength + 1, filename.data(), filenameLength);
+		names[dirLength + 1 + filenameLength] = 0;
+
+		mHead = end;
+		mHeader->mHead.store(mHead, std::memory_order_release);
+
+		// the system call is only paid while somebody sleeps
+		mHeader->mFutex.fetch_add(1);
+		if(mHeader->mWaiters.load())
+			futex(&mHeader->mFutex, FUTEX_WAKE, INT_MAX, NULL);
+	}
+
+	//--------
+	uint64_t SharedRingWriter::published() const
+	{
+		return mSequence;
+	}
+
+	//--------
+	SharedRingReader::SharedRingReader()
+		: mFD(-1), mHeader(0), mData(0), mMapSize(0), mMask(0), mCursor(0), mRecord(0), mSequence(0), mLost(0)
+	{
+	}
+
+	//--------
+	SharedRingReader::~SharedRingReader()
+	{
+		release();
+	}
+
+	//--------
+	void SharedRingReader::release()
+	{
+		if(mHeader)
+			munmap(mHeader, mMapSize);
+		if(mFD >= 0)
+			close(mFD);
+		mHeader = 0;
+		mData = 0;
+		mFD = -1;
+	}
+
+	//--------
+	bool SharedRingReader::attach(int fd)
+	{
+		release();
+
+		struct stat attrib;
+		if(fstat(fd, &attrib) < 0)
+			return false;
+		if(attrib.st_size < RING_HEADER_SIZE + RING_MIN_CAPACITY)
+		{
+			errno = EINVAL;
+			return false;
+		}
+
+		// writable only for the waiter count
+		mMapSize = attrib.st_size;
+		void* mapping = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(mapping == MAP_FAILED)
+			return false;
+
+		mHeader = (SharedRingHeader*)mapping;
+		uint64_t capacity = mHeader->mCapacity;
+		if(mHeader->mMagic != RING_MAGIC || mHeader->mVersion != RING_VERSION
+			|| (capacity & (capacity - 1)) || RING_HEADER_SIZE + capacity != mMapSize)
+		{
+			munmap(mapping, mMapSize);
+			mHeader = 0;
+			errno = EINVAL;
+			return false;
+		}
+
+		mFD = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		mData = (const char*)mapping + RING_HEADER_SIZE;
+		mMask = capacity - 1;
+		mLost = 0;
+
+		// start with the events published from now on
+		resync();
+		mSequence = 0;
+		mRecord = mCursor;
+		return true;
+	}
+
+	//--------
+	bool SharedRingReader::receive(int socket)
+	{
+		char byte;
+		struct iovec data = { &byte, 1 };
+
+		char control[CMSG_SPACE(sizeof(int))];
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		if(recvmsg(socket, &message, MSG_CMSG_CLOEXEC) <= 0)
+			return false;
+
+		struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+		if(!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+		{
+			errno = EBADMSG;
+			return false;
+		}
+
+		int fd;
+		memcpy(&fd, CMSG_DATA(header), sizeof(int));
+		bool attached = attach(fd);
+		int error = errno;
+		close(fd);
+		errno = error;
+		return attached;
+	}
+
+	//--------
+	void SharedRingReader::resync()
+	{
+		mCursor = mHeader->mHead.load(std::memory_order_acquire);
+	}
+
+	//--------
+	SharedRingReader::Status SharedRingReader::next(SharedEvent& event)
+	{
+		if(!mHeader)
+			return Empty;
+
+		uint64_t capacity = mMask + 1;
+		while(true)
+		{
+			uint64_t head = mHeader->mHead.load(std::memory_order_acquire);
+			if(mCursor == head)
+				return Empty;
+
+			if(mHeader->mTail.load(std::memory_order_acquire) > mCursor)
+			{
+				resync();
+				return Lapped;
+			}
+
+			uint64_t offset = mCursor & mMask;
+			if(capacity - offset < sizeof(RingRecord))
+			{
+				mCursor += capacity - offset;
+				continue;
+			}
+
+			RingRecord record;
+			memcpy(&record, mData + offset, sizeof(record));
+
+			// the copy only counts if the writer did not get there meanwhile
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if(mHeader->mTail.load(std::memory_order_relaxed) > mCursor
+				|| record.mSize < sizeof(RingRecord) || record.mSize > capacity - offset || (record.mSize & 7))
+			{
+				resync();
+				return Lapped;
+			}
+
+			if(record.mPadding)
+			{
+				mCursor += record.mSize;
+				continue;
+			}
+
+			const char* names = mData + offset + sizeof(RingRecord);
+			event.watchid = (WatchID)record.mWatchID;
+			event.action = (Action)record.mAction;
+			event.dir = names;
+			event.dirLength = record.mDirLength;
+			event.filename = names + record.mDirLength + 1;
+			event.filenameLength = record.mFilenameLength;
+			event.sequence = record.mSequence;
+
+			if(record.mSequence > mSequence)
+				mLost += record.mSequence - mSequence;
+			mSequence = record.mSequence + 1;
+
+			mRecord = mCursor;
+			mCursor += record.mSize;
+			return Read;
+		}
+	}
+
+	//--------
+	bool SharedRingReader::intact() const
+	{
+		if(!mHeader)
+			return false;
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return mHeader->mTail.load(std::memory_order_relaxed) <= mRecord;
+	}
+
+	//--------
+	bool SharedRingReader::wait(int timeout)
+	{
+		if(!mHeader)
+			return false;
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		mHeader->mWaiters.fetch_add(1);
+		while(true)
+		{
+			uint32_t sequence = mHeader->mFutex.load();
+			if(mHeader->mHead.load() != mCursor)
+				break;
+
+			struct timespec interval = { 0, 0 };
+			if(timeout >= 0)
+			{
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				interval.tv_sec = deadline.tv_sec - now.tv_sec;
+				interval.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+				if(interval.tv_nsec < 0)
+				{
+					interval.tv_sec -= 1;
+					interval.tv_nsec += 1000000000L;
+				}
+				if(interval.tv_sec < 0)
+					break;
+			}
+
+			// wakes early when the counter moved on since it was read, the
+			// loop sorts out whether that brought anything new
+			futex(&mHeader->mFutex, FUTEX_WAIT, sequence, timeout < 0 ? NULL : &interval);
+		}
+		mHeader->mWaiters.fetch_sub(1);
+
+		return mHeader->mHead.load() != mCursor;
+	}
+
+};//namespace FW
+
+#endif//FILEWATCHER_PLATFORM_LINUX
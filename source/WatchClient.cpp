@@ -0,0 +1,268 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/WatchClient.h>
+
+#if FILEWATCHER_PLATFORM != FILEWATCHER_PLATFORM_WIN32
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace FW
+{
+
+	//--------
+	WatchClient::WatchClient()
+		: mFD(-1), mLastWatchID(0), mLastRequest(0)
+	{
+	}
+
+	//--------
+	WatchClient::~WatchClient()
+	{
+		disconnect();
+	}
+
+	//--------
+	bool WatchClient::connect(const String& socketPath)
+	{
+		disconnect();
+
+		struct sockaddr_un address;
+		if(socketPath.size() >= sizeof(address.sun_path))
+		{
+			errno = ENAMETOOLONG;
+			return false;
+		}
+
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+		mFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(mFD < 0)
+			return false;
+
+		if(::connect(mFD, (struct sockaddr*)&address, sizeof(address)) < 0)
+		{
+			int error = errno;
+			disconnect();
+			errno = error;
+			return false;
+		}
+		return true;
+	}
+
+	//--------
+	void WatchClient::disconnect()
+	{
+		if(mFD >= 0)
+			close(mFD);
+		mFD = -1;
+		mInput.clear();
+		mPending.clear();
+		mWatches.clear();
+	}
+
+	//--------
+	WatchID WatchClient::addWatch(const String& directory, FileWatchListener* watcher, bool recursive)
+	{
+		if(mFD < 0)
+			throw Exception("Not connected to the watch daemon");
+
+		uint32_t request = ++mLastRequest;
+		String frame;
+		{
+			WatchProtocol::Writer writer(frame, WatchProtocol::Subscribe);
+			writer.put32(request);
+			writer.put8(recursive ? WatchProtocol::Recursive : 0);
+			writer.put(directory);
+		}
+		send(frame);
+
+		WatchID subscription = 0;
+		int error = 0;
+		String message;
+		while(!decode(request, &subscription, &error, &message))
+		{
+			if(!receive(true))
+				throw Exception("Lost the connection to the watch daemon");
+		}
+
+		if(error == ENOENT)
+			throw FileNotFoundException(directory);
+		else if(error)
+			throw Exception(message.empty() ? strerror(error) : message);
+
+		Watch watch = { subscription, watcher };
+		mWatches.insert(std::make_pair(++mLastWatchID, watch));
+		return mLastWatchID;
+	}
+
+	//--------
+	void WatchClient::removeWatch(WatchID watchid)
+	{
+		std::map<WatchID, Watch>::iterator iter = mWatches.find(watchid);
+		if(iter == mWatches.end())
+			return;
+
+		String frame;
+		{
+			WatchProtocol::Writer writer(frame, WatchProtocol::Unsubscribe);
+			writer.put32((uint32_t)iter->second.mSubscription);
+		}
+		mWatches.erase(iter);
+
+		if(mFD >= 0)
+			send(frame);
+	}
+
+	//--------
+	bool WatchClient::update()
+	{
+		if(mFD < 0)
+			return false;
+
+		bool connected = receive(false);
+		decode(0, 0, 0, 0);
+
+		while(!mPending.empty())
+		{
+			PendingEvent event;
+			event.mSubscription = mPending.front().mSubscription;
+			event.mDir.swap(mPending.front().mDir);
+			event.mFilename.swap(mPending.front().mFilename);
+			event.mAction = mPending.front().mAction;
+			mPending.pop_front();
+
+			// a listener may remove watches while we go
+			std::vector<WatchID> targets;
+			std::map<WatchID, Watch>::const_iterator iter = mWatches.begin();
+			for(; iter != mWatches.end(); ++iter)
+			{
+				if(iter->second.mSubscription == event.mSubscription)
+					targets.push_back(iter->first);
+			}
+
+			for(size_t i = 0; i < targets.size(); ++i)
+			{
+				iter = mWatches.find(targets[i]);
+				if(iter != mWatches.end() && iter->second.mListener)
+					iter->second.mListener->handleFileAction(targets[i], event.mDir, event.mFilename, event.mAction);
+			}
+		}
+
+		if(!connected)
+			disconnect();
+		return connected;
+	}
+
+	//--------
+	void WatchClient::send(const String& frame)
+	{
+		size_t sent = 0;
+		while(sent < frame.size())
+		{
+			ssize_t result = ::send(mFD, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+			if(result < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				throw Exception(strerror(errno));
+			}
+			sent += result;
+		}
+	}
+
+	//--------
+	bool WatchClient::receive(bool block)
+	{
+		char buffer[64 * 1024];
+		while(true)
+		{
+			ssize_t result = recv(mFD, buffer, sizeof(buffer), block ? 0 : MSG_DONTWAIT);
+			if(result > 0)
+			{
+				mInput.append(buffer, result);
+				if((size_t)result < sizeof(buffer))
+					return true;
+				block = false;
+				continue;
+			}
+
+			if(result == 0)
+				return false;
+			if(errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+	}
+
+	//--------
+	bool WatchClient::decode(uint32_t request, WatchID* result, int* error, String* message)
+	{
+		size_t pos = 0;
+		bool answered = false;
+
+		uint8_t type;
+		WatchProtocol::Reader payload(0, 0);
+		while(!answered && WatchProtocol::nextFrame(mInput, pos, type, payload))
+		{
+			if(type == WatchProtocol::Event)
+			{
+				PendingEvent event;
+				event.mSubscription = payload.get32();
+				event.mAction = (Action)payload.get8();
+				event.mDir = payload.get(payload.get32());
+				event.mFilename = payload.rest();
+				if(payload.valid())
+					mPending.push_back(event);
+			}
+			else if(type == WatchProtocol::Subscribed)
+			{
+				uint32_t answer = payload.get32();
+				WatchID subscription = payload.get32();
+				int code = (int)payload.get32();
+				if(request && answer == request)
+				{
+					*result = subscription;
+					*error = code;
+					*message = payload.rest();
+					answered = true;
+				}
+			}
+			else if(type == 0)
+			{
+				// out of step with the daemon, nothing after this can be trusted
+				pos = mInput.size();
+				break;
+			}
+		}
+
+		mInput.erase(0, pos);
+		return answered;
+	}
+
+};//namespace FW
+
+#endif//FILEWATCHER_PLATFORM != FILEWATCHER_PLATFORM_WIN32
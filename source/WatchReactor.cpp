@@ -0,0 +1,385 @@
+/**
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/WatchReactor.h>
+
+#include <algorithm>
+
+namespace FW
+{
+
+	//--------
+	static String normalizeDirectory(const String& directory)
+	{
+		size_t length = directory.size();
+		while(length > 1 && directory[length - 1] == '/')
+			--length;
+		return directory.substr(0, length);
+	}
+
+	/// Counts a running fan-out, also when a listener throws
+	struct FanOutScope
+	{
+		FanOutScope(int& depth) : mDepth(depth) { ++mDepth; }
+		~FanOutScope() { --mDepth; }
+
+		int& mDepth;
+	};
+
+	//--------
+	WatchReactor::WatchReactor(const QueueOptions& queue, const ReaderOptions& reader)
+		: mDepth(0), mWatcher(queue, reader)
+	{
+	}
+
+	//--------
+	WatchReactor::~WatchReactor()
+	{
+		// break the cycles between watches and subscriptions; the watcher
+		// thread still runs, so it has to find the tables empty
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		std::map<String, WatchPtr>::iterator iter = mByDirectory.begin();
+		for(; iter != mByDirectory.end(); ++iter)
+			iter->second->mSubscriptions.clear();
+
+		std::unordered_map<WatchID, WatchPtr>::iterator core = mByCoreID.begin();
+		for(; core != mByCoreID.end(); ++core)
+			core->second->mSubscriptions.clear();
+
+		mSubscriptions.clear();
+		mByDirectory.clear();
+		mByCoreID.clear();
+	}
+
+	//--------
+	WatchReactor& WatchReactor::shared()
+	{
+		static WatchReactor reactor;
+		return reactor;
+	}
+
+	//--------
+	size_t WatchReactor::getWatchCount() const
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		return mByCoreID.size();
+	}
+
+	//--------
+	size_t WatchReactor::getSubscriptionCount() const
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		return mSubscriptions.size();
+	}
+
+	//--------
+	WatchID WatchReactor::subscribe(const SharedFileWatcher* owner, const String& directory, FileWatchListener* listener, const WatchOptions& options)
+	{
+		String key = normalizeDirectory(directory);
+		SubscriptionPtr subscription = std::make_shared<Subscription>();
+		std::shared_future<void> ready;
+		bool wait;
+		{
+			std::lock_guard<std::recursive_mutex> lock(mMutex);
+			WatchPtr watch;
+			std::map<String, WatchPtr>::iterator iter = mByDirectory.find(key);
+			if(iter != mByDirectory.end())
+			{
+				watch = iter->second;
+				if(options.recursive && !watch->mRecursive)
+				{
+					watch->mRecursive = true;
+					submitAdd(watch, key, options);
+				}
+			}
+			else
+			{
+				watch = std::make_shared<Watch>();
+				watch->mCoreID = 0;
+				watch->mPending = 0;
+				watch->mRecursive = options.recursive;
+				watch->mKeys.push_back(key);
+				mByDirectory[key] = watch;
+				submitAdd(watch, key, options);
+			}
+
+			subscription->mID = mRouter.subscribe(key, listener, options.recursive);
+			subscription->mOwner = owner;
+			subscription->mListener = listener;
+			subscription->mDirectory = key;
+			subscription->mRecursive = options.recursive;
+			subscription->mWatch = watch;
+			watch->mSubscriptions.push_back(subscription);
+			mSubscriptions[subscription->mID] = subscription;
+
+			// a listener adding a watch must not wait for the thread it runs on
+			ready = watch->mReady;
+			wait = mDepth == 0 && watch->mPending > 0;
+		}
+
+		if(wait)
+			ready.get();
+		return subscription->mID;
+	}
+
+	//--------
+	void WatchReactor::unsubscribe(const SharedFileWatcher* owner, WatchID watchid)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		std::unordered_map<WatchID, SubscriptionPtr>::iterator iter = mSubscriptions.find(watchid);
+		if(iter == mSubscriptions.end() || iter->second->mOwner != owner)
+			return;
+
+		// release erases the entry the iterator points at
+		SubscriptionPtr subscription = iter->second;
+		release(subscription);
+	}
+
+	//--------
+	void WatchReactor::unsubscribe(const SharedFileWatcher* owner, const String& directory)
+	{
+		String key = normalizeDirectory(directory);
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		std::vector<SubscriptionPtr> matches;
+		std::unordered_map<WatchID, SubscriptionPtr>::iterator iter = mSubscriptions.begin();
+		for(; iter != mSubscriptions.end(); ++iter)
+		{
+			if(iter->second->mOwner == owner && iter->second->mDirectory == key)
+				matches.push_back(iter->second);
+		}
+
+		for(size_t i = 0; i < matches.size(); ++i)
+			release(matches[i]);
+	}
+
+	//--------
+	void WatchReactor::unsubscribeAll(const SharedFileWatcher* owner)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		std::vector<SubscriptionPtr> matches;
+		std::unordered_map<WatchID, SubscriptionPtr>::iterator iter = mSubscriptions.begin();
+		for(; iter != mSubscriptions.end(); ++iter)
+		{
+			if(iter->second->mOwner == owner)
+				matches.push_back(iter->second);
+		}
+
+		for(size_t i = 0; i < matches.size(); ++i)
+			release(matches[i]);
+	}
+
+	//--------
+	void WatchReactor::submitAdd(const WatchPtr& watch, const String& directory, const WatchOptions& options)
+	{
+		WatchBatch batch;
+		// a watch that exists is added again with recursion; removing it by
+		// path also covers a first add that has not run yet
+		if(watch->mCoreID || watch->mPending)
+			batch.removeWatch(directory);
+
+		WatchOptions add = options;
+		add.recursive = watch->mRecursive;
+		batch.addWatch(directory, this, add);
+
+		std::shared_ptr<std::promise<void> > ready = std::make_shared<std::promise<void> >();
+		watch->mReady = ready->get_future().share();
+		++watch->mPending;
+
+		mWatcher.submit(batch, [this, watch, ready](const std::vector<WatchResult>& results) {
+			completeAdd(watch, results.back(), ready);
+		});
+	}
+
+	//--------
+	void WatchReactor::completeAdd(const WatchPtr& watch, const WatchResult& result, const std::shared_ptr<std::promise<void> >& ready)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		--watch->mPending;
+
+		if(watch->mCoreID)
+		{
+			std::unordered_map<WatchID, WatchPtr>::iterator iter = mByCoreID.find(watch->mCoreID);
+			if(iter != mByCoreID.end() && iter->second == watch)
+				mByCoreID.erase(iter);
+			watch->mCoreID = 0;
+		}
+
+		if(result.failed())
+		{
+			// the watches waiting on this add go away with it
+			for(size_t i = 0; i < watch->mSubscriptions.size(); ++i)
+			{
+				mSubscriptions.erase(watch->mSubscriptions[i]->mID);
+				mRouter.unsubscribe(watch->mSubscriptions[i]->mID);
+				watch->mSubscriptions[i]->mListener = 0;
+				watch->mSubscriptions[i]->mWatch.reset();
+			}
+			watch->mSubscriptions.clear();
+			drop(watch);
+			ready->set_exception(result.error);
+			return;
+		}
+
+		watch->mCoreID = result.watchid;
+		std::unordered_map<WatchID, WatchPtr>::iterator iter = mByCoreID.find(watch->mCoreID);
+		if(iter != mByCoreID.end() && iter->second != watch)
+		{
+			// the directory is already covered by another kernel watch, for
+			// example as a child of a recursive one; share that watch
+			WatchPtr existing = iter->second;
+			for(size_t i = 0; i < watch->mSubscriptions.size(); ++i)
+			{
+				watch->mSubscriptions[i]->mWatch = existing;
+				existing->mSubscriptions.push_back(watch->mSubscriptions[i]);
+			}
+			for(size_t i = 0; i < watch->mKeys.size(); ++i)
+			{
+				mByDirectory[watch->mKeys[i]] = existing;
+				existing->mKeys.push_back(watch->mKeys[i]);
+			}
+			watch->mSubscriptions.clear();
+			watch->mKeys.clear();
+			watch->mCoreID = 0;
+			drop(existing);
+		}
+		else
+		{
+			mByCoreID[watch->mCoreID] = watch;
+			drop(watch);
+		}
+
+		ready->set_value();
+	}
+
+	//--------
+	void WatchReactor::release(const SubscriptionPtr& subscription)
+	{
+		mSubscriptions.erase(subscription->mID);
+		mRouter.unsubscribe(subscription->mID);
+		subscription->mListener = 0;
+
+		WatchPtr watch = subscription->mWatch;
+		subscription->mWatch.reset();
+		if(!watch)
+			return;
+
+		std::vector<SubscriptionPtr>& list = watch->mSubscriptions;
+		list.erase(std::remove(list.begin(), list.end(), subscription), list.end());
+		drop(watch);
+	}
+
+	//--------
+	void WatchReactor::drop(const WatchPtr& watch)
+	{
+		if(watch->mPending)
+			return;
+
+		for(size_t i = 0; i < watch->mSubscriptions.size(); ++i)
+		{
+			if(watch->mSubscriptions[i]->mListener)
+				return;
+		}
+
+		for(size_t i = 0; i < watch->mKeys.size(); ++i)
+		{
+			std::map<String, WatchPtr>::iterator iter = mByDirectory.find(watch->mKeys[i]);
+			if(iter != mByDirectory.end() && iter->second == watch)
+				mByDirectory.erase(iter);
+		}
+		watch->mKeys.clear();
+
+		if(watch->mCoreID)
+		{
+			mByCoreID.erase(watch->mCoreID);
+			mWatcher.removeWatch(watch->mCoreID);
+			watch->mCoreID = 0;
+		}
+	}
+
+	//--------
+	void WatchReactor::handleFileAction(WatchID watchid, const String& dir, const String& filename, Action action)
+	{
+		handleFileEvent(watchid, dir, filename, action, FileInfo());
+	}
+
+	//--------
+	void WatchReactor::handleFileEvent(WatchID watchid, const String& dir, const String& filename, Action action, const FileInfo& info)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		if(!mByCoreID.count(watchid))
+			return;
+
+		// the router skips subscriptions added or removed by a listener
+		FanOutScope scope(mDepth);
+		mRouter.handleFileEvent(watchid, dir, filename, action, info);
+	}
+
+	//--------
+	void WatchReactor::handleChangeset(WatchID watchid, const Changeset& changes)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mMutex);
+		if(!mByCoreID.count(watchid))
+			return;
+
+		FanOutScope scope(mDepth);
+		mRouter.handleChangeset(watchid, changes);
+	}
+
+	//--------
+	SharedFileWatcher::SharedFileWatcher(WatchReactor& reactor)
+		: mReactor(reactor)
+	{
+	}
+
+	//--------
+	SharedFileWatcher::~SharedFileWatcher()
+	{
+		mReactor.unsubscribeAll(this);
+	}
+
+	//--------
+	WatchID SharedFileWatcher::addWatch(const String& directory, FileWatchListener* watcher, bool recursive)
+	{
+		WatchOptions options;
+		options.recursive = recursive;
+		return mReactor.subscribe(this, directory, watcher, options);
+	}
+
+	//--------
+	WatchID SharedFileWatcher::addWatch(const String& directory, FileWatchListener* watcher, const WatchOptions& options)
+	{
+		return mReactor.subscribe(this, directory, watcher, options);
+	}
+
+	//--------
+	void SharedFileWatcher::removeWatch(const String& directory)
+	{
+		mReactor.unsubscribe(this, directory);
+	}
+
+	//--------
+	void SharedFileWatcher::removeWatch(WatchID watchid)
+	{
+		mReactor.unsubscribe(this, watchid);
+	}
+
+};//namespace FW
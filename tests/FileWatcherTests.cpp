@@ -0,0 +1,347 @@
+/**
+	filewatchtests, tests of the listener stages driven by FileWatcherFake.
+	Events are injected instead of read from the kernel, so every case
+	runs without touching the file system and on the fake clock.
+
+	usage: filewatchtests [case]
+		runs every case, or the one named
+
+	Copyright (c) 2009 James Wynn (james@jameswynn.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <FileWatcher/FileWatcher.h>
+#include <FileWatcher/EventQueue.h>
+#include <FileWatcher/FileWatcherFake.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+
+static int gFailures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool passed, const char* condition, const char* file, int line)
+{
+	if(passed)
+		return;
+	fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, condition);
+	++gFailures;
+}
+
+/// Records what reaches it, single events and changesets apart
+class RecordingListener : public FW::FileWatchListener
+{
+public:
+	RecordingListener() : mThrowAt(0) {}
+
+	void handleFileAction(FW::WatchID watchid, const FW::String& dir, const FW::String& filename, FW::Action action)
+	{
+		FW::Change change;
+		change.dir = dir;
+		change.filename = filename;
+		change.action = action;
+		mEvents.push_back(change);
+
+		// the listener fails on the event numbered mThrowAt, counting from 1
+		if(mEvents.size() == mThrowAt)
+			throw std::runtime_error("listener failed");
+	}
+
+	void handleChangeset(FW::WatchID watchid, const FW::Changeset& changes)
+	{
+		mChangesets.push_back(changes);
+	}
+
+	/// Names of the events received, in order
+	FW::String names() const
+	{
+		FW::String names;
+		for(size_t i = 0; i < mEvents.size(); ++i)
+			names += mEvents[i].filename;
+		return names;
+	}
+
+	FW::Changeset mEvents;
+	std::vector<FW::Changeset> mChangesets;
+	size_t mThrowAt;
+};
+
+//--------
+static void testPauseResume()
+{
+	FW::FileWatcherFake* fake = new FW::FileWatcherFake();
+	FW::FileWatcher watcher(fake);
+	RecordingListener listener;
+
+	FW::WatchID watchid = watcher.addWatch("/w", &listener, false);
+	CHECK(watcher.pause(watchid));
+	CHECK(!watcher.pause(watchid));
+
+	fake->inject("/w", "a", FW::Actions::Add);
+	fake->inject("/w", "a", FW::Actions::Modified);
+	fake->inject("/w", "b", FW::Actions::Add);
+	fake->inject("/w", "b", FW::Actions::Delete);
+	fake->inject("/w", "c", FW::Actions::Modified);
+	watcher.update();
+	CHECK(listener.mEvents.empty());
+	CHECK(listener.mChangesets.empty());
+
+	// the net changes, in the order they first happened
+	CHECK(watcher.resume(watchid));
+	CHECK(!watcher.resume(watchid));
+	CHECK(listener.mChangesets.size() == 1);
+	if(listener.mChangesets.size() == 1)
+	{
+		const FW::Changeset& changes = listener.mChangesets[0];
+		CHECK(changes.size() == 2);
+		CHECK(changes.size() == 2 && changes[0].filename == "a" && changes[0].action == FW::Actions::Add);
+		CHECK(changes.size() == 2 && changes[1].filename == "c" && changes[1].action == FW::Actions::Modified);
+	}
+
+	fake->inject("/w", "d", FW::Actions::Add);
+	watcher.update();
+	CHECK(listener.names() == "d");
+
+	// nothing held for a watch removed while paused
+	CHECK(watcher.pause(watchid));
+	watcher.removeWatch(watchid);
+	CHECK(!watcher.resume(watchid));
+}
+
+//--------
+static void testPauseKeepsStages()
+{
+	FW::FileWatcherFake* fake = new FW::FileWatcherFake();
+	FW::FileWatcher watcher(fake);
+	watcher.enableHeavyHitters();
+	RecordingListener listener;
+
+	FW::WatchOptions options;
+	options.settleTime = 50;
+	options.historySize = 16;
+	FW::WatchID watchid = watcher.addWatch("/w", &listener, options);
+	FW::ClockToken start = watcher.getClock();
+
+	CHECK(watcher.pause(watchid));
+	fake->inject("/w", "a", FW::Actions::Add);
+	fake->inject("/w", "b", FW::Actions::Modified);
+	watcher.update();
+
+	// the history and the heavy hitters still see the paused events
+	CHECK(watcher.query(watchid, start).changes.size() == 2);
+	CHECK(watcher.getHeavyHitters().events == 2);
+
+	// held back for longer than the settle time
+	fake->advance(100);
+	watcher.update();
+	CHECK(listener.mChangesets.empty());
+
+	// they settled while paused, so they go out with resume
+	CHECK(watcher.resume(watchid));
+	CHECK(listener.mChangesets.size() == 1);
+	CHECK(listener.mChangesets.size() == 1 && listener.mChangesets[0].size() == 2);
+	CHECK(listener.mEvents.empty());
+}
+
+//--------
+static void testQueueDropOldest()
+{
+	FW::FileWatcherFake* fake = new FW::FileWatcherFake();
+	FW::BufferedFileWatcher watcher(fake, FW::QueueOptions(4, FW::QueuePolicies::DropOldest));
+	RecordingListener listener;
+	watcher.addWatch("/w", &listener);
+	watcher.update();
+
+	const char* names[] = { "a", "b", "c", "d", "e", "f" };
+	for(size_t i = 0; i < 6; ++i)
+		fake->inject("/w", names[i], FW::Actions::Add);
+	watcher.update();
+
+	// the overflow notice comes first, then the newest events
+	FW::QueueStats stats = watcher.getQueueStats();
+	CHECK(stats.dropped == 2);
+	CHECK(stats.depth == 0);
+	CHECK(listener.mEvents.size() == 5);
+	CHECK(!listener.mEvents.empty() && listener.mEvents[0].action == FW::Actions::Overflow);
+	CHECK(!listener.mEvents.empty() && listener.mEvents[0].dir == "/w");
+	CHECK(listener.names() == "cdef");
+}
+
+//--------
+static void testQueueCoalesce()
+{
+	FW::FileWatcherFake* fake = new FW::FileWatcherFake();
+	FW::BufferedFileWatcher watcher(fake, FW::QueueOptions(4, FW::QueuePolicies::Coalesce));
+	RecordingListener listener;
+	watcher.addWatch("/w", &listener);
+	watcher.update();
+
+	fake->inject("/w", "a", FW::Actions::Add);
+	for(size_t i = 0; i < 8; ++i)
+		fake->inject("/w", "a", FW::Actions::Modified);
+	fake->inject("/w", "b", FW::Actions::Modified);
+	fake->inject("/w", "c", FW::Actions::Add);
+	fake->inject("/w", "c", FW::Actions::Delete);
+	watcher.update();
+
+	// one event per file with the net action, the created and deleted
+	// one cancels out
+	FW::QueueStats stats = watcher.getQueueStats();
+	CHECK(stats.dropped == 0);
+	CHECK(stats.coalesced == 9);
+	CHECK(listener.names() == "ab");
+	CHECK(listener.mEvents.size() == 2 && listener.mEvents[0].action == FW::Actions::Add);
+	CHECK(listener.mEvents.size() == 2 && listener.mEvents[1].action == FW::Actions::Modified);
+}
+
+//--------
+static void testQueueBlock()
+{
+	// the queue stands between reader and listener as in BufferedFileWatcher
+	FW::FileWatcherFake fake;
+	FW::EventQueue queue(FW::QueueOptions(4, FW::QueuePolicies::Block), false);
+	RecordingListener listener;
+	FW::WatchID watchid = fake.addWatch("/w", &queue, false);
+	queue.setListener(watchid, &listener);
+
+	const char* names[] = { "a", "b", "c", "d", "e", "f", "g", "h" };
+	for(size_t i = 0; i < 8; ++i)
+		fake.inject("/w", names[i], FW::Actions::Add);
+	fake.update();
+
+	// a read may go past the bound, then the reader is asked to pause
+	CHECK(queue.isFull());
+	CHECK(listener.mEvents.empty());
+
+	// nothing is lost, the events wait instead
+	CHECK(queue.dispatch() == 8);
+	CHECK(!queue.isFull());
+	FW::QueueStats stats = queue.getStats();
+	CHECK(stats.dropped == 0);
+	CHECK(stats.highWater == 8);
+	CHECK(listener.names() == "abcdefgh");
+}
+
+//--------
+static void testListenerThrows()
+{
+	FW::FileWatcherFake fake;
+	RecordingListener listener;
+	listener.mThrowAt = 2;
+	FW::WatchID watchid = fake.addWatch("/w", &listener, false);
+
+	fake.inject("/w", "a", FW::Actions::Add);
+	fake.inject(watchid, "b", FW::Actions::Modified, 3);
+	fake.inject("/w", "c", FW::Actions::Add);
+
+	bool thrown = false;
+	try
+	{
+		fake.update();
+	}
+	catch(const std::runtime_error&)
+	{
+		thrown = true;
+	}
+	CHECK(thrown);
+
+	// the failed event counts as delivered, the rest waits in order
+	CHECK(fake.getDeliveredCount() == 2);
+	CHECK(fake.getPendingCount() == 3);
+
+	fake.update();
+	CHECK(fake.getPendingCount() == 0);
+	CHECK(fake.getDeliveredCount() == 5);
+	CHECK(listener.names() == "abbbc");
+}
+
+//--------
+static void testListenerThrowsBehindStages()
+{
+	FW::FileWatcherFake* fake = new FW::FileWatcherFake();
+	FW::FileWatcher watcher(fake);
+	RecordingListener listener;
+	listener.mThrowAt = 1;
+
+	FW::WatchOptions options;
+	options.historySize = 16;
+	FW::WatchID watchid = watcher.addWatch("/w", &listener, options);
+	FW::ClockToken start = watcher.getClock();
+
+	fake->inject("/w", "a", FW::Actions::Add);
+	fake->inject("/w", "b", FW::Actions::Add);
+
+	bool thrown = false;
+	try
+	{
+		watcher.update();
+	}
+	catch(const std::runtime_error&)
+	{
+		thrown = true;
+	}
+	CHECK(thrown);
+
+	watcher.update();
+	CHECK(listener.names() == "ab");
+	// recorded once each, the failed event is not recorded again
+	CHECK(watcher.query(watchid, start).changes.size() == 2);
+}
+
+struct TestCase
+{
+	const char* mName;
+	void (*mRun)();
+};
+
+static const TestCase gTests[] =
+{
+	{ "pause_resume", testPauseResume },
+	{ "pause_keeps_stages", testPauseKeepsStages },
+	{ "queue_drop_oldest", testQueueDropOldest },
+	{ "queue_coalesce", testQueueCoalesce },
+	{ "queue_block", testQueueBlock },
+	{ "listener_throws", testListenerThrows },
+	{ "listener_throws_behind_stages", testListenerThrowsBehindStages }
+};
+
+int main(int argc, char **argv)
+{
+	bool found = false;
+	for(size_t i = 0; i < sizeof(gTests) / sizeof(gTests[0]); ++i)
+	{
+		if(argc > 1 && strcmp(argv[1], gTests[i].mName) != 0)
+			continue;
+
+		found = true;
+		int failures = gFailures;
+		gTests[i].mRun();
+		printf("%s %s\n", gFailures == failures ? "passed" : "FAILED", gTests[i].mName);
+	}
+
+	if(!found)
+	{
+		fprintf(stderr, "Error: no case named %s\n", argv[1]);
+		return 1;
+	}
+	return gFailures ? 1 : 0;
+}